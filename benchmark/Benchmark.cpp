@@ -0,0 +1,841 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <BinLogWriter.h>
+#include <CmdLineParsing.h>
+#include <SmapsParser.h>
+#include <Storage.h>
+#include <String.h>
+#include <Utils.h>
+#include <Version.h>
+
+#include <QtCore/QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+struct Arguments {
+  bool help{false};
+  bool version{false};
+  QString benchmark;
+  QString smapsFile{"/proc/self/smaps"};
+  unsigned long iterations{1000};
+  unsigned long ranges{1000};
+  unsigned long period{60000};
+  unsigned long keyframeInterval{60};
+};
+
+class ArgParser: public CmdLineParser {
+private:
+  Arguments args;
+
+public:
+  ArgParser(QCoreApplication *app,
+            int argc, char *argv[])
+    : CmdLineParser(app->applicationName().toStdString(), argc, argv) {
+
+    using namespace std::string_literals;
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.help = value;
+              }),
+              std::vector<std::string>{"h", "help"},
+              "Display help and exits",
+              true);
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.version = value;
+              }),
+              std::vector<std::string>{"v", "version"},
+              "Display application version and exits",
+              false);
+
+    AddOption(CmdLineStringOption([this](const std::string &value){
+                args.smapsFile = QString::fromStdString(value);
+              }),
+              "smaps-file",
+              "smaps file used by smaps benchmark. Default is "s + args.smapsFile.toStdString());
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                args.iterations = value;
+              }),
+              "iterations",
+              "Number of iterations. Default is "s + std::to_string(args.iterations));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                args.ranges = value;
+              }),
+              "ranges",
+              "Number of memory ranges in measurement used by insert, read, seek, blob and schema benchmark. Default is "s + std::to_string(args.ranges));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                args.period = value;
+              }),
+              "period",
+              "Period of measurements [ms] in recordings of seek and schema benchmark. Default is "s + std::to_string(args.period));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                args.keyframeInterval = value;
+              }),
+              "keyframe-interval",
+              "Keyframe interval of delta recordings in seek benchmark. Default is "s + std::to_string(args.keyframeInterval));
+
+    AddPositional(CmdLineStringOption([this](const std::string &value){
+                    args.benchmark = QString::fromStdString(value);
+                  }),
+                  "benchmark",
+                  "Benchmark to run:"s
+                  "\n\tsmaps - smaps parsing, lines/s of QTextStream based parser and SmapsParser"s
+                  "\n\tinsert - measurement inserts, rows/s of QtSql, sqlite3 API and binary log"s
+                  "\n\tread - measurement reads as memory-chart does, rows/s of QtSql with and without statement cache, sqlite3 API and series scan"s
+                  "\n\tseek - reads of measurement at random time in delta recordings of 1, 7 and 30 days, seeks/s and latency"s
+                  "\n\tblob - database size and series scan, rows/s of data rows, blobs and compressed blobs"s
+                  "\n\tschema - one day recording with schema v1 converted by memory-migrate, database size and seek latency of both"s);
+  }
+
+  Arguments GetArguments() const {
+    return args;
+  }
+};
+
+namespace legacy {
+
+// smaps parsing as it was implemented before SmapsParser, for comparison
+
+size_t parseMemory(const QString &line) {
+  QStringList arr = line.split(" ", SkipEmptyParts);
+  if (arr.size() != 3) {
+    return 0;
+  }
+  return arr[1].toULongLong();
+}
+
+void parseRange(SmapsRange &range, const QString &line) {
+  QStringList arr = line.split(" ", SkipEmptyParts);
+  if (arr.size() < 5) {
+    return;
+  }
+  QStringList arr2 = arr[0].split("-", SkipEmptyParts);
+  if (arr2.size() != 2) {
+    return;
+  }
+  range.key.from = arr2[0].toULongLong(nullptr, 16);
+  range.key.to = arr2[1].toULongLong(nullptr, 16);
+  range.key.name = arr.size() >= 6 ? arr[5] : "";
+  range.key.permission = arr[1];
+  range.rss = 0;
+  range.pss = 0;
+}
+
+QString lastLineStart(const QString &file) {
+  QFile inputFile(file);
+  if (!inputFile.open(QIODevice::ReadOnly)) {
+    return QString();
+  }
+  QTextStream in(&inputFile);
+  QString lastLine;
+  for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
+    lastLine = line;
+  }
+  QStringList arr = lastLine.split(":", SkipEmptyParts);
+  return arr.size() == 2 ? arr[0] : QString();
+}
+
+bool readSmaps(const QString &file, const QString &lastLineStart, QList<SmapsRange> &ranges, size_t &lines) {
+  QFile inputFile(file);
+  if (!inputFile.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  QTextStream in(&inputFile);
+  bool rangeLine = true;
+  SmapsRange range;
+  for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
+    lines++;
+    if (rangeLine) {
+      parseRange(range, line);
+      rangeLine = false;
+    } else {
+      if (line.startsWith(lastLineStart)) {
+        rangeLine = true;
+        ranges << range;
+      } else if (line.startsWith("Rss:")) {
+        range.rss = parseMemory(line);
+      } else if (line.startsWith("Pss:")) {
+        range.pss = parseMemory(line);
+      }
+    }
+  }
+  return true;
+}
+
+// recording with schema v1, as it was written before schema versioning, for comparison
+
+bool execAll(QSqlDatabase &db, const QStringList &statements) {
+  for (const QString &sql: statements) {
+    QSqlQuery q = db.exec(sql);
+    if (q.lastError().isValid()) {
+      qWarning() << "Executing" << sql << "failed" << q.lastError();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeRecording(QSqlDatabase &db, const ProcessId &processId, const QList<SmapsRange> &ranges,
+                    const QDateTime &start, qint64 count, qint64 period) {
+  if (!execAll(db, {
+        "CREATE TABLE `process` ("
+        "  `id` UNSIGNED BIG INT PRIMARY KEY, `pid` INTEGER NOT NULL, `start_time` INTEGER NOT NULL,"
+        "  `name` varchar(255) NULL);",
+        "CREATE TABLE `memory_range` ("
+        "  `id` UNSIGNED BIG INT PRIMARY KEY,"
+        "  `process_id` UNSIGNED BIG INT NOT NULL REFERENCES `process`(`id`) ON DELETE CASCADE,"
+        "  `from` INTEGER NOT NULL, `to` INTEGER NOT NULL,"
+        "  `permission` varchar(255) NULL, `name` varchar(255) NULL);",
+        "CREATE TABLE `measurement` ("
+        "  `id` UNSIGNED BIG INT PRIMARY KEY,"
+        "  `process_id` UNSIGNED BIG INT NOT NULL REFERENCES `process`(`id`) ON DELETE CASCADE,"
+        "  `time` datetime NOT NULL, `rss_sum` INTEGER NOT NULL, `pss_sum` INTEGER NOT NULL,"
+        "  `oom_adj` INTEGER NOT NULL, `oom_score` INTEGER NOT NULL, `oom_score_adj` INTEGER NOT NULL,"
+        "  `statm_size` INTEGER NOT NULL, `statm_resident` INTEGER NOT NULL, `statm_shared` INTEGER NOT NULL,"
+        "  `statm_text` INTEGER NOT NULL, `statm_lib` INTEGER NOT NULL, `statm_data` INTEGER NOT NULL,"
+        "  `statm_dt` INTEGER NOT NULL);",
+        "CREATE TABLE `data` ("
+        "  `range_id` UNSIGNED BIG INT NOT NULL REFERENCES `memory_range`(`id`) ON DELETE CASCADE,"
+        "  `measurement_id` UNSIGNED BIG INT NOT NULL REFERENCES `measurement`(`id`) ON DELETE CASCADE,"
+        "  `rss` INTEGER NOT NULL, `pss` INTEGER NOT NULL);",
+        "CREATE INDEX `idx_data_measurement_id` ON `data` (`measurement_id`);",
+        "CREATE TABLE `system_memory` ("
+        "  `time` datetime NOT NULL, `mem_total` INTEGER NOT NULL, `mem_free` INTEGER NOT NULL,"
+        "  `mem_available` INTEGER NOT NULL, `buffers` INTEGER NOT NULL, `cached` INTEGER NOT NULL,"
+        "  `swap_cache` INTEGER NOT NULL, `swap_total` INTEGER NOT NULL, `swap_free` INTEGER NOT NULL,"
+        "  `anon_pages` INTEGER NOT NULL, `mapped` INTEGER NOT NULL, `shmem` INTEGER NOT NULL,"
+        "  `slab` INTEGER NOT NULL, `s_reclaimable` INTEGER NOT NULL);"})) {
+    return false;
+  }
+
+  // hashes and times are bound as the old recorder did
+  QSqlQuery processInsert(db);
+  processInsert.prepare("INSERT INTO `process` (`id`, `pid`, `start_time`, `name`) VALUES (?, ?, ?, ?)");
+  QSqlQuery rangeInsert(db);
+  rangeInsert.prepare("INSERT OR IGNORE INTO `memory_range` (`id`, `process_id`, `from`, `to`, `permission`, `name`) "
+                      "VALUES (?, ?, ?, ?, ?, ?)");
+  QSqlQuery measurementInsert(db);
+  measurementInsert.prepare("INSERT INTO `measurement` (`id`, `process_id`, `time`, `rss_sum`, `pss_sum`,"
+                            "  `oom_adj`, `oom_score`, `oom_score_adj`, `statm_size`, `statm_resident`, `statm_shared`,"
+                            "  `statm_text`, `statm_lib`, `statm_data`, `statm_dt`"
+                            ") VALUES (?, ?, ?, ?, ?, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)");
+  QSqlQuery dataInsert(db);
+  dataInsert.prepare("INSERT INTO `data` (`range_id`, `measurement_id`, `rss`, `pss`) VALUES (?, ?, ?, ?)");
+  QSqlQuery systemInsert(db);
+  systemInsert.prepare("INSERT INTO `system_memory` (`time`, `mem_total`, `mem_free`, `mem_available`,"
+                       "  `buffers`, `cached`, `swap_cache`, `swap_total`, `swap_free`, `anon_pages`, `mapped`,"
+                       "  `shmem`, `slab`, `s_reclaimable`"
+                       ") VALUES (?, 16777216, ?, ?, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)");
+
+  auto exec = [](QSqlQuery &q) {
+    if (!q.exec()) {
+      qWarning() << "Insert failed" << q.lastError();
+      return false;
+    }
+    return true;
+  };
+
+  db.transaction();
+  processInsert.addBindValue(processId.hash());
+  processInsert.addBindValue(processId.pid);
+  processInsert.addBindValue(processId.startTime);
+  processInsert.addBindValue("benchmark");
+  bool result = exec(processInsert);
+  for (const SmapsRange &range: ranges) {
+    rangeInsert.addBindValue(range.key.hash());
+    rangeInsert.addBindValue(processId.hash());
+    rangeInsert.addBindValue(qlonglong(range.key.from));
+    rangeInsert.addBindValue(qlonglong(range.key.to));
+    rangeInsert.addBindValue(range.key.permission);
+    rangeInsert.addBindValue(range.key.name);
+    result = result && exec(rangeInsert);
+  }
+  for (qint64 i = 0; result && i < count; i++) {
+    QDateTime time = start.addMSecs(i * period);
+    qulonglong measurementId = processId.hash() ^ qHash(time);
+    measurementInsert.addBindValue(measurementId);
+    measurementInsert.addBindValue(processId.hash());
+    measurementInsert.addBindValue(time);
+    measurementInsert.addBindValue(qlonglong(ranges.size()));
+    measurementInsert.addBindValue(qlonglong(ranges.size()));
+    result = exec(measurementInsert);
+    for (const SmapsRange &range: ranges) {
+      dataInsert.addBindValue(range.key.hash());
+      dataInsert.addBindValue(measurementId);
+      dataInsert.addBindValue(qlonglong(range.rss + (i % 100)));
+      dataInsert.addBindValue(qlonglong(range.pss));
+      result = result && exec(dataInsert);
+    }
+    systemInsert.addBindValue(time);
+    systemInsert.addBindValue(qlonglong(i % 1024));
+    systemInsert.addBindValue(qlonglong(i % 2048));
+    result = result && exec(systemInsert);
+  }
+  if (!result) {
+    db.rollback();
+    return false;
+  }
+  return db.commit();
+}
+
+} // namespace legacy
+
+void printResult(const std::string &name, size_t count, qint64 nanoseconds, const std::string &unit = "lines") {
+  double seconds = double(nanoseconds) / 1e9;
+  std::cout << std::setw(24) << std::left << name
+            << std::setw(12) << std::right << count << " " << unit << " "
+            << std::setw(10) << std::right << std::fixed << std::setprecision(3) << seconds << " s "
+            << std::setw(14) << std::right << std::setprecision(0) << (seconds > 0 ? double(count) / seconds : 0) << " " << unit << "/s"
+            << std::endl;
+}
+
+void printSpeedup(size_t count, qint64 nanoseconds, size_t baseCount, qint64 baseNanoseconds) {
+  if (nanoseconds > 0 && baseCount > 0) {
+    double speedup = (double(count) / nanoseconds) / (double(baseCount) / baseNanoseconds);
+    std::cout << "speedup: " << std::setprecision(2) << speedup << "x" << std::endl;
+  }
+}
+
+bool smapsBenchmark(const Arguments &args) {
+  QString lastLineStart = legacy::lastLineStart(args.smapsFile);
+  if (lastLineStart.isEmpty()) {
+    qWarning() << "Can't read" << args.smapsFile;
+    return false;
+  }
+
+  QElapsedTimer timer;
+  size_t legacyLines = 0;
+  timer.start();
+  for (unsigned long i = 0; i < args.iterations; i++) {
+    QList<SmapsRange> ranges;
+    if (!legacy::readSmaps(args.smapsFile, lastLineStart, ranges, legacyLines)) {
+      qWarning() << "Can't read" << args.smapsFile;
+      return false;
+    }
+  }
+  qint64 legacyTime = timer.nsecsElapsed();
+
+  SmapsParser parser;
+  size_t parserLines = 0;
+  timer.restart();
+  for (unsigned long i = 0; i < args.iterations; i++) {
+    QList<SmapsRange> ranges;
+    if (!parser.parse(args.smapsFile, ranges)) {
+      qWarning() << "Can't read" << args.smapsFile;
+      return false;
+    }
+    parserLines += parser.lineCount();
+  }
+  qint64 parserTime = timer.nsecsElapsed();
+
+  printResult("QTextStream", legacyLines, legacyTime);
+  printResult("SmapsParser", parserLines, parserTime);
+  printSpeedup(parserLines, parserTime, legacyLines, legacyTime);
+  return true;
+}
+
+QList<SmapsRange> benchmarkRanges(const ProcessId &processId, unsigned long count) {
+  QList<SmapsRange> ranges;
+  for (unsigned long i = 0; i < count; i++) {
+    SmapsRange range;
+    range.key.processId = processId;
+    range.key.from = i * 0x10000;
+    range.key.to = range.key.from + 0x1000;
+    range.key.permission = "r-xp";
+    range.key.name = QString("/usr/lib/libbenchmark%1.so").arg(i % 100);
+    range.rss = i % 1000;
+    range.pss = i % 500;
+    ranges << range;
+  }
+  return ranges;
+}
+
+// Writer is Storage or BinLogWriter
+template <typename Writer>
+bool insertProcess(Writer &writer, const ProcessId &processId, const QList<SmapsRange> &ranges) {
+  writer.transaction();
+  writer.insertOrIgnoreProcess(processId, "benchmark");
+  for (const SmapsRange &range: ranges) {
+    writer.insertOrIgnoreRange(range.key);
+  }
+  return writer.commit();
+}
+
+/** Measurements of the process in single transaction, 1% of ranges changes between measurements */
+bool insertMeasurements(Storage &storage, const ProcessId &processId, const QList<SmapsRange> &ranges,
+                        const QDateTime &start, qint64 count, qint64 period) {
+  QList<SmapsRange> snapshot = ranges;
+  storage.transaction();
+  for (qint64 i = 0; i < count; i++) {
+    for (int j = int(i % 100); j < snapshot.size(); j += 100) {
+      snapshot[j].rss++;
+    }
+    QDateTime time = start.addMSecs(i * period);
+    storage.insertMeasurement(processId, time, FullSmaps, 0, 0, StatM{}, OomScore{});
+    if (!storage.insertData(processId, time, snapshot)) {
+      storage.rollback();
+      return false;
+    }
+  }
+  return storage.commit();
+}
+
+bool insertBenchmark(const Arguments &args) {
+  QTemporaryDir dir;
+  if (!dir.isValid()) {
+    qWarning() << "Can't create temporary directory";
+    return false;
+  }
+  Storage storage;
+  if (!storage.init(dir.filePath("benchmark.db"))) {
+    return false;
+  }
+
+  ProcessId processId(1, ProcessId::StartTime(1));
+  QList<SmapsRange> ranges = benchmarkRanges(processId, args.ranges);
+  if (!insertProcess(storage, processId, ranges)) {
+    return false;
+  }
+
+  QDateTime time = QDateTime::currentDateTime();
+  auto insert = [&](qint64 &nanoseconds) {
+    QElapsedTimer timer;
+    timer.start();
+    storage.transaction();
+    for (unsigned long i = 0; i < args.iterations; i++) {
+      time = time.addMSecs(1);
+      storage.insertMeasurement(processId, time, FullSmaps, 0, 0, StatM{}, OomScore{});
+      if (!storage.insertData(processId, time, ranges)) {
+        storage.rollback();
+        return false;
+      }
+    }
+    storage.commit();
+    nanoseconds = timer.nsecsElapsed();
+    return true;
+  };
+
+  size_t rows = args.iterations * (args.ranges + 1);
+  qint64 qtSqlTime = 0;
+  storage.setNativeWrites(false);
+  if (!insert(qtSqlTime)) {
+    return false;
+  }
+  printResult("QtSql", rows, qtSqlTime, "rows");
+
+  if (!storage.setNativeWrites(true)) {
+    qWarning() << "Native writes are not available";
+    return false;
+  }
+  qint64 nativeTime = 0;
+  if (!insert(nativeTime)) {
+    return false;
+  }
+  printResult("sqlite3", rows, nativeTime, "rows");
+  printSpeedup(rows, nativeTime, rows, qtSqlTime);
+
+  BinLogWriter binLog;
+  if (!binLog.init(dir.filePath("binlog"), 16 * 1024 * 1024) ||
+      !insertProcess(binLog, processId, ranges)) {
+    return false;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  binLog.transaction();
+  for (unsigned long i = 0; i < args.iterations; i++) {
+    time = time.addMSecs(1);
+    binLog.insertMeasurement(processId, time, FullSmaps, 0, 0, StatM{}, OomScore{});
+    if (!binLog.insertData(processId, time, ranges)) {
+      return false;
+    }
+  }
+  if (!binLog.commit()) {
+    return false;
+  }
+  qint64 binLogTime = timer.nsecsElapsed();
+  printResult("binary log", rows, binLogTime, "rows");
+  printSpeedup(rows, binLogTime, rows, nativeTime);
+  return true;
+}
+
+bool readBenchmark(const Arguments &args) {
+  QTemporaryDir dir;
+  if (!dir.isValid()) {
+    qWarning() << "Can't create temporary directory";
+    return false;
+  }
+  QString file = dir.filePath("benchmark.db");
+  ProcessId processId(1, ProcessId::StartTime(1));
+  QList<QDateTime> times;
+  {
+    Storage storage;
+    if (!storage.init(file)) {
+      return false;
+    }
+    QList<SmapsRange> ranges = benchmarkRanges(processId, args.ranges);
+    if (!insertProcess(storage, processId, ranges)) {
+      return false;
+    }
+    QDateTime time = QDateTime::currentDateTime();
+    storage.transaction();
+    for (unsigned long i = 0; i < args.iterations; i++) {
+      time = time.addMSecs(1000);
+      storage.insertMeasurement(processId, time, FullSmaps, 0, 0, StatM{}, OomScore{});
+      if (!storage.insertData(processId, time, ranges)) {
+        storage.rollback();
+        return false;
+      }
+      times << time;
+    }
+    if (!storage.commit()) {
+      return false;
+    }
+  }
+
+  Storage storage;
+  if (!storage.init(file, StorageMode::ReadOnly)) {
+    return false;
+  }
+  storage.ensureIndexes();
+
+  // the same access pattern as memory-chart
+  auto read = [&](qint64 &nanoseconds) {
+    QElapsedTimer timer;
+    timer.start();
+    Measurement measurement;
+    for (const QDateTime &time: times) {
+      // ranges are cached by memory-chart, data rows are decoded for every measurement
+      if (!storage.getMeasurementAt(processId.hash(), time, measurement, true)) {
+        return false;
+      }
+    }
+    nanoseconds = timer.nsecsElapsed();
+    return true;
+  };
+
+  // throughput of decoded data rows
+  size_t rows = size_t(times.size()) * args.ranges;
+  qint64 uncachedTime = 0;
+  storage.setNativeReads(false);
+  storage.setStatementCache(false);
+  if (!read(uncachedTime)) {
+    return false;
+  }
+  printResult("QtSql, prepare every call", rows, uncachedTime, "rows");
+
+  qint64 cachedTime = 0;
+  storage.setStatementCache(true);
+  if (!read(cachedTime)) {
+    return false;
+  }
+  printResult("QtSql, statement cache", rows, cachedTime, "rows");
+  printSpeedup(rows, cachedTime, rows, uncachedTime);
+
+  if (!storage.setNativeReads(true)) {
+    qWarning() << "Native reads are not available";
+    return false;
+  }
+  qint64 nativeTime = 0;
+  if (!read(nativeTime)) {
+    return false;
+  }
+  printResult("sqlite3, statement cache", rows, nativeTime, "rows");
+  printSpeedup(rows, nativeTime, rows, cachedTime);
+
+  // single ordered scan, as memory-chart reads the history now
+  QElapsedTimer timer;
+  timer.start();
+  size_t seriesRows = 0;
+  if (!storage.getMeasurementSeries(processId.hash(), times.first(), times.last(),
+                                    [&](const Measurement &measurement) {
+                                      seriesRows += measurement.data.size();
+                                      return true;
+                                    })) {
+    return false;
+  }
+  qint64 seriesTime = timer.nsecsElapsed();
+  printResult("sqlite3, series scan", seriesRows, seriesTime, "rows");
+  printSpeedup(seriesRows, seriesTime, rows, nativeTime);
+  return true;
+}
+
+bool seekBenchmark(const Arguments &args) {
+  QTemporaryDir dir;
+  if (!dir.isValid()) {
+    qWarning() << "Can't create temporary directory";
+    return false;
+  }
+  if (args.period == 0 || args.ranges == 0) {
+    qWarning() << "Period and number of ranges has to be positive";
+    return false;
+  }
+  ProcessId processId(1, ProcessId::StartTime(1));
+  QList<SmapsRange> ranges = benchmarkRanges(processId, args.ranges);
+  QDateTime start = QDateTime::fromMSecsSinceEpoch(1600000000000);
+
+  for (int days: {1, 7, 30}) {
+    QString file = dir.filePath(QString("benchmark-%1d.db").arg(days));
+    qint64 count = qint64(days) * 24 * 3600 * 1000 / qint64(args.period);
+    {
+      Storage storage;
+      if (!storage.init(file)) {
+        return false;
+      }
+      storage.setDeltaRecording(int(args.keyframeInterval));
+      if (!insertProcess(storage, processId, ranges) ||
+          !insertMeasurements(storage, processId, ranges, start, count, qint64(args.period))) {
+        return false;
+      }
+    }
+
+    Storage storage;
+    if (!storage.init(file, StorageMode::ReadOnly)) {
+      return false;
+    }
+    storage.ensureIndexes();
+
+    // the same random times for every recording length, relative to its duration
+    QRandomGenerator random(42);
+    Measurement measurement; // ranges are cached, seek reads keyframe and deltas
+    QElapsedTimer timer;
+    timer.start();
+    for (unsigned long i = 0; i < args.iterations; i++) {
+      QDateTime time = start.addMSecs(qint64(random.bounded(double(count)) * double(args.period)));
+      if (!storage.getMeasurementAtOrBefore(processId.hash(), time, measurement, true)) {
+        return false;
+      }
+    }
+    qint64 seekTime = timer.nsecsElapsed();
+    printResult(std::to_string(days) + (days == 1 ? " day" : " days"), args.iterations, seekTime, "seeks");
+    std::cout << "measurements: " << count
+              << ", database: " << QFileInfo(file).size() / (1024 * 1024) << " MiB"
+              << ", latency: " << std::setprecision(1)
+              << (args.iterations > 0 ? double(seekTime) / 1000.0 / double(args.iterations) : 0) << " us"
+              << std::endl;
+  }
+  return true;
+}
+
+bool blobBenchmark(const Arguments &args) {
+  QTemporaryDir dir;
+  if (!dir.isValid()) {
+    qWarning() << "Can't create temporary directory";
+    return false;
+  }
+  ProcessId processId(1, ProcessId::StartTime(1));
+  QList<SmapsRange> ranges = benchmarkRanges(processId, args.ranges);
+  QDateTime start = QDateTime::fromMSecsSinceEpoch(1600000000000);
+
+  qint64 rowsSize = 0;
+  qint64 rowsTime = 0;
+  size_t rowsCount = 0;
+  for (const auto &[name, format]: std::vector<std::pair<std::string, DataFormat>>{
+         {"rows", DataFormat::Rows},
+         {"blob", DataFormat::Blob},
+         {"compressed-blob", DataFormat::CompressedBlob}}) {
+    QString file = dir.filePath(QString("benchmark-%1.db").arg(QString::fromStdString(name)));
+    {
+      Storage storage;
+      if (!storage.init(file)) {
+        return false;
+      }
+      storage.setDataFormat(format);
+      if (!insertProcess(storage, processId, ranges) ||
+          !insertMeasurements(storage, processId, ranges, start, qint64(args.iterations), 1000)) {
+        return false;
+      }
+    }
+    qint64 size = QFileInfo(file).size();
+
+    Storage storage;
+    if (!storage.init(file, StorageMode::ReadOnly)) {
+      return false;
+    }
+    storage.ensureIndexes();
+
+    // full process scan, as memory-chart reads the history
+    QElapsedTimer timer;
+    timer.start();
+    size_t rows = 0;
+    if (!storage.getMeasurementSeries(processId.hash(), start, start.addMSecs(qint64(args.iterations) * 1000),
+                                      [&](const Measurement &measurement) {
+                                        rows += measurement.data.size();
+                                        return true;
+                                      })) {
+      return false;
+    }
+    qint64 scanTime = timer.nsecsElapsed();
+    printResult(name + ", series scan", rows, scanTime, "rows");
+    std::cout << "database: " << std::setprecision(1) << double(size) / (1024 * 1024) << " MiB";
+    if (format == DataFormat::Rows) {
+      rowsSize = size;
+      rowsTime = scanTime;
+      rowsCount = rows;
+      std::cout << std::endl;
+    } else {
+      std::cout << ", size reduction: " << std::setprecision(2)
+                << (size > 0 ? double(rowsSize) / double(size) : 0) << "x" << std::endl;
+      printSpeedup(rows, scanTime, rowsCount, rowsTime);
+    }
+  }
+  return true;
+}
+
+bool schemaBenchmark(const Arguments &args) {
+  QTemporaryDir dir;
+  if (!dir.isValid()) {
+    qWarning() << "Can't create temporary directory";
+    return false;
+  }
+  if (args.period == 0 || args.ranges == 0) {
+    qWarning() << "Period and number of ranges has to be positive";
+    return false;
+  }
+  ProcessId processId(1, ProcessId::StartTime(1));
+  QList<SmapsRange> ranges = benchmarkRanges(processId, args.ranges);
+  QDateTime start = QDateTime::fromMSecsSinceEpoch(1600000000000);
+  qint64 count = qint64(24) * 3600 * 1000 / qint64(args.period);
+
+  // one day recording written by the old recorder, converted as memory-migrate does
+  QString v1File = dir.filePath("benchmark-v1.db");
+  QString v2File = dir.filePath("benchmark-v2.db");
+  {
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "benchmark-v1");
+    db.setDatabaseName(v1File);
+    bool written = db.open() && legacy::writeRecording(db, processId, ranges, start, count, qint64(args.period));
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase("benchmark-v1");
+    if (!written) {
+      qWarning() << "Can't write" << v1File;
+      return false;
+    }
+  }
+  {
+    Storage storage;
+    if (!storage.init(v2File) || !storage.importV1(v1File)) {
+      return false;
+    }
+  }
+
+  qint64 v1Size = 0;
+  qint64 v1Time = 0;
+  for (const QString &file: {v1File, v2File}) {
+    Storage storage;
+    if (!storage.init(file, StorageMode::ReadOnly)) {
+      return false;
+    }
+    // size of recording prepared for analysis
+    storage.ensureIndexes();
+    qint64 size = QFileInfo(file).size();
+
+    // process and system memory at random times, as memory-replay seeks
+    QRandomGenerator random(42);
+    Measurement measurement;
+    QDateTime exactTime;
+    MemInfo memInfo;
+    QElapsedTimer timer;
+    timer.start();
+    for (unsigned long i = 0; i < args.iterations; i++) {
+      QDateTime time = start.addMSecs(qint64(random.bounded(double(count)) * double(args.period)));
+      QList<Measurement> processes;
+      if (!storage.getMeasurementAtOrBefore(processId.hash(), time, measurement, true) ||
+          !storage.getSystemMemoryAtOrBefore(time, exactTime, memInfo, processes)) {
+        return false;
+      }
+    }
+    qint64 seekTime = timer.nsecsElapsed();
+    std::string name = "schema v" + std::to_string(storage.schemaVersion());
+    printResult(name, args.iterations, seekTime, "seeks");
+    std::cout << "measurements: " << count
+              << ", database: " << std::setprecision(1) << double(size) / (1024 * 1024) << " MiB"
+              << ", latency: " << (args.iterations > 0 ? double(seekTime) / 1000.0 / double(args.iterations) : 0) << " us";
+    if (file == v1File) {
+      v1Size = size;
+      v1Time = seekTime;
+      std::cout << std::endl;
+    } else {
+      std::cout << ", size reduction: " << std::setprecision(2)
+                << (size > 0 ? double(v1Size) / double(size) : 0) << "x" << std::endl;
+      printSpeedup(args.iterations, seekTime, args.iterations, v1Time);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  QCoreApplication app(argc, argv);
+  Utils::registerQtMetatypes();
+
+  Arguments args;
+  ArgParser argParser(&app, argc, argv);
+  {
+    CmdLineParseResult argResult = argParser.Parse();
+    if (argResult.HasError()) {
+      std::cerr << "ERROR: " << argResult.GetErrorDescription() << std::endl;
+      std::cout << argParser.GetHelp() << std::endl;
+      return 1;
+    }
+
+    args = argParser.GetArguments();
+    if (args.help) {
+      std::cout << argParser.GetHelp() << std::endl;
+      return 0;
+    }
+    if (args.version) {
+      std::cout << MEMORY_WATCHER_VERSION_STRING << std::endl;
+      return 0;
+    }
+  }
+
+  QMap<QString, std::function<bool(const Arguments&)>> benchmarks {
+    {"smaps", smapsBenchmark},
+    {"insert", insertBenchmark},
+    {"read", readBenchmark},
+    {"seek", seekBenchmark},
+    {"blob", blobBenchmark},
+    {"schema", schemaBenchmark},
+  };
+
+  if (!benchmarks.contains(args.benchmark)) {
+    std::cerr << "ERROR: Unknown benchmark " << args.benchmark.toStdString() << std::endl;
+    std::cout << argParser.GetHelp() << std::endl;
+    return 1;
+  }
+
+  return benchmarks[args.benchmark](args) ? 0 : 1;
+}
@@ -30,7 +30,6 @@
 #include <QChart>
 #include <QChartView>
 #include <QAreaSeries>
-#include <QFileInfo>
 #include <QElapsedTimer>
 
 #include <iostream>
@@ -101,7 +100,8 @@ public:
                 args.databaseFile = QString::fromStdString(value);
               }),
               "database-file",
-              "Sqlite database file with recording. Default is measurement.db");
+              "Sqlite database file with recording, directory or quoted wildcard pattern "s +
+              "(measurement-*.db) of files rotated by memory-record. Default is measurement.db"s);
 
   }
 
@@ -127,17 +127,13 @@ Chart::~Chart()
 
 void Chart::run()
 {
-  if (!QFileInfo(db).exists()){
-    qWarning() << "File don't exists" << db;
-    deleteLater();
-    return;
-  }
-
+  // database file, directory or wildcard pattern of files rotated by memory-record
   if (!storage.init(db)){
     qWarning() << "Failed to open database" << db;
     deleteLater();
     return;
   }
+  storage.ensureIndexes();
 
   if (pid.has_value() || processId.has_value()) {
     if (!processId.has_value()) {
@@ -198,17 +194,25 @@ void Chart::run()
   QElapsedTimer time;
   time.start();
   MeasurementGroups peak;
-  Measurement measurement;
-  for (qint64 step = 0; step < pointCount; step ++){
-    storage.getMeasurementAt(processId.value(),
-                             times[std::min(measurementTo - 1, step * stepSize)],
-                             measurement,
-                             true);
-
-    Utils::group(measurements[step], measurement, type, true);
-    if (peak.sum < measurements[step].sum) {
-      peak = measurements[step];
-    }
+  qint64 index = 0;
+  qint64 point = 0;
+  bool seriesRead = storage.getMeasurementSeries(
+    processId.value(), times[measurementFrom], times[measurementTo - 1],
+    [&](const Measurement &measurement) {
+      if ((index++) % stepSize != 0) {
+        return true;
+      }
+      Utils::group(measurements[point], measurement, type, true);
+      if (peak.sum < measurements[point].sum) {
+        peak = measurements[point];
+      }
+      point++;
+      return point < pointCount;
+    });
+  if (!seriesRead) {
+    qWarning() << "Failed to read measurements" << db;
+    deleteLater();
+    return;
   }
   qDebug() << "getting data: " << time.elapsed() << "ms";
 
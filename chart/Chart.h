@@ -19,7 +19,7 @@
 
 #pragma once
 
-#include <Storage.h>
+#include <StorageSet.h>
 
 #include <QObject>
 #include <QString>
@@ -43,7 +43,7 @@ public:
   ~Chart() override;
 
 private:
-  Storage storage;
+  StorageSet storage;
   QString db;
   std::optional<pid_t> pid;
   std::optional<qulonglong> processId;
@@ -35,7 +35,7 @@ void Feeder::onSnapshot(ProcessId processId, QDateTime time, QList<SmapsRange> r
     pssSum += r.pss;
 
   }
-  storage.insertMeasurement(processId, time, rssSum, pssSum, StatM{}, OomScore{});
+  storage.insertMeasurement(processId, time, FullSmaps, rssSum, pssSum, StatM{}, OomScore{});
   storage.insertData(processId, time, ranges);
   if (!storage.commit()){
     qWarning() << "Failed to commit measurement";
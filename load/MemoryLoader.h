@@ -52,6 +52,5 @@ private:
 
 private:
   QFileInfo smapsFile;
-  QString lastLineStart;
   ProcessId processId;
 };
@@ -0,0 +1,160 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <BinLog.h>
+#include <CmdLineParsing.h>
+#include <Storage.h>
+#include <Utils.h>
+#include <Version.h>
+
+#include <QtCore/QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+
+#include <iostream>
+
+struct Arguments {
+  bool help{false};
+  bool version{false};
+  QString source;
+  QString destination;
+};
+
+class ArgParser: public CmdLineParser {
+private:
+  Arguments args;
+
+public:
+  ArgParser(QCoreApplication *app,
+            int argc, char *argv[])
+    : CmdLineParser(app->applicationName().toStdString(), argc, argv) {
+
+    using namespace std::string_literals;
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.help = value;
+              }),
+              std::vector<std::string>{"h", "help"},
+              "Display help and exits",
+              true);
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.version = value;
+              }),
+              std::vector<std::string>{"v", "version"},
+              "Display application version and exits",
+              false);
+
+    AddPositional(CmdLineStringOption([this](const std::string &value){
+                    args.source = QString::fromStdString(value);
+                  }),
+                  "source",
+                  "Recording with schema v1 or directory with binary log of memory-record --binlog");
+
+    AddPositional(CmdLineStringOption([this](const std::string &value){
+                    args.destination = QString::fromStdString(value);
+                  }),
+                  "destination",
+                  "New database file with schema v"s + std::to_string(Storage::SchemaVersion));
+  }
+
+  Arguments GetArguments() const {
+    return args;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  QCoreApplication app(argc, argv);
+  Utils::registerQtMetatypes();
+
+  Arguments args;
+  {
+    ArgParser argParser(&app, argc, argv);
+
+    CmdLineParseResult argResult = argParser.Parse();
+    if (argResult.HasError()) {
+      std::cerr << "ERROR: " << argResult.GetErrorDescription() << std::endl;
+      std::cout << argParser.GetHelp() << std::endl;
+      return 1;
+    }
+
+    args = argParser.GetArguments();
+    if (args.help) {
+      std::cout << argParser.GetHelp() << std::endl;
+      return 0;
+    }
+    if (args.version) {
+      std::cout << MEMORY_WATCHER_VERSION_STRING << std::endl;
+      return 0;
+    }
+  }
+
+  if (!QFileInfo(args.source).exists()) {
+    std::cerr << "ERROR: File don't exists " << args.source.toStdString() << std::endl;
+    return 1;
+  }
+  if (QFileInfo(args.destination).exists()) {
+    std::cerr << "ERROR: File already exists " << args.destination.toStdString() << std::endl;
+    return 1;
+  }
+
+  QElapsedTimer timer;
+  if (QFileInfo(args.source).isDir()) {
+    qint64 sourceSize = 0;
+    for (const QString &segment: BinLog::segmentFiles(args.source)) {
+      sourceSize += QFileInfo(segment).size();
+    }
+    timer.start();
+    Storage destination;
+    if (!destination.init(args.destination) || !destination.importBinLog(args.source)) {
+      std::cerr << "ERROR: Conversion failed" << std::endl;
+      return 1;
+    }
+    std::cout << "Converted in " << timer.elapsed() << " ms" << std::endl;
+    std::cout << "Size: " << (sourceSize / 1024) << " KiB -> "
+              << (QFileInfo(args.destination).size() / 1024) << " KiB" << std::endl;
+    return 0;
+  }
+
+  {
+    Storage source;
+    if (!source.init(args.source, StorageMode::ReadOnly)) {
+      std::cerr << "ERROR: Failed to open database " << args.source.toStdString() << std::endl;
+      return 1;
+    }
+    if (source.schemaVersion() != 1) {
+      std::cerr << "ERROR: " << args.source.toStdString() << " has schema version "
+                << source.schemaVersion() << ", just version 1 may be converted" << std::endl;
+      return 1;
+    }
+  }
+
+  timer.start();
+  Storage destination;
+  if (!destination.init(args.destination) || !destination.importV1(args.source)) {
+    std::cerr << "ERROR: Conversion failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Converted in " << timer.elapsed() << " ms" << std::endl;
+  std::cout << "Database size: " << (QFileInfo(args.source).size() / 1024) << " KiB -> "
+            << (QFileInfo(args.destination).size() / 1024) << " KiB" << std::endl;
+  return 0;
+}
@@ -26,10 +26,11 @@
 
 #include <QtCore/QCoreApplication>
 #include <QDebug>
-#include <QFileInfo>
 
+#include <algorithm>
 #include <iostream>
 #include <optional>
+#include <vector>
 
 struct Arguments {
   bool help{false};
@@ -40,6 +41,7 @@ struct Arguments {
   QString processMemoryType{"pss"};
   QString systemMemoryType{"MemAvailable"};
   QDateTime measurementTime;
+  std::optional<unsigned long> top;
 };
 
 class ArgParser: public CmdLineParser {
@@ -84,7 +86,8 @@ public:
                 args.databaseFile = QString::fromStdString(value);
               }),
               "database-file",
-              "Sqlite database file with recording. Default is measurement.db");
+              "Sqlite database file with recording, directory or quoted wildcard pattern "s +
+              "(measurement-*.db) of files rotated by memory-record. Default is measurement.db"s);
 
     AddOption(CmdLineStringOption([this](const std::string &value){
                 args.processMemoryType = QString::fromStdString(value);
@@ -112,6 +115,13 @@ public:
               "measurement-time",
               "Instead of peak memory, show measurement at specified time, or right before it."s
               "\n\tTime should be in ISO 8601 format, for example \"2021-10-30T12:31:17.513\""s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                args.top = value;
+              }),
+              "top",
+              "Report <number> processes with the highest peak of process-memory type. "s +
+              "Recording is scanned just once for all processes."s);
   }
 
   Arguments GetArguments() const {
@@ -124,8 +134,10 @@ Peak::Peak(const QString &db,
            std::optional<qulonglong> processId,
            ProcessMemoryType processType,
            SystemMemoryType systemType,
-           const QDateTime &measurementTime):
-  db(db), pid(pid), processId(processId), processType(processType), systemType(systemType), measurementTime(measurementTime)
+           const QDateTime &measurementTime,
+           std::optional<unsigned long> top):
+  db(db), pid(pid), processId(processId), processType(processType), systemType(systemType), measurementTime(measurementTime),
+  top(top)
 {}
 
 Peak::~Peak()
@@ -135,13 +147,17 @@ Peak::~Peak()
 
 void Peak::run()
 {
-  if (!QFileInfo(db).exists()){
-    qWarning() << "File don't exists" << db;
+  // database file, directory or wildcard pattern of files rotated by memory-record
+  if (!storage.init(db)){
+    qWarning() << "Failed to open database" << db;
     deleteLater();
     return;
   }
-  if (!storage.init(db)){
-    qWarning() << "Failed to open database" << db;
+  // recordings of older versions may lack indexes, missing ones are created on first analysis
+  storage.ensureIndexes();
+
+  if (top.has_value()) {
+    printTop();
     deleteLater();
     return;
   }
@@ -212,6 +228,41 @@ void Peak::run()
   deleteLater();
 }
 
+void Peak::printTop()
+{
+  QHash<qulonglong, ProcessPeaks> peaks;
+  if (!storage.getProcessPeaks(peaks)) {
+    qWarning() << "Failed to read process peaks";
+    return;
+  }
+
+  using ProcessPeak = std::pair<qulonglong, PeakValue>;
+  std::vector<ProcessPeak> sorted;
+  sorted.reserve(peaks.size());
+  for (auto it = peaks.cbegin(); it != peaks.cend(); ++it) {
+    sorted.emplace_back(it.key(), it.value().get(processType));
+  }
+  size_t count = std::min(sorted.size(), size_t(top.value()));
+  std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end(),
+                    [](const ProcessPeak &a, const ProcessPeak &b) {
+                      return a.second.value > b.second.value;
+                    });
+
+  // ranges and data are read just for reported peaks
+  QList<Measurement> measurements;
+  for (size_t i = 0; i < count; i++) {
+    Measurement measurement;
+    qlonglong measurementId = qlonglong(sorted[i].second.measurementId);
+    if (!storage.getProcess(sorted[i].first, measurement.pid, measurement.processName) ||
+        !storage.getMeasurement(measurement, measurementId)) {
+      qWarning() << "Failed to read peak of process" << sorted[i].first;
+      return;
+    }
+    measurements << measurement;
+  }
+  Utils::printPeaks(measurements, processType);
+}
+
 QMap<QString, ProcessMemoryType> memoryTypes {
   {"rss",   ProcessMemoryType::Rss},
   {"pss",   ProcessMemoryType::Pss},
@@ -267,7 +318,13 @@ int main(int argc, char* argv[]) {
   }
   systemType = sysMemoryTypes[args.systemMemoryType];
 
-  Peak *peak = new Peak(args.databaseFile, args.pid, args.processId, processType, systemType, args.measurementTime);
+  if (args.top.has_value() && (args.pid.has_value() || args.processId.has_value())) {
+    qWarning() << "Top processes report can't be combined with pid or process-id";
+    return 1;
+  }
+
+  Peak *peak = new Peak(args.databaseFile, args.pid, args.processId, processType, systemType, args.measurementTime,
+                        args.top);
   QMetaObject::invokeMethod(peak, "run", Qt::QueuedConnection);
 
   int result = app.exec();
@@ -19,7 +19,7 @@
 
 #pragma once
 
-#include <Storage.h>
+#include <StorageSet.h>
 
 #include <QObject>
 #include <QString>
@@ -40,16 +40,21 @@ public:
        std::optional<qulonglong> processId,
        ProcessMemoryType type,
        SystemMemoryType systemType,
-       const QDateTime &measurementTime);
+       const QDateTime &measurementTime,
+       std::optional<unsigned long> top);
 
   ~Peak() override;
 
 private:
-  Storage storage;
+  void printTop();
+
+private:
+  StorageSet storage;
   QString db;
   std::optional<pid_t> pid;
   std::optional<qulonglong> processId;
   ProcessMemoryType processType{Rss};
   SystemMemoryType systemType{MemAvailable};
   QDateTime measurementTime;
+  std::optional<unsigned long> top; //!< number of processes in report of all process peaks
 };
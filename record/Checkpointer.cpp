@@ -0,0 +1,114 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "Checkpointer.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+#include <algorithm>
+
+namespace {
+
+// size of the log is checked at least this often [ms]
+constexpr long PollInterval = 1000;
+
+} // namespace
+
+Checkpointer::Checkpointer(const QString &file, RecorderStats &stats, long interval, qint64 sizeThreshold):
+  file(file),
+  walFile(file + "-wal"),
+  stats(stats),
+  interval(interval),
+  sizeThreshold(sizeThreshold),
+  timer(this)
+{
+  timer.setSingleShot(false);
+  timer.setInterval(int(std::min(interval, PollInterval)));
+  connect(&timer, &QTimer::timeout, this, &Checkpointer::onTimeout);
+}
+
+bool Checkpointer::init()
+{
+  storage = std::make_unique<Storage>();
+  if (!storage->init(file, StorageMode::Wal)) {
+    return false;
+  }
+  lastCheckpoint.start();
+  checkpointedWalSize = -1;
+  timer.start();
+  return true;
+}
+
+void Checkpointer::close()
+{
+  // the last closed connection checkpoints the whole log
+  timer.stop();
+}
+
+void Checkpointer::switchFile(QString nextFile)
+{
+  // the previous database is closed by recorder already,
+  // so this connection is the last one and it checkpoints the whole log
+  storage.reset();
+  file = nextFile;
+  walFile = file + "-wal";
+  if (!init()) {
+    qWarning() << "Failed to open database" << file << "for checkpoints";
+    timer.stop();
+  }
+}
+
+void Checkpointer::onTimeout()
+{
+  // log is truncated when the writer rewinds it after complete checkpoint (journal_size_limit),
+  // so it contains just frames written since then
+  qint64 walSize = QFileInfo(walFile).size();
+  stats.set("wal_bytes", walSize);
+  if (walSize == checkpointedWalSize) {
+    // nothing was written since the last checkpoint, it was complete or frames
+    // are still read by analysis tools
+    return;
+  }
+  if (walSize > 0 && (walSize >= sizeThreshold || lastCheckpoint.elapsed() >= interval)) {
+    if (checkpoint()) {
+      checkpointedWalSize = walSize;
+    }
+  }
+}
+
+bool Checkpointer::checkpoint()
+{
+  QElapsedTimer checkpointTimer;
+  checkpointTimer.start();
+  int walFrames = 0;
+  int checkpointedFrames = 0;
+  bool busy = false;
+  if (!storage->checkpoint(walFrames, checkpointedFrames, busy)) {
+    return false;
+  }
+  lastCheckpoint.start();
+  stats.add("checkpoints");
+  stats.add("checkpoint_us", checkpointTimer.nsecsElapsed() / 1000);
+  if (busy || checkpointedFrames < walFrames) {
+    // frames still read by analysis tools are checkpointed next time
+    stats.add("checkpoint_incomplete");
+  }
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include "RecorderStats.h"
+
+#include <Storage.h>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <memory>
+
+/**
+ * Checkpoints write-ahead log of the recording by its own database connection,
+ * so writer thread is never blocked by checkpoint. Checkpoint is done
+ * after interval or when the log exceeds size threshold.
+ */
+class Checkpointer : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY_MOVE(Checkpointer)
+
+public slots:
+  void close();
+
+  /** Continue with checkpoints of rotated database */
+  void switchFile(QString nextFile);
+
+private slots:
+  void onTimeout();
+
+public:
+  /**
+   * @param interval maximum time [ms] between checkpoints
+   * @param sizeThreshold size of write-ahead log [bytes] that triggers checkpoint
+   */
+  Checkpointer(const QString &file, RecorderStats &stats, long interval, qint64 sizeThreshold);
+  ~Checkpointer() = default;
+
+  /** Open the database, it has to be invoked from the thread of Checkpointer */
+  Q_INVOKABLE bool init();
+
+private:
+  bool checkpoint();
+
+private:
+  QString file;
+  QString walFile;
+  RecorderStats &stats;
+  long interval;
+  qint64 sizeThreshold;
+  std::unique_ptr<Storage> storage;
+  QTimer timer;
+  QElapsedTimer lastCheckpoint;
+  qint64 checkpointedWalSize{-1}; //!< size of the log at the last checkpoint
+};
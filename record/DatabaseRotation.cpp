@@ -0,0 +1,187 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "DatabaseRotation.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// sorted by name in time order
+constexpr const char *TimeFormat = "yyyyMMdd-HHmmss";
+
+QString fileSuffix(const QFileInfo &base)
+{
+  return base.suffix().isEmpty() ? QString() : "." + base.suffix();
+}
+
+} // namespace
+
+DatabaseRotation::DatabaseRotation(const QString &baseFile, long interval, qint64 size, long maxFiles):
+  baseFile(baseFile),
+  interval(interval),
+  size(size),
+  maxFiles(maxFiles)
+{}
+
+QString DatabaseRotation::nextFile()
+{
+  QFileInfo base(baseFile);
+  QString prefix = base.dir().filePath(base.completeBaseName() + "-" +
+                                       QDateTime::currentDateTimeUtc().toString(TimeFormat));
+  QString suffix = fileSuffix(base);
+  QString file = prefix + suffix;
+  // rotated more than once per second
+  for (int i = 1; QFileInfo::exists(file); i++) {
+    file = QString("%1-%2%3").arg(prefix).arg(i).arg(suffix);
+  }
+  age.start();
+  return file;
+}
+
+bool DatabaseRotation::isDue(const QString &file) const
+{
+  if (interval > 0 && age.isValid() && age.elapsed() >= qint64(interval) * 1000) {
+    return true;
+  }
+  // write-ahead log is truncated when it is rewound after complete checkpoint (see Storage::init),
+  // so pages already moved to the database are counted twice at most until the next commit
+  return size > 0 && QFileInfo(file).size() + QFileInfo(file + "-wal").size() >= size;
+}
+
+QStringList DatabaseRotation::files() const
+{
+  QFileInfo base(baseFile);
+  QRegularExpression pattern("^" + QRegularExpression::escape(base.completeBaseName()) +
+                             "-(\\d{8}-\\d{6})(?:-(\\d+))?" +
+                             QRegularExpression::escape(fileSuffix(base)) + "$");
+  // sequence number of file rotated in the same second is compared as number
+  using Key = std::pair<QString, int>;
+  std::vector<std::pair<Key, QString>> rotated;
+  QDir dir = base.dir();
+  for (const QString &name: dir.entryList(QDir::Files)) {
+    QRegularExpressionMatch match = pattern.match(name);
+    if (match.hasMatch()) {
+      rotated.emplace_back(Key(match.captured(1), match.captured(2).toInt()), dir.filePath(name));
+    }
+  }
+  std::sort(rotated.begin(), rotated.end());
+
+  QStringList result;
+  for (const auto &file: rotated) {
+    result << file.second;
+  }
+  return result;
+}
+
+void DatabaseRotation::applyRetention(const QString &currentFile) const
+{
+  if (maxFiles <= 0) {
+    return;
+  }
+  QStringList rotated = files();
+  rotated.removeAll(currentFile);
+  // the current file is counted to the limit
+  int count = rotated.size() - int(maxFiles - 1);
+  for (int i = 0; i < count; i++) {
+    const QString &file = rotated[i];
+    if (!QFile::remove(file)) {
+      qWarning() << "Failed to delete database" << file;
+      continue;
+    }
+    // write-ahead log and rollback journal, if any
+    for (const char *suffix: {"-wal", "-shm", "-journal"}) {
+      QFile::remove(file + suffix);
+    }
+    qDebug() << "Deleted database" << file;
+  }
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+#include <QTemporaryDir>
+
+TEST_CASE("rotated databases are ordered by time and the oldest are deleted") {
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  auto create = [&](const QString &name, int bytes = 0) {
+    QFile file(dir.filePath(name));
+    REQUIRE(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray(bytes, 'x'));
+  };
+
+  // files rotated in the same second have sequence number, it is compared as number
+  for (const char *name: {"measurement-20211005-134502.db", "measurement-20211005-134501-10.db",
+                          "measurement-20211005-134501.db", "measurement-20211005-134501-2.db",
+                          "measurement.db", "measurement-20211005-134501.db-wal",
+                          "other-20211005-134501.db", "measurement-20211005.db"}) {
+    create(name);
+  }
+  DatabaseRotation rotation(dir.filePath("measurement.db"), 0, 0, 2);
+  REQUIRE(!rotation.isEnabled());
+  const QStringList expected{dir.filePath("measurement-20211005-134501.db"),
+                             dir.filePath("measurement-20211005-134501-2.db"),
+                             dir.filePath("measurement-20211005-134501-10.db"),
+                             dir.filePath("measurement-20211005-134502.db")};
+  REQUIRE(rotation.files() == expected);
+
+  // the next file is named by current UTC time, it doesn't overwrite existing one
+  QString next = rotation.nextFile();
+  REQUIRE(QRegularExpression("/measurement-\\d{8}-\\d{6}(-\\d+)?\\.db$").match(next).hasMatch());
+  REQUIRE(!QFileInfo::exists(next));
+  create(QFileInfo(next).fileName());
+  QString sameSecond = rotation.nextFile();
+  REQUIRE(sameSecond != next);
+  create(QFileInfo(sameSecond).fileName());
+  REQUIRE(rotation.files().mid(4) == QStringList({next, sameSecond}));
+
+  // the current file is counted to the limit
+  rotation.applyRetention(sameSecond);
+  REQUIRE(rotation.files() == QStringList({next, sameSecond}));
+  REQUIRE(!QFileInfo::exists(dir.filePath("measurement-20211005-134501.db-wal")));
+  REQUIRE(QFileInfo::exists(dir.filePath("measurement.db")));
+  REQUIRE(QFileInfo::exists(dir.filePath("other-20211005-134501.db")));
+
+  // the current file is kept, even when it is the oldest one
+  DatabaseRotation single(dir.filePath("measurement.db"), 0, 0, 1);
+  single.applyRetention(next);
+  REQUIRE(single.files() == QStringList{next});
+
+  DatabaseRotation bySize(dir.filePath("measurement.db"), 0, 100, 0);
+  REQUIRE(bySize.isEnabled());
+  REQUIRE(!bySize.isDue(next));
+  create(QFileInfo(next).fileName() + "-wal", 100);
+  REQUIRE(bySize.isDue(next));
+  DatabaseRotation byTime(dir.filePath("measurement.db"), 3600, 0, 0);
+  byTime.nextFile();
+  REQUIRE(!byTime.isDue(next));
+}
+
+#endif // UNIT_TESTS
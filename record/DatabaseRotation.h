@@ -0,0 +1,66 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Rotation of database written by long-running recorder. New file is started
+ * when the current one is older than interval or larger than size limit, its name
+ * is derived from the base file and UTC time: measurement.db -> measurement-20211005-134501.db.
+ * The oldest rotated files over maxFiles are deleted.
+ */
+class DatabaseRotation {
+public:
+  DatabaseRotation() = default;
+
+  /**
+   * @param interval maximum age of the file [s], zero disables rotation by time
+   * @param size maximum size of the file including its write-ahead log [bytes], zero disables rotation by size
+   * @param maxFiles number of rotated files kept, zero keeps all
+   */
+  DatabaseRotation(const QString &baseFile, long interval, qint64 size, long maxFiles);
+
+  bool isEnabled() const
+  {
+    return interval > 0 || size > 0;
+  }
+
+  /** Name of the next database file, age of the file is measured from now */
+  QString nextFile();
+
+  /** The file should be replaced by the next one */
+  bool isDue(const QString &file) const;
+
+  /** Rotated files of the base file, ordered from the oldest */
+  QStringList files() const;
+
+  /** Delete the oldest rotated files over the limit, the current one is kept always */
+  void applyRetention(const QString &currentFile) const;
+
+private:
+  QString baseFile;
+  long interval{0};
+  qint64 size{0};
+  long maxFiles{0};
+  QElapsedTimer age;
+};
@@ -0,0 +1,225 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ExitWatcher.h"
+
+#include <ProcFile.h>
+
+#include <QDebug>
+#include <QFileInfo>
+
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434 // the same number on all architectures
+#endif
+
+namespace {
+
+constexpr int MaxEvents = 64;
+
+int pidfdOpen(pid_t pid) {
+  return int(::syscall(SYS_pidfd_open, pid, 0));
+}
+
+} // namespace
+
+ExitWatcher::ExitWatcher(const QString &procFs):
+  procFs(procFs)
+{
+  // pidfd is usable just for processes from our pid namespace
+  if (QFileInfo(procFs).canonicalFilePath() != QLatin1String("/proc")) {
+    qDebug() << "Proc filesystem" << procFs << "is not local, exit of processes is detected by polling";
+    return;
+  }
+
+  int probe = pidfdOpen(::getpid());
+  if (probe < 0) {
+    qWarning() << "pidfd_open is not available, exit of processes is detected by polling";
+    return;
+  }
+  ::close(probe);
+
+  epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    qWarning() << "Failed to create epoll descriptor, exit of processes is detected by polling";
+    return;
+  }
+
+  notifier = std::make_unique<QSocketNotifier>(epollFd, QSocketNotifier::Read);
+  connect(notifier.get(), &QSocketNotifier::activated, this, &ExitWatcher::onActivated);
+}
+
+ExitWatcher::~ExitWatcher()
+{
+  notifier.reset();
+  for (const Process &process: processes) {
+    ::close(process.pidFd);
+    ProcFile::releaseDescriptor();
+  }
+  processes.clear();
+  if (epollFd >= 0) {
+    ::close(epollFd);
+  }
+}
+
+bool ExitWatcher::watch(const ProcessId &processId)
+{
+  if (!isAvailable()) {
+    return false;
+  }
+  if (processes.contains(processId.pid)) {
+    unwatch(processId.pid);
+  }
+  if (!ProcFile::acquireDescriptor()) {
+    return false;
+  }
+
+  int pidFd = pidfdOpen(processId.pid);
+  if (pidFd < 0) {
+    ProcFile::releaseDescriptor();
+    return false;
+  }
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = quint64(processId.pid);
+  if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, pidFd, &event) < 0) {
+    qWarning() << "Failed to add pidfd of process" << processId.pid << "to epoll";
+    ::close(pidFd);
+    ProcFile::releaseDescriptor();
+    return false;
+  }
+  processes.insert(processId.pid, Process{processId, pidFd});
+
+  // pid may be reused before pidfd was opened
+  if (ProcessId::processStartTime(processId.pid, procFs) != processId.startTime) {
+    unwatch(processId.pid);
+    return false;
+  }
+  return true;
+}
+
+void ExitWatcher::unwatch(pid_t pid)
+{
+  auto it = processes.find(pid);
+  if (it == processes.end()) {
+    return;
+  }
+  ::epoll_ctl(epollFd, EPOLL_CTL_DEL, it->pidFd, nullptr);
+  ::close(it->pidFd);
+  ProcFile::releaseDescriptor();
+  processes.erase(it);
+}
+
+void ExitWatcher::onActivated()
+{
+  epoll_event events[MaxEvents];
+  for (;;) {
+    int count = ::epoll_wait(epollFd, events, MaxEvents, 0);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      qWarning() << "Waiting for epoll events failed";
+      return;
+    }
+    for (int i = 0; i < count; i++) {
+      pid_t pid = pid_t(events[i].data.u64);
+      auto it = processes.find(pid);
+      if (it == processes.end()) {
+        continue;
+      }
+      ProcessId processId = it->processId;
+      unwatch(pid);
+      emit exited(processId);
+    }
+    if (count < MaxEvents) {
+      return;
+    }
+  }
+}
+
+#ifdef UNIT_TESTS
+
+#include "TestFixture.h"
+
+#include <catch2/catch.hpp>
+
+#include <QElapsedTimer>
+
+#include <sys/wait.h>
+
+TEST_CASE("exit of watched process is signaled before it is reaped") {
+  TestFixture::Application app;
+
+  ExitWatcher watcher("/proc");
+  if (!watcher.isAvailable()) {
+    WARN("pidfd is not available");
+    return;
+  }
+  QList<ProcessId> exited;
+  QObject::connect(&watcher, &ExitWatcher::exited, [&](ProcessId processId) { exited << processId; });
+  auto processEvents = [&](qint64 timeoutMs) {
+    QElapsedTimer timer;
+    timer.start();
+    while (exited.isEmpty() && timer.elapsed() < timeoutMs) {
+      QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+  };
+
+  // child exits when the pipe is closed
+  int pipeFds[2];
+  REQUIRE(::pipe(pipeFds) == 0);
+  pid_t child = ::fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    ::close(pipeFds[1]);
+    char byte;
+    ssize_t count = ::read(pipeFds[0], &byte, 1);
+    ::_exit(count == 0 ? 0 : 1);
+  }
+  ::close(pipeFds[0]);
+  ProcessId processId(child, QString("/proc"));
+
+  // pid reused by process with different start time is not watched
+  REQUIRE(!watcher.watch(ProcessId(child, processId.startTime + 1)));
+  REQUIRE(watcher.watch(processId));
+  processEvents(100);
+  REQUIRE(exited.isEmpty());
+
+  ::close(pipeFds[1]);
+  processEvents(5000);
+  REQUIRE(exited.size() == 1);
+  REQUIRE(exited[0].pid == child);
+  REQUIRE(exited[0].startTime == processId.startTime);
+
+  // zombie is still listed with the same start time until it is reaped
+  REQUIRE(ProcessId::processStartTime(child, "/proc") == processId.startTime);
+  int status = 0;
+  REQUIRE(::waitpid(child, &status, 0) == child);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+}
+
+#endif // UNIT_TESTS
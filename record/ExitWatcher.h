@@ -0,0 +1,75 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <ProcessId.h>
+#include <Utils.h>
+
+#include <QHash>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QString>
+
+#include <memory>
+
+/**
+ * Notification about process exit. Pidfd (Linux 5.3+) is opened for every watched process,
+ * all of them are polled by single epoll descriptor integrated to Qt event loop.
+ *
+ * When pidfd is not available (old kernel, remote proc filesystem, exhausted descriptor budget),
+ * watch returns false and caller have to detect process exit by itself.
+ */
+class ExitWatcher : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY_MOVE(ExitWatcher)
+
+signals:
+  void exited(ProcessId processId);
+
+public:
+  explicit ExitWatcher(const QString &procFs);
+  ~ExitWatcher();
+
+  bool isAvailable() const {
+    return epollFd >= 0;
+  }
+
+  /**
+   * Start watching the process.
+   * @return true when exit of process will be signaled
+   */
+  bool watch(const ProcessId &processId);
+
+  void unwatch(pid_t pid);
+
+private slots:
+  void onActivated();
+
+private:
+  struct Process {
+    ProcessId processId;
+    int pidFd;
+  };
+
+  QString procFs;
+  int epollFd{-1};
+  std::unique_ptr<QSocketNotifier> notifier;
+  QHash<pid_t, Process> processes;
+};
@@ -20,39 +20,294 @@
 #include "Feeder.h"
 
 #include <QDebug>
+#include <QElapsedTimer>
 
-void Feeder::processInitialized(ProcessId processId,
-                                QString name) {
-  storage.insertOrIgnoreProcess(processId, name);
+Feeder::Feeder(SnapshotQueue &queue, RecorderStats &stats, long maxLatency):
+  queue(queue),
+  stats(stats),
+  latencyTimer(this)
+{
+  latencyTimer.setSingleShot(true);
+  latencyTimer.setInterval(int(maxLatency));
+  connect(&latencyTimer, &QTimer::timeout, this, &Feeder::onMaxLatency);
+}
+
+void Feeder::begin()
+{
+  if (inTransaction) {
+    return;
+  }
+  inTransaction = binLog ? binLog->transaction() : storage->transaction();
+  if (!inTransaction) {
+    qWarning() << "Failed to begin transaction";
+    return;
+  }
+  latencyTimer.start();
+}
+
+void Feeder::commit()
+{
+  latencyTimer.stop();
+  if (!inTransaction) {
+    return;
+  }
+  QElapsedTimer commitTimer;
+  commitTimer.start();
+  if (!(binLog ? binLog->commit() : storage->commit())){
+    qWarning() << "Failed to commit measurements";
+    // cached ranges may not be stored
+    storedRanges.clear();
+    storedProcesses.clear();
+  }
+  inTransaction = false;
+  stats.add("commits");
+  stats.add("commit_us", commitTimer.nsecsElapsed() / 1000);
+}
+
+void Feeder::drain()
+{
+  queue.take(snapshots);
+  if (snapshots.empty()) {
+    return;
+  }
+  begin();
+  for (const ProcessSnapshot &snapshot: snapshots) {
+    writeSnapshot(snapshot);
+  }
+  stats.add("written_snapshots", qlonglong(snapshots.size()));
+  snapshots.clear();
+}
+
+void Feeder::onTickFinished(QDateTime /*time*/)
+{
+  drain();
+  commit();
+  if (rotation.isEnabled() && rotation.isDue(currentFile)) {
+    rotate();
+  }
+}
+
+void Feeder::onMaxLatency()
+{
+  qDebug() << "Tick was not finished in time, committing";
+  stats.add("forced_commits");
+  drain();
+  commit();
+}
+
+void Feeder::close()
+{
+  drain();
+  commit();
+}
+
+void Feeder::onProcessExited(ProcessId processId)
+{
+  // snapshots of the process may be still in the queue
+  drain();
+  storedRanges.remove(processId.hash());
+  processNames.remove(processId);
+  storedProcesses.remove(processId.hash());
+  if (!binLog) {
+    storage->forgetProcess(processId);
+  }
 }
 
-void Feeder::onProcessSnapshot(QDateTime time,
-                               ProcessId processId,
-                               QList<SmapsRange> ranges,
-                               StatM statm,
-                               OomScore oomScore)
+void Feeder::writeSnapshot(const ProcessSnapshot &snapshot)
 {
-  storage.transaction();
+  if (binLog) {
+    writeSnapshot(*binLog, snapshot);
+  } else {
+    writeSnapshot(*storage, snapshot);
+  }
+}
 
-  qlonglong rssSum = 0;
-  qlonglong pssSum = 0;
-  for (const auto &r:ranges){
-    storage.insertOrIgnoreRange(r.key);
-    rssSum += r.rss;
-    pssSum += r.pss;
+template <typename Writer>
+void Feeder::writeSnapshot(Writer &writer, const ProcessSnapshot &snapshot)
+{
+  if (!snapshot.processName.isEmpty()) {
+    writer.insertOrIgnoreProcess(snapshot.processId, snapshot.processName);
+    if (rotation.isEnabled()) {
+      processNames[snapshot.processId] = snapshot.processName;
+      storedProcesses.insert(snapshot.processId.hash());
+    }
+  } else if (rotation.isEnabled() && !storedProcesses.contains(snapshot.processId.hash())) {
+    // name comes just with the first snapshot, rotated database needs its own process row
+    writer.insertOrIgnoreProcess(snapshot.processId, processNames.value(snapshot.processId));
+    storedProcesses.insert(snapshot.processId.hash());
+  }
+
+  // smaps_rollup sample contains just one range with sums,
+  // it is not real memory mapping and it is not stored
+  if (snapshot.sampleType == FullSmaps) {
+    // most of the mappings are the same as in previous snapshot
+    QSet<qulonglong> &ranges = storedRanges[snapshot.processId.hash()];
+    qlonglong inserts = 0;
+    for (const auto &r: snapshot.ranges) {
+      qulonglong hash = r.key.hash();
+      if (!ranges.contains(hash)) {
+        if (writer.insertOrIgnoreRange(r.key)) {
+          ranges.insert(hash);
+        }
+        inserts++;
+      }
+    }
+    stats.add("range_inserts", inserts);
+    stats.add("range_cache_hits", snapshot.ranges.size() - inserts);
   }
-  storage.insertMeasurement(processId, time, rssSum, pssSum, statm, oomScore);
-  storage.insertData(processId, time, ranges);
-  if (!storage.commit()){
-    qWarning() << "Failed to commit measurement";
+  writer.insertMeasurement(snapshot.processId, snapshot.time, snapshot.sampleType,
+                           snapshot.rssSum, snapshot.pssSum, snapshot.statm, snapshot.oomScore);
+  if (snapshot.sampleType == FullSmaps) {
+    writer.insertData(snapshot.processId, snapshot.time, snapshot.ranges);
   }
 }
 
 void Feeder::onSystemSnapshot(QDateTime time, MemInfo memInfo) {
-  storage.insertSystemMemInfo(time, memInfo);
+  begin();
+  if (binLog) {
+    binLog->insertSystemMemInfo(time, memInfo);
+  } else {
+    storage->insertSystemMemInfo(time, memInfo);
+  }
 }
 
-bool Feeder::init(QString file)
+void Feeder::onRecorderStats(QDateTime time, QMap<QString, qlonglong> values) {
+  begin();
+  if (binLog) {
+    binLog->insertRecorderStats(time, values);
+  } else {
+    storage->insertRecorderStats(time, values);
+  }
+}
+
+void Feeder::setRotation(const DatabaseRotation &rotation)
+{
+  this->rotation = rotation;
+}
+
+bool Feeder::init(QString file, bool wal, int keyframeInterval, DataFormat dataFormat)
+{
+  this->wal = wal;
+  this->keyframeInterval = keyframeInterval;
+  this->dataFormat = dataFormat;
+  if (!openStorage(rotation.isEnabled() ? rotation.nextFile() : file)) {
+    return false;
+  }
+  if (rotation.isEnabled()) {
+    // files of previous recordings are counted as well
+    rotation.applyRetention(currentFile);
+  }
+  return true;
+}
+
+bool Feeder::openStorage(const QString &file)
 {
-  return storage.init(file);
+  auto opened = std::make_unique<Storage>();
+  if (!opened->init(file, wal ? StorageMode::Wal : StorageMode::Fast)) {
+    return false;
+  }
+  opened->setDeltaRecording(keyframeInterval);
+  opened->setDataFormat(dataFormat);
+  // the previous database is closed, the new one starts with its own process and range rows
+  // and keyframes of delta recording
+  storage = std::move(opened);
+  currentFile = file;
+  storedRanges.clear();
+  storedProcesses.clear();
+  return true;
 }
+
+void Feeder::rotate()
+{
+  QString file = rotation.nextFile();
+  if (!openStorage(file)) {
+    qWarning() << "Failed to open database" << file << ", recording continues to" << currentFile;
+    return;
+  }
+  qDebug() << "Database rotated to" << file;
+  stats.add("rotations");
+  rotation.applyRetention(currentFile);
+  emit rotated(currentFile);
+}
+
+QString Feeder::databaseFile() const
+{
+  return currentFile;
+}
+
+bool Feeder::initBinLog(QString directory, qlonglong segmentSize)
+{
+  binLog = std::make_unique<BinLogWriter>();
+  return binLog->init(directory, segmentSize);
+}
+
+#ifdef UNIT_TESTS
+
+#include "TestFixture.h"
+
+#include <catch2/catch.hpp>
+
+#include <QTemporaryDir>
+
+TEST_CASE("rotated database contains its own process, ranges and keyframes") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(3);
+  QDateTime start = TestFixture::start();
+
+  SnapshotQueue queue(16 * 1024 * 1024, QueuePolicy::Block);
+  RecorderStats stats;
+  Feeder feeder(queue, stats, 1000);
+  // every non-empty file is rotated at the end of tick
+  feeder.setRotation(DatabaseRotation(dir.filePath("measurement.db"), 0, 1, 0));
+  REQUIRE(feeder.init(QString(), false, 10, DataFormat::Rows));
+  QStringList files{feeder.databaseFile()};
+  for (int i = 0; i < 2; i++) {
+    // name comes just with the first snapshot of the process, one range changes
+    ProcessSnapshot snapshot;
+    snapshot.time = start.addSecs(i);
+    snapshot.processId = processId;
+    snapshot.processName = i == 0 ? "test" : "";
+    snapshot.ranges = ranges;
+    snapshot.ranges[0].rss += i;
+    queue.push(std::move(snapshot));
+    feeder.onTickFinished(start.addSecs(i));
+    files << feeder.databaseFile();
+  }
+  feeder.close();
+  REQUIRE(files.removeDuplicates() == 0);
+  REQUIRE(files.size() == 3);
+  REQUIRE(stats.take()["rotations"] == 2);
+
+  // the second file is readable alone
+  Storage storage;
+  REQUIRE(storage.init(files[1], StorageMode::ReadOnly));
+  pid_t pid = 0;
+  QString processName;
+  REQUIRE(storage.getProcess(processId.hash(), pid, processName));
+  REQUIRE(pid == 42);
+  REQUIRE(processName == "test");
+  QMap<qulonglong, Range> rangeMap;
+  REQUIRE(storage.getAllRanges(processId.hash(), rangeMap));
+  REQUIRE(rangeMap.size() == ranges.size());
+  Measurement measurement;
+  REQUIRE(storage.getMeasurementAt(processId.hash(), start.addSecs(1), measurement));
+  REQUIRE(measurement.keyframeId == 0);
+  REQUIRE(measurement.data.size() == ranges.size());
+
+  // keyframe is stored with all data rows, not as delta of the previous file
+  sqlite3 *db = nullptr;
+  REQUIRE(sqlite3_open_v2(files[1].toUtf8().constData(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK);
+  SqliteStatement count;
+  REQUIRE(count.prepare(db, "SELECT COUNT(*) FROM `data`;"));
+  REQUIRE(count.next());
+  REQUIRE(count.columnLong(0) == ranges.size());
+  count.finalize();
+  sqlite3_close(db);
+}
+
+#endif // UNIT_TESTS
@@ -18,38 +18,112 @@
 */
 #pragma once
 
-#include "ProcessMemoryWatcher.h"
+#include "DatabaseRotation.h"
+#include "RecorderStats.h"
+#include "SnapshotQueue.h"
 
+#include <BinLogWriter.h>
 #include <Storage.h>
 #include <MemInfo.h>
 
 #include <QObject>
+#include <QHash>
 #include <QMap>
+#include <QSet>
+#include <QTimer>
 
-#include <atomic>
+#include <memory>
+#include <vector>
 
 class Feeder : public QObject{
   Q_OBJECT
   Q_DISABLE_COPY_MOVE(Feeder)
 
 signals:
-public slots:
-  void processInitialized(ProcessId processId, QString name);
+  /** Database was rotated, the previous file is closed */
+  void rotated(QString file);
 
-  void onProcessSnapshot(QDateTime time,
-                         ProcessId processId,
-                         QList<SmapsRange> ranges,
-                         StatM statm,
-                         OomScore oomScore);
+public slots:
+  /** Write snapshots available in the queue */
+  void drain();
 
   void onSystemSnapshot(QDateTime time, MemInfo memInfo);
 
+  void onRecorderStats(QDateTime time, QMap<QString, qlonglong> values);
+
+  /** All snapshots of the tick are written, commit the transaction */
+  void onTickFinished(QDateTime time);
+
+  /** Write pending snapshots and commit */
+  void close();
+
+  /** Drop cache of process ranges and its delta recording state */
+  void onProcessExited(ProcessId processId);
+
+private slots:
+  void onMaxLatency();
+
 public:
-  Feeder() = default;
+  /**
+   * @param maxLatency maximum time [ms] of open transaction,
+   *   it is committed even when the tick is not finished yet
+   */
+  Feeder(SnapshotQueue &queue, RecorderStats &stats, long maxLatency);
   ~Feeder() = default;
 
-  bool init(QString file);
+  /** Rotation of database files, it has to be set before init */
+  void setRotation(const DatabaseRotation &rotation);
+
+  /**
+   * Open the database, it has to be invoked from the thread of Feeder.
+   * File name is given by rotation when it is enabled.
+   * @param keyframeInterval see Storage::setDeltaRecording
+   * @param dataFormat see Storage::setDataFormat
+   */
+  Q_INVOKABLE bool init(QString file, bool wal, int keyframeInterval, DataFormat dataFormat);
+
+  /**
+   * Open binary log instead of the database, see BinLogWriter
+   * @param segmentSize size of segment [bytes]
+   */
+  Q_INVOKABLE bool initBinLog(QString directory, qlonglong segmentSize);
+
+  /** Database file written now */
+  Q_INVOKABLE QString databaseFile() const;
+
+private:
+  void writeSnapshot(const ProcessSnapshot &snapshot);
+
+  // Writer is Storage or BinLogWriter, they have the same insert methods
+  template <typename Writer>
+  void writeSnapshot(Writer &writer, const ProcessSnapshot &snapshot);
+
+  /** Open the database and replace the current one, rows cached for previous database are dropped */
+  bool openStorage(const QString &file);
+
+  /** Continue with the next database file, called between transactions */
+  void rotate();
+
+  /** Begin transaction when it is not open yet */
+  void begin();
+  void commit();
 
 private:
-  Storage storage;
+  SnapshotQueue &queue;
+  RecorderStats &stats;
+  std::vector<ProcessSnapshot> snapshots;
+  // hashes of ranges already stored, per process hash
+  QHash<qulonglong, QSet<qulonglong>> storedRanges;
+  std::unique_ptr<Storage> storage;
+  QString currentFile;
+  bool wal{false};
+  int keyframeInterval{0};
+  DataFormat dataFormat{DataFormat::Rows};
+  DatabaseRotation rotation;
+  // names of live processes and hashes of processes stored in the current file, just with rotation
+  QMap<ProcessId, QString> processNames;
+  QSet<qulonglong> storedProcesses;
+  std::unique_ptr<BinLogWriter> binLog; //!< used instead of storage when it is not null
+  QTimer latencyTimer;
+  bool inTransaction{false};
 };
@@ -0,0 +1,190 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ProcessDiscovery.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// glibc provides getdents64 wrapper since 2.30, use the syscall directly
+struct LinuxDirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+constexpr size_t DirentBufferSize = 64 * 1024;
+
+} // namespace
+
+ProcessDiscovery::ProcessDiscovery(const QString &procFs):
+  procFs(procFs),
+  buffer(DirentBufferSize)
+{}
+
+ProcessDiscovery::~ProcessDiscovery()
+{
+  if (dirFd >= 0) {
+    ::close(dirFd);
+  }
+}
+
+bool ProcessDiscovery::readPids(std::vector<pid_t> &pids)
+{
+  pids.clear();
+  if (dirFd < 0) {
+    dirFd = ::open(QFile::encodeName(procFs).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+      qWarning() << "Can't open directory" << procFs;
+      return false;
+    }
+  } else if (::lseek(dirFd, 0, SEEK_SET) < 0) {
+    qWarning() << "Can't rewind directory" << procFs;
+    return false;
+  }
+
+  for (;;) {
+    long count = ::syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      qWarning() << "Can't read directory" << procFs;
+      return false;
+    }
+    if (count == 0) {
+      break;
+    }
+    for (long offset = 0; offset < count;) {
+      const auto *entry = reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset);
+      offset += entry->d_reclen;
+
+      // just numeric entries are processes
+      const char *name = entry->d_name;
+      if (*name < '0' || *name > '9') {
+        continue;
+      }
+      unsigned long long pid = 0;
+      for (; *name >= '0' && *name <= '9'; ++name) {
+        pid = pid * 10 + (*name - '0');
+      }
+      if (*name == '\0' && pid <= (unsigned long long)std::numeric_limits<pid_t>::max()) {
+        pids.push_back(pid_t(pid));
+      }
+    }
+  }
+
+  // proc filesystem lists processes ordered by pid already
+  if (!std::is_sorted(pids.begin(), pids.end())) {
+    std::sort(pids.begin(), pids.end());
+  }
+  return true;
+}
+
+bool ProcessDiscovery::scan(std::vector<pid_t> &born, std::vector<pid_t> &dead)
+{
+  born.clear();
+  dead.clear();
+  if (!readPids(current)) {
+    return false;
+  }
+
+  auto prev = previous.cbegin();
+  auto curr = current.cbegin();
+  while (prev != previous.cend() && curr != current.cend()) {
+    if (*prev < *curr) {
+      dead.push_back(*prev++);
+    } else if (*curr < *prev) {
+      born.push_back(*curr++);
+    } else {
+      ++prev;
+      ++curr;
+    }
+  }
+  dead.insert(dead.end(), prev, previous.cend());
+  born.insert(born.end(), curr, current.cend());
+
+  std::swap(previous, current);
+  return true;
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+#include <QDir>
+#include <QTemporaryDir>
+
+TEST_CASE("process discovery reports born and dead pids between scans") {
+  QTemporaryDir procFs;
+  REQUIRE(procFs.isValid());
+  QDir dir(procFs.path());
+  // directory entries are not ordered by pid, non-numeric entries are ignored
+  for (const char *name: {"20", "1", "self", "3", "12x", "sys", "4000000"}) {
+    REQUIRE(dir.mkdir(name));
+  }
+
+  ProcessDiscovery discovery(procFs.path());
+  std::vector<pid_t> born;
+  std::vector<pid_t> dead;
+  REQUIRE(discovery.scan(born, dead));
+  REQUIRE(born == std::vector<pid_t>{1, 3, 20, 4000000});
+  REQUIRE(dead.empty());
+  REQUIRE(discovery.pids() == born);
+
+  REQUIRE(dir.rmdir("3"));
+  REQUIRE(dir.rmdir("4000000"));
+  REQUIRE(dir.mkdir("5"));
+  REQUIRE(dir.mkdir("100"));
+  REQUIRE(discovery.scan(born, dead));
+  REQUIRE(born == std::vector<pid_t>{5, 100});
+  REQUIRE(dead == std::vector<pid_t>{3, 4000000});
+  REQUIRE(discovery.pids() == std::vector<pid_t>{1, 5, 20, 100});
+
+  // unchanged list, previous results are cleared
+  REQUIRE(discovery.scan(born, dead));
+  REQUIRE(born.empty());
+  REQUIRE(dead.empty());
+
+  // every process is dead when the list is empty
+  for (const char *name: {"1", "5", "20", "100"}) {
+    REQUIRE(dir.rmdir(name));
+  }
+  REQUIRE(discovery.scan(born, dead));
+  REQUIRE(born.empty());
+  REQUIRE(dead == std::vector<pid_t>{1, 5, 20, 100});
+  REQUIRE(discovery.pids().empty());
+
+  ProcessDiscovery missing(procFs.filePath("missing"));
+  REQUIRE(!missing.scan(born, dead));
+}
+
+#endif // UNIT_TESTS
@@ -0,0 +1,64 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <Utils.h>
+
+#include <QString>
+
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Discovery of processes in proc filesystem.
+ *
+ * Directory entries are read by getdents64 syscall to reused buffer,
+ * pids are kept in sorted vector and compared with previous scan by linear merge.
+ */
+class ProcessDiscovery {
+  Q_DISABLE_COPY_MOVE(ProcessDiscovery)
+
+public:
+  explicit ProcessDiscovery(const QString &procFs);
+  ~ProcessDiscovery();
+
+  /**
+   * Scan proc filesystem.
+   * @param born pids that appeared since previous scan
+   * @param dead pids that disappeared since previous scan
+   */
+  bool scan(std::vector<pid_t> &born, std::vector<pid_t> &dead);
+
+  /** Sorted pids from the last scan */
+  const std::vector<pid_t> &pids() const {
+    return previous;
+  }
+
+private:
+  bool readPids(std::vector<pid_t> &pids);
+
+private:
+  QString procFs;
+  int dirFd{-1};
+  std::vector<char> buffer;
+  std::vector<pid_t> current;
+  std::vector<pid_t> previous;
+};
@@ -18,234 +18,187 @@
 */
 
 #include "ProcessMemoryWatcher.h"
+#include <SmapsParser.h>
 #include <StatM.h>
 #include <Utils.h>
-#include <String.h>
 
 #include <QDebug>
 #include <QtCore/QFileInfo>
 #include <QTextStream>
 #include <QtCore/QDateTime>
 
+#include <cstdlib>
 
 namespace {
-
-size_t parseMemory(const QString &line) {
-  QStringList arr = line.split(" ", SkipEmptyParts);
-  if (arr.size() != 3) {
-    qWarning() << "Can't parse memory line" << line;
-    return 0;
-  }
-  bool ok = true;
-  size_t val = arr[1].toULongLong(&ok);
-  if (!ok) {
-    qWarning() << "Can't parse memory line" << line;
-    return 0;
-  }
-  return val;
-}
-
-void parseRange(SmapsRange &range, const QString &line, const ProcessId &processId) {
-  QStringList arr = line.split(" ", SkipEmptyParts);
-  if (arr.size() < 5) {
-    qWarning() << "Can't parse range:" << line;
-  }
-  QStringList arr2 = arr[0].split("-", SkipEmptyParts);
-  if (arr2.size() != 2) {
-    qWarning() << "Can't parse range:" << line;
-  }
-  range.key.processId = processId;
-  range.key.from = arr2[0].toULongLong(nullptr, 16);
-  range.key.to = arr2[1].toULongLong(nullptr, 16);
-  range.key.name = arr.size() >= 6 ? arr[5] : "";
-  range.key.permission = arr[1];
-  range.rss = 0;
-  range.pss = 0;
-}
+// statm, oom_adj, oom_score and oom_score_adj are just few numbers
+constexpr size_t SmallFileBufferSize = 256;
 } // namespace
 
-
-ProcessMemoryWatcher::ProcessMemoryWatcher(QThread *thread,
-                                           pid_t pid,
-                                           QString procFs):
+ProcessMemoryWatcher::ProcessMemoryWatcher(pid_t pid,
+                                           QString procFs,
+                                           SnapshotQueue &queue,
+                                           long fullSmapsPeriod):
   processId(pid, procFs),
-  thread(thread),
+  queue(queue),
   smapsFile(QString("%1/%2/smaps").arg(procFs).arg(pid)),
+  smapsRollupFile(QString("%1/%2/smaps_rollup").arg(procFs).arg(pid)),
   statmFile(QString("%1/%2/statm").arg(procFs).arg(pid)),
   statusFile(QString("%1/%2/status").arg(procFs).arg(pid)),
   oomAdjFile(QString("%1/%2/oom_adj").arg(procFs).arg(pid)),
   oomScoreFile(QString("%1/%2/oom_score").arg(procFs).arg(pid)),
-  oomScoreAdjFile(QString("%1/%2/oom_score_adj").arg(procFs).arg(pid))
-{
-  moveToThread(thread);
-}
+  oomScoreAdjFile(QString("%1/%2/oom_score_adj").arg(procFs).arg(pid)),
+  smapsParser(processId),
+  fullSmapsPeriod(fullSmapsPeriod)
+{}
 
 bool ProcessMemoryWatcher::readStatM(StatM &statm) {
-  QFile inputFile(statmFile.absoluteFilePath());
-  if (!inputFile.open(QIODevice::ReadOnly)) {
-    qWarning() << "Can't open file" << statmFile.absoluteFilePath();
-    return false;
-  }
-  QTextStream in(&inputFile);
-
-  QString line = in.readLine();
-  if (line.isEmpty()){
-    qWarning() << "Can't parse" << statmFile.absoluteFilePath();
+  char buffer[SmallFileBufferSize];
+  size_t length;
+  if (!statmFile.read(buffer, sizeof(buffer), length)) {
+    qWarning() << "Can't read file" << statmFile.path();
     return false;
   }
 
-  QStringList arr = line.split(" ", SkipEmptyParts);
-  if (arr.size() < 7){
-    qWarning() << "Can't parse" << statmFile.absoluteFilePath();
-    return false;
-  }
-  QVector<size_t> arri;
-  arri.reserve(arr.size());
-  for (const auto &numStr:arr){
-    bool ok;
-    arri.push_back(numStr.toULongLong(&ok) * PageSizeKiB);
-    if (!ok){
-      qWarning() << "Can't parse" << statmFile.absoluteFilePath();
+  // size resident shared text lib data dt
+  size_t values[7];
+  char *p = buffer;
+  for (size_t &value: values) {
+    char *end;
+    value = std::strtoull(p, &end, 10) * PageSizeKiB;
+    if (end == p) {
+      qWarning() << "Can't parse" << statmFile.path() << ":" << buffer;
       return false;
     }
+    p = end;
   }
 
-  statm.size = arri[0];
-  statm.resident = arri[1];
-  statm.shared = arri[2];
-  statm.text = arri[3];
-  statm.lib = arri[4];
-  statm.data = arri[5];
-  statm.dt = arri[6];
+  statm.size = values[0];
+  statm.resident = values[1];
+  statm.shared = values[2];
+  statm.text = values[3];
+  statm.lib = values[4];
+  statm.data = values[5];
+  statm.dt = values[6];
 
   return true;
 }
 
-bool ProcessMemoryWatcher::readInt(const QFileInfo &file, int &value) const {
-  if (!file.exists()) {
-    return false;
-  }
-
-  QFile inputFile(file.absoluteFilePath());
-  if (!inputFile.open(QIODevice::ReadOnly)) {
-    qWarning() << "Can't open file" << file.absoluteFilePath();
+bool ProcessMemoryWatcher::readInt(ProcFile &file, int &value) {
+  char buffer[SmallFileBufferSize];
+  size_t length;
+  if (!file.read(buffer, sizeof(buffer), length)) {
+    // oom files may be missing on some kernels
     return false;
   }
-  QTextStream in(&inputFile);
 
-  QString line = in.readLine();
-  if (line.isEmpty()){
-    qWarning() << "Can't parse" << file.absoluteFilePath();
+  char *end;
+  long i = std::strtol(buffer, &end, 10);
+  if (end == buffer) {
+    qWarning() << "Can't parse" << file.path() << ":" << buffer;
     return false;
   }
-
-  bool ok = true;
-  int i = line.toInt(&ok);
-  if (!ok) {
-    qWarning() << "Can't parse" << file.absoluteFilePath() << ":" << line;
-    return false;
-  }
-  value = i;
+  value = int(i);
   return true;
 }
+
 OomScore ProcessMemoryWatcher::readOomScore() {
   OomScore result;
   readInt(oomAdjFile, result.adj);
-  readInt(oomScoreFile, result.adj);
-  readInt(oomScoreAdjFile, result.adj);
+  readInt(oomScoreFile, result.score);
+  readInt(oomScoreAdjFile, result.scoreAdj);
   return result;
 }
 
 bool ProcessMemoryWatcher::readSmaps(QList<SmapsRange> &ranges)
 {
-  QFile inputFile(smapsFile.absoluteFilePath());
-  if (!inputFile.open(QIODevice::ReadOnly)) {
-    qWarning() << "Can't open file" << smapsFile.absoluteFilePath();
+  if (!smapsFile.access([&](int fd) { return smapsParser.parse(fd, ranges); })) {
+    qWarning() << "Can't read file" << smapsFile.path();
     return false;
   }
-  QTextStream in(&inputFile);
-  bool rangeLine = true;
-  SmapsRange range;
-  for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
-    if (rangeLine) {
-      //qDebug() << line;
-      parseRange(range, line, processId);
-      rangeLine = false;
-    }else{
-      if (line.startsWith(lastLineStart)){
-        rangeLine = true;
-        ranges << range;
-        //range.debugPrint();
-      } else if (line.startsWith("Rss:")) {
-        range.rss = parseMemory(line);
-      } else if (line.startsWith("Pss:")) {
-        range.pss = parseMemory(line);
-      }
-    }
-  }
+  return true;
+}
 
+bool ProcessMemoryWatcher::readSmapsRollup(QList<SmapsRange> &ranges)
+{
+  // smaps_rollup has the same format as smaps, with single range covering whole address space
+  if (!smapsRollupFile.access([&](int fd) { return smapsParser.parse(fd, ranges); }) ||
+      ranges.size() != 1) {
+    qWarning() << "Can't read file" << smapsRollupFile.path();
+    return false;
+  }
   return true;
 }
 
 void ProcessMemoryWatcher::update(QDateTime time)
 {
-  if (thread != QThread::currentThread()) {
-    qWarning() << "Incorrect thread;" << thread << "!=" << QThread::currentThread();
+  if (alive) {
+    if (!initialized) {
+      init();
+      initialized = true;
+    }
+    sample(time);
   }
+  scheduled = false;
+}
 
-  smapsFile.refresh(); // flush cached info, and get updated info
-  if (!smapsFile.exists()) {
-    // qWarning() << "File" << smapsFile.absoluteFilePath() << "don't exists";
+void ProcessMemoryWatcher::sample(const QDateTime &time)
+{
+  if (!exitNotification && !QFileInfo::exists(smapsFile.path())) {
+    // qWarning() << "File" << smapsFile.path() << "don't exists";
     emit exited(processId);
     return;
   }
 
-  QList<SmapsRange> ranges;
+  ProcessSnapshot snapshot;
+  snapshot.time = time;
+  snapshot.processId = processId;
   if (accessible) {
-    if (!readSmaps(ranges)) {
-      return;
+    if (rollupAvailable &&
+        lastFullSmaps.isValid() &&
+        lastFullSmaps.msecsTo(time) < fullSmapsPeriod) {
+      snapshot.sampleType = SmapsRollup;
+      if (!readSmapsRollup(snapshot.ranges)) {
+        return;
+      }
+    } else {
+      if (!readSmaps(snapshot.ranges)) {
+        return;
+      }
+      lastFullSmaps = time;
     }
   }
+  for (const SmapsRange &range: snapshot.ranges) {
+    snapshot.rssSum += range.rss;
+    snapshot.pssSum += range.pss;
+  }
 
-  StatM statm;
-  if (!readStatM(statm)){
+  if (!readStatM(snapshot.statm)){
     return;
   }
 
-  OomScore oomScore = readOomScore();
+  snapshot.oomScore = readOomScore();
 
-  emit snapshot(time, processId, ranges, statm, oomScore);
+  std::swap(snapshot.processName, processName);
+  queue.push(std::move(snapshot));
 }
 
 bool ProcessMemoryWatcher::initSmaps() {
-  if (!smapsFile.exists()){
-    qWarning() << "File" << smapsFile.absoluteFilePath() << "don't exists";
+  if (!QFileInfo::exists(smapsFile.path())){
+    qWarning() << "File" << smapsFile.path() << "don't exists";
     return false;
   }
-  QFile inputFile(smapsFile.absoluteFilePath());
-  if (!inputFile.open(QIODevice::ReadOnly)) {
-    qWarning() << "Can't open file" << smapsFile.absoluteFilePath();
+  QList<SmapsRange> ranges;
+  if (!smapsFile.access([&](int fd) { return smapsParser.parse(fd, ranges); })) {
+    qWarning() << "Can't open file" << smapsFile.path();
     // not enough privileges?
     return false;
   }
-  QTextStream in(&inputFile);
-  QString lastLine;
-  for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
-    lastLine = line;
-  }
-  inputFile.close();
-  if (lastLine.isEmpty()) {
-    // qWarning() << "Last line is empty" << smapsFile.absoluteFilePath();
+  if (ranges.isEmpty()) {
+    // qWarning() << "No memory ranges" << smapsFile.path();
     // kernel thread ?
+    smapsFile.close();
     return false;
   }
-  QStringList arr = lastLine.split(":", SkipEmptyParts);
-  if (arr.size() != 2) {
-    qWarning() << "Last line is malformed" << smapsFile.absoluteFilePath();
-    return false;
-  }
-  lastLineStart = arr[0];
-  // qDebug() << "lastLineStart:" << lastLineStart;
   return true;
 }
 
@@ -256,21 +209,27 @@ QString ProcessMemoryWatcher::readProcessName() const {
     return "";
   }
   QTextStream in(&inputFile);
-  QString processName;
+  QString name;
   for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
     if (line.startsWith("Name:")) {
-      processName = line.right(line.size() - QString("Name:").size()).trimmed();
+      name = line.right(line.size() - QString("Name:").size()).trimmed();
       break;
     }
   }
   inputFile.close();
-  return processName;
+  return name;
 }
 
 void ProcessMemoryWatcher::init()
 {
   accessible = initSmaps();
-  QString processName = readProcessName();
+  if (accessible && fullSmapsPeriod > 0) {
+    rollupAvailable = QFileInfo::exists(smapsRollupFile.path());
+    if (!rollupAvailable) {
+      qWarning() << "File" << smapsRollupFile.path() << "don't exists, reading full smaps";
+    }
+  }
+  processName = readProcessName();
   if (!processName.isEmpty()) {
     emit initialized(processId, processName);
   }
@@ -20,13 +20,15 @@
 #pragma once
 
 #include <OomScore.h>
+#include "SnapshotQueue.h"
+
+#include <ProcFile.h>
 #include <ProcessId.h>
+#include <SmapsParser.h>
 #include <SmapsRange.h>
 #include <Utils.h>
 
 #include <QtCore/QObject>
-#include <QThread>
-#include <QTimer>
 #include <QDateTime>
 #include <QtCore/QProcessEnvironment>
 #include <QtCore/QFileInfo>
@@ -41,22 +43,17 @@ class ProcessMemoryWatcher : public QObject{
 signals:
   void initialized(ProcessId processId, QString name);
 
-  void snapshot(QDateTime time,
-                ProcessId processId,
-                QList<SmapsRange> ranges,
-                StatM statm,
-                OomScore oomScore);
-
   void exited(ProcessId processId);
 
-public slots:
-  void init();
-  void update(QDateTime time);
-
 public:
-  ProcessMemoryWatcher(QThread *thread,
-                       pid_t pid,
-                       QString procFs);
+  /**
+   * @param fullSmapsPeriod when positive, smaps_rollup is read on every update
+   *   and full smaps just once per this period [ms]
+   */
+  ProcessMemoryWatcher(pid_t pid,
+                       QString procFs,
+                       SnapshotQueue &queue,
+                       long fullSmapsPeriod = 0);
 
   virtual ~ProcessMemoryWatcher() = default;
 
@@ -64,23 +61,63 @@ public:
     return processId;
   }
 
+  /**
+   * When enabled, process exit is notified from outside (see ExitWatcher)
+   * and existence of the process is not checked on every update.
+   */
+  void setExitNotification(bool enabled) {
+    exitNotification = enabled;
+  }
+
+  /** Process exited, no more snapshots are taken. Thread safe. */
+  void markExited() {
+    alive = false;
+  }
+
+  /**
+   * Reserve watcher for the next update.
+   * @return false when previous update was not finished yet
+   */
+  bool schedule() {
+    return !scheduled.exchange(true);
+  }
+
+  /**
+   * Take snapshot of the process, it may be called from any thread
+   * after successful schedule. Watcher is initialized by the first call.
+   */
+  void update(QDateTime time);
+
 private:
+  void init();
+  void sample(const QDateTime &time);
   bool initSmaps();
   QString readProcessName() const;
   bool readSmaps(QList<SmapsRange> &ranges);
+  bool readSmapsRollup(QList<SmapsRange> &ranges);
   bool readStatM(StatM &statm);
-  bool readInt(const QFileInfo &file, int &value) const;
+  bool readInt(ProcFile &file, int &value);
   OomScore readOomScore();
 
 private:
   ProcessId processId;
-  QThread *thread;
-  QFileInfo smapsFile;
-  QFileInfo statmFile;
+  SnapshotQueue &queue;
+  QString processName; //!< sent with the first snapshot
+  // descriptors are kept open for the whole watcher life, see ProcFile
+  ProcFile smapsFile;
+  ProcFile smapsRollupFile;
+  ProcFile statmFile;
   QFileInfo statusFile;
-  QFileInfo oomAdjFile;
-  QFileInfo oomScoreFile;
-  QFileInfo oomScoreAdjFile;
-  QString lastLineStart;
+  ProcFile oomAdjFile;
+  ProcFile oomScoreFile;
+  ProcFile oomScoreAdjFile;
+  SmapsParser smapsParser;
   bool accessible{true}; // false when smaps is not accessible (we don't have enough privileges)
+  long fullSmapsPeriod{0};
+  bool rollupAvailable{false}; // smaps_rollup exists since Linux 4.14
+  QDateTime lastFullSmaps;
+  std::atomic<bool> exitNotification{false};
+  std::atomic<bool> alive{true};
+  std::atomic<bool> scheduled{false};
+  bool initialized{false};
 };
@@ -21,14 +21,16 @@
 #include "Record.h"
 
 #include <CmdLineParsing.h>
+#include <ProcFile.h>
 #include <ThreadPool.h>
 #include <Utils.h>
 #include <Version.h>
 
 #include <QtCore/QCoreApplication>
 #include <QDebug>
-#include <QDirIterator>
+#include <QElapsedTimer>
 
+#include <algorithm>
 #include <iostream>
 #include <signal.h>
 
@@ -36,50 +38,104 @@ void Record::close()
 {
   qDebug() << "close()";
   timer.stop();
-  for (ProcessMemoryWatcher *watcher: watchers.values()) {
-    watcher->deleteLater();
+  queue.close();
+  scheduler.close();
+  if (feeder != nullptr) {
+    // write all snapshots accepted by the queue before the writer event loop is finished,
+    // feeder is deleted when its thread finishes
+    QMetaObject::invokeMethod(feeder, "close", Qt::BlockingQueuedConnection);
+    writerThread->quit();
+    feeder = nullptr;
   }
-  watchers.clear();
-  for (auto *t: watcherThreads) {
-    t->quit(); // thread is deleted on finish
+  if (checkpointer != nullptr) {
+    QMetaObject::invokeMethod(checkpointer, "close", Qt::BlockingQueuedConnection);
+    checkpointThread->quit();
+    checkpointer = nullptr;
   }
-  watcherThreads.clear();
+  watchers.clear();
   threadPool.close();
 }
 
-Record::Record(QSet<long> pids,
-               long period,
-               QString databaseFile,
-               QString procFs):
-  systemMemoryWatcher(procFs),
-  monitorSystem(pids.empty()),
-  procFs(procFs)
+Record::Record(const RecordOptions &options):
+  scheduler(QThread::idealThreadCount()),
+  discovery(options.procFs),
+  exitWatcher(options.procFs),
+  systemMemoryWatcher(options.procFs),
+  queue(options.queueBudget, options.queuePolicy),
+  monitorSystem(options.pids.empty()),
+  options(options)
 {
   connect(&threadPool, &ThreadPool::closed, this, &Record::deleteLater);
 
-  timer.setSingleShot(false);
-  timer.setInterval(period);
-
-  connect(&timer, &QTimer::timeout, this, &Record::update);
-
-  timer.start();
-
-  if (!feeder.init(databaseFile)){
+  connect(&timer, &TickTimer::timeout, this, &Record::update);
+
+  timer.start(options.period);
+
+  // database writes are done by dedicated thread, slow commits don't delay ticks
+  writerThread = threadPool.makeThread("writer");
+  feeder = new Feeder(queue, stats, options.maxWriteLatency);
+  feeder->setRotation(DatabaseRotation(options.databaseFile, options.rotateInterval,
+                                       options.rotateSize, options.maxFiles));
+  feeder->moveToThread(writerThread);
+  connect(writerThread, &QThread::finished, feeder, &Feeder::deleteLater);
+  writerThread->start();
+
+  bool initialized = false;
+  if (options.binLogDirectory.isEmpty()) {
+    QMetaObject::invokeMethod(feeder, "init", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, initialized),
+                              Q_ARG(QString, options.databaseFile),
+                              Q_ARG(bool, options.wal),
+                              Q_ARG(int, options.delta ? int(options.keyframeInterval) : 0),
+                              Q_ARG(DataFormat, options.dataFormat));
+  } else {
+    QMetaObject::invokeMethod(feeder, "initBinLog", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, initialized),
+                              Q_ARG(QString, options.binLogDirectory),
+                              Q_ARG(qlonglong, options.segmentSize));
+  }
+  if (!initialized){
     close();
     return;
   }
 
-  watcherThreads.reserve(QThread::idealThreadCount());
-  for (int i = 0; i < QThread::idealThreadCount(); i++) {
-    QThread *t = threadPool.makeThread(QString("watcher-%1").arg(i));
-    t->start();
-    watcherThreads.push_back(t);
+  if (options.wal) {
+    // name of the first file is given by rotation
+    QString databaseFile;
+    QMetaObject::invokeMethod(feeder, "databaseFile", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(QString, databaseFile));
+    checkpointThread = threadPool.makeThread("checkpoint");
+    checkpointer = new Checkpointer(databaseFile, stats,
+                                    options.checkpointInterval, options.checkpointSize);
+    checkpointer->moveToThread(checkpointThread);
+    connect(checkpointThread, &QThread::finished, checkpointer, &Checkpointer::deleteLater);
+    checkpointThread->start();
+
+    QMetaObject::invokeMethod(checkpointer, "init", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, initialized));
+    if (!initialized){
+      close();
+      return;
+    }
+    connect(feeder, &Feeder::rotated,
+            checkpointer, &Checkpointer::switchFile,
+            Qt::QueuedConnection);
   }
 
+  qDebug() << "Budget of open /proc file descriptors:" << ProcFile::initBudget(options.fdBudget);
+
+  connect(&queue, &SnapshotQueue::available,
+          feeder, &Feeder::drain,
+          Qt::QueuedConnection);
+
+  connect(&scheduler, &TaskScheduler::tickFinished,
+          this, &Record::tickFinished,
+          Qt::QueuedConnection);
+
   if (monitorSystem) {
     updateProcessList();
   } else {
-    for (pid_t pid: pids) {
+    for (pid_t pid: options.pids) {
       startProcessMonitor(pid);
     }
   }
@@ -88,9 +144,24 @@ Record::Record(QSet<long> pids,
           &systemMemoryWatcher, &SystemMemoryWatcher::update);
 
   connect(&systemMemoryWatcher, &SystemMemoryWatcher::systemSnapshot,
-          &feeder, &Feeder::onSystemSnapshot,
+          feeder, &Feeder::onSystemSnapshot,
+          Qt::QueuedConnection);
+
+  connect(this, &Record::recorderStats,
+          feeder, &Feeder::onRecorderStats,
           Qt::QueuedConnection);
 
+  connect(this, &Record::tickCompleted,
+          feeder, &Feeder::onTickFinished,
+          Qt::QueuedConnection);
+
+  connect(this, &Record::processRemoved,
+          feeder, &Feeder::onProcessExited,
+          Qt::QueuedConnection);
+
+  connect(&exitWatcher, &ExitWatcher::exited,
+          this, &Record::processExited);
+
   // for debug
   // shutdownTimer.setSingleShot(true);
   // shutdownTimer.setInterval(10000);
@@ -105,40 +176,24 @@ Record::~Record()
 }
 
 void Record::startProcessMonitor(pid_t pid) {
-  assert(!watcherThreads.empty());
-  QThread *watcherThread = watcherThreads[ nextThread++ % watcherThreads.size()];
-  ProcessMemoryWatcher *watcher = new ProcessMemoryWatcher(watcherThread, pid, procFs);
-
-  connect(watcher, &ProcessMemoryWatcher::snapshot,
-          &feeder, &Feeder::onProcessSnapshot,
-          Qt::QueuedConnection);
-
-  connect(this, &Record::updateRequest,
-          watcher, &ProcessMemoryWatcher::update,
-          Qt::QueuedConnection);
-
-  connect(watcher, &ProcessMemoryWatcher::initialized,
-          &feeder, &Feeder::processInitialized,
-          Qt::QueuedConnection);
-
-  connect(watcher, &ProcessMemoryWatcher::initialized,
+  // watcher may be released by worker thread, deleteLater is thread safe
+  std::shared_ptr<ProcessMemoryWatcher> watcher(
+    new ProcessMemoryWatcher(pid,
+                             options.procFs,
+                             queue,
+                             options.smapsRollup ? options.fullSmapsPeriod : 0),
+    [](ProcessMemoryWatcher *w) { w->deleteLater(); });
+
+  connect(watcher.get(), &ProcessMemoryWatcher::initialized,
           this, &Record::processInitialized,
           Qt::QueuedConnection);
 
-  connect(watcher, &ProcessMemoryWatcher::exited,
+  connect(watcher.get(), &ProcessMemoryWatcher::exited,
           this, &Record::processExited,
           Qt::QueuedConnection);
 
-  connect(watcherThread, &QThread::finished,
-          watcher, &ProcessMemoryWatcher::deleteLater);
-
+  watcher->setExitNotification(exitWatcher.watch(watcher->getProcessId()));
   watchers[pid] = watcher;
-
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-  QMetaObject::invokeMethod(watcher, "init", Qt::QueuedConnection);
-#else
-  QMetaObject::invokeMethod(watcher, &ProcessMemoryWatcher::init, Qt::QueuedConnection);
-#endif
 }
 
 void Record::processInitialized(ProcessId processId, QString name) {
@@ -147,40 +202,112 @@ void Record::processInitialized(ProcessId processId, QString name) {
 
 void Record::processExited(ProcessId processId) {
   auto it = watchers.find(processId.pid);
-  if (it != watchers.end()) {
+  if (it != watchers.end() && it.value()->getProcessId().startTime == processId.startTime) {
     qDebug() << "Process" << processId.pid << "(hash" << processId.hash() << ") terminated";
-    it.value()->deleteLater();
-    watchers.remove(processId.pid);
+    exitWatcher.unwatch(processId.pid);
+    it.value()->markExited();
+    watchers.erase(it);
+    emit processRemoved(processId);
+    if (monitorSystem) {
+      exitedProcesses.push_back(processId);
+    }
   }
 }
 
 void Record::updateProcessList() {
-  QDirIterator it(procFs);
-  bool ok;
-  while (it.hasNext()) {
-    QFileInfo dir(it.next());
-    auto pid = dir.fileName().toULongLong(&ok);
-    if (ok && pid <= std::numeric_limits<pid_t>::max() && !watchers.contains(pid)) {
+  QElapsedTimer scanTimer;
+  scanTimer.start();
+  if (!discovery.scan(bornPids, deadPids)) {
+    return;
+  }
+  stats.set("scan_us", scanTimer.nsecsElapsed() / 1000);
+  stats.set("scan_pids", discovery.pids().size());
+
+  // pid reused between two scans is not reported, its watcher detects the exit by itself
+  for (pid_t pid: deadPids) {
+    auto it = watchers.find(pid);
+    if (it != watchers.end()) {
+      processExited(it.value()->getProcessId());
+    }
+  }
+  for (pid_t pid: bornPids) {
+    if (!watchers.contains(pid)) {
       startProcessMonitor(pid);
     }
   }
+  // exited pid that is still listed is either zombie, that is not reaped yet,
+  // or it was reused by new process with different start time
+  const std::vector<pid_t> &pids = discovery.pids();
+  size_t kept = 0;
+  for (const ProcessId &exited: exitedProcesses) {
+    if (watchers.contains(exited.pid) || !std::binary_search(pids.begin(), pids.end(), exited.pid)) {
+      continue;
+    }
+    ProcessId::StartTime startTime = ProcessId::processStartTime(exited.pid, options.procFs);
+    if (startTime == exited.startTime) {
+      exitedProcesses[kept++] = exited;
+    } else if (startTime != 0) {
+      startProcessMonitor(exited.pid);
+    }
+  }
+  exitedProcesses.erase(exitedProcesses.begin() + long(kept), exitedProcesses.end());
 }
 
-void Record::update() {
+void Record::update(qulonglong missedTicks, qint64 latenessUs) {
+  QDateTime time = QDateTime::currentDateTime();
+  if (lastTick.isValid()) {
+    qint64 periodUs = lastTick.nsecsElapsed() / 1000;
+    stats.set("tick_period_us", periodUs);
+    stats.set("tick_jitter_us", qAbs(periodUs - qint64(options.period) * 1000 * qint64(missedTicks + 1)));
+  }
+  lastTick.start();
+  stats.set("tick_lateness_us", latenessUs);
+  stats.set("tick_missed", missedTicks);
+  stats.set("tick_overrun", unfinishedTicks > 0 ? 1 : 0);
+
   if (monitorSystem) {
     updateProcessList();
   }
   qDebug() << "tick, watching" << watchers.size() << "processes";
-  emit updateRequest(QDateTime::currentDateTime());
+  emit updateRequest(time);
+
+  // watchers with unfinished snapshot from previous tick are skipped
+  std::vector<TaskScheduler::Task> tasks;
+  tasks.reserve(watchers.size());
+  for (const auto &watcher: watchers) {
+    if (watcher->schedule()) {
+      tasks.push_back([watcher, time]() { watcher->update(time); });
+    }
+  }
+  stats.set("watchers", watchers.size());
+  stats.set("tick_skipped", qlonglong(watchers.size()) - qlonglong(tasks.size()));
+  emit recorderStats(time, stats.take());
+
+  unfinishedTicks++;
+  scheduler.submit(time, std::move(tasks));
+}
+
+void Record::tickFinished(TickReport report) {
+  unfinishedTicks--;
+  stats.set("tick_us", report.durationUs);
+  stats.set("tick_tasks", report.tasks);
+  stats.set("tick_steals", report.steals);
+  stats.set("worker_busy_max_us", report.workerBusyMaxUs);
+  stats.set("worker_busy_min_us", report.workerBusyMinUs);
+  const auto counters = queue.takeCounters();
+  for (auto it = counters.cbegin(); it != counters.cend(); ++it) {
+    stats.set(it.key(), it.value());
+  }
+  emit recorderStats(report.time, stats.take());
+  emit tickCompleted(report.time);
 }
 
 struct Arguments {
   bool help{false};
   bool version{false};
-  QSet<long> pids;
-  long period{1000};
-  QString databaseFile;
-  QString procFs{"/proc"};
+  QString queuePolicy{"drop-smaps-keep-statm"};
+  QString dataFormat{"rows"};
+  RecordOptions options;
 };
 
 class ArgParser: public CmdLineParser {
@@ -209,29 +336,150 @@ public:
               false);
 
     AddOption(CmdLineULongOption([this](const unsigned long &value) {
-                    args.pids.insert(value);
+                    args.options.pids.insert(value);
                   }),
                   std::vector<std::string>{"p","pid"},
                   "Pid of monitored process. May be defined multiple times. "s +
                   "If not defined, all processes are monitored."s);
 
     AddOption(CmdLineULongOption([this](const unsigned long &value) {
-                    args.period = value;
+                    args.options.period = value;
                   }),
                   "period",
-                  "Period of snapshot [ms], default "s + std::to_string(args.period));
+                  "Period of snapshot [ms], default "s + std::to_string(args.options.period));
 
     AddOption(CmdLineStringOption([this](const std::string &value){
-                    args.databaseFile = QString::fromStdString(value);
+                    args.options.databaseFile = QString::fromStdString(value);
                   }),
               "database-file",
-              "Sqlite database file for storing recording. Default is measurement.db");
+              "Sqlite database file for storing recording. Default is "s + args.options.databaseFile.toStdString());
 
     AddOption(CmdLineStringOption([this](const std::string &value){
-                    args.procFs = QString::fromStdString(value);
+                    args.options.procFs = QString::fromStdString(value);
                   }),
               "proc",
-              "Mount point of proc filesystem. Default is "s + args.procFs.toStdString());
+              "Mount point of proc filesystem. Default is "s + args.options.procFs.toStdString());
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.options.smapsRollup = value;
+              }),
+              "smaps-rollup",
+              "Read process Rss/Pss sums from /proc/<pid>/smaps_rollup on every snapshot, "s +
+              "full smaps with memory mappings is read with full-smaps-period."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.fullSmapsPeriod = value;
+                  }),
+                  "full-smaps-period",
+                  "Period of full smaps snapshot [ms] when smaps-rollup is used, default "s +
+                  std::to_string(args.options.fullSmapsPeriod));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.fdBudget = value;
+                  }),
+                  "fd-budget",
+                  "Maximum number of /proc file descriptors kept open between snapshots. "s +
+                  "Default is given by RLIMIT_NOFILE."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.queueBudget = value * 1024 * 1024;
+                  }),
+                  "queue-budget",
+                  "Memory budget of snapshots waiting for write to database [MiB], default "s +
+                  std::to_string(args.options.queueBudget / (1024 * 1024)));
+
+    AddOption(CmdLineStringOption([this](const std::string &value){
+                    args.queuePolicy = QString::fromStdString(value);
+                  }),
+              "queue-policy",
+              "What to do when queue-budget is exceeded: drop-oldest (snapshots), "s +
+              "drop-smaps-keep-statm (drop memory mappings of oldest snapshots) or block (watchers). "s +
+              "Default is "s + args.queuePolicy.toStdString());
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.maxWriteLatency = value;
+                  }),
+                  "max-write-latency",
+                  "Snapshots of one tick are written in single transaction, it is committed "s +
+                  "after this time [ms] even when the tick is not finished. Default "s +
+                  std::to_string(args.options.maxWriteLatency));
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.options.wal = value;
+              }),
+              "wal",
+              "Use write-ahead log. Database is not corrupted by crash of the system "s +
+              "and analysis tools may read it during recording. Log is checkpointed "s +
+              "by background thread."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.checkpointInterval = value;
+                  }),
+                  "checkpoint-interval",
+                  "Maximum time between checkpoints of write-ahead log [ms], default "s +
+                  std::to_string(args.options.checkpointInterval));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.checkpointSize = qint64(value) * 1024 * 1024;
+                  }),
+                  "checkpoint-size",
+                  "Size of write-ahead log that triggers checkpoint [MiB], default "s +
+                  std::to_string(args.options.checkpointSize / (1024 * 1024)));
+
+    AddOption(CmdLineFlag([this](const bool &value) {
+                args.options.delta = value;
+              }),
+              "delta",
+              "Write memory mapping of full smaps snapshot just when its Rss or Pss changes, "s +
+              "appears or disappears. All mappings are written periodically with keyframe-interval."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.keyframeInterval = long(value);
+                  }),
+                  "keyframe-interval",
+                  "Every n-th full smaps snapshot of the process contains all mappings in delta mode, default "s +
+                  std::to_string(args.options.keyframeInterval));
+
+    AddOption(CmdLineStringOption([this](const std::string &value){
+                    args.dataFormat = QString::fromStdString(value);
+                  }),
+              "data-format",
+              "How memory mappings of full smaps snapshot are stored: rows (row per mapping), "s +
+              "blob (single value per snapshot) or compressed-blob. Default is "s + args.dataFormat.toStdString());
+
+    AddOption(CmdLineStringOption([this](const std::string &value){
+                    args.options.binLogDirectory = QString::fromStdString(value);
+                  }),
+              "binlog",
+              "Write append-only binary log to this directory instead of database. "s +
+              "It may be converted to database by memory-migrate."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.segmentSize = qint64(value) * 1024 * 1024;
+                  }),
+                  "segment-size",
+                  "Size of binary log segment [MiB], default "s +
+                  std::to_string(args.options.segmentSize / (1024 * 1024)));
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.rotateInterval = long(value);
+                  }),
+                  "rotate-interval",
+                  "Start new database file after this time [s]. Files are named by database-file "s +
+                  "and UTC time of their start (measurement-20211005-134501.db). Default 0 disables rotation by time."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.rotateSize = qint64(value) * 1024 * 1024;
+                  }),
+                  "rotate-size",
+                  "Start new database file when it exceeds this size [MiB]. "s +
+                  "Default 0 disables rotation by size."s);
+
+    AddOption(CmdLineULongOption([this](const unsigned long &value) {
+                    args.options.maxFiles = long(value);
+                  }),
+                  "max-files",
+                  "Number of rotated database files kept, the oldest are deleted. Default 0 keeps all files."s);
   }
 
   Arguments GetArguments() const {
@@ -263,13 +511,33 @@ int main(int argc, char* argv[]) {
       std::cout << MEMORY_WATCHER_VERSION_STRING << std::endl;
       return 0;
     }
+    if (!SnapshotQueue::parsePolicy(args.queuePolicy, args.options.queuePolicy)) {
+      std::cerr << "ERROR: Unknown queue policy " << args.queuePolicy.toStdString() << std::endl;
+      std::cout << argParser.GetHelp() << std::endl;
+      return 1;
+    }
+    if (!Storage::parseDataFormat(args.dataFormat, args.options.dataFormat)) {
+      std::cerr << "ERROR: Unknown data format " << args.dataFormat.toStdString() << std::endl;
+      std::cout << argParser.GetHelp() << std::endl;
+      return 1;
+    }
+    if (!args.options.binLogDirectory.isEmpty() &&
+        (args.options.wal || args.options.delta || args.options.dataFormat != DataFormat::Rows)) {
+      std::cerr << "ERROR: wal, delta and data-format options can't be used with binary log" << std::endl;
+      return 1;
+    }
+    bool rotation = args.options.rotateInterval > 0 || args.options.rotateSize > 0;
+    if (rotation && !args.options.binLogDirectory.isEmpty()) {
+      std::cerr << "ERROR: binary log is split to segments by segment-size, it can't be rotated" << std::endl;
+      return 1;
+    }
+    if (args.options.maxFiles > 0 && !rotation) {
+      std::cerr << "ERROR: max-files requires rotate-interval or rotate-size" << std::endl;
+      return 1;
+    }
   }
 
-  if (args.databaseFile.isEmpty()) {
-    args.databaseFile = QString("measurement.db");
-  }
-
-  Record *record = new Record(args.pids, args.period, args.databaseFile, args.procFs);
+  Record *record = new Record(args.options);
   std::function<void(int)> signalCallback = [&](int){
     Utils::cleanSignalCallback();
     qDebug() << "closing";
@@ -19,17 +19,52 @@
 
 #pragma once
 
+#include "Checkpointer.h"
 #include "ProcessMemoryWatcher.h"
+#include "ExitWatcher.h"
 #include "Feeder.h"
+#include "ProcessDiscovery.h"
+#include "RecorderStats.h"
+#include "SnapshotQueue.h"
 #include "SystemMemoryWatcher.h"
+#include "TaskScheduler.h"
+#include "TickTimer.h"
 
 #include <ThreadPool.h>
 #include <Utils.h>
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <QSet>
+#include <QString>
 #include <QThread>
 
 #include <atomic>
+#include <memory>
+
+struct RecordOptions {
+  QSet<long> pids; //!< monitored processes, all processes when empty
+  long period{1000}; //!< period of snapshot [ms]
+  QString databaseFile{"measurement.db"};
+  QString procFs{"/proc"};
+  bool smapsRollup{false}; //!< read smaps_rollup on every snapshot, full smaps just with fullSmapsPeriod
+  long fullSmapsPeriod{60000}; //!< period of full smaps snapshot [ms] in smaps_rollup mode
+  long fdBudget{0}; //!< maximum of /proc file descriptors kept open, zero for limit given by RLIMIT_NOFILE
+  size_t queueBudget{64 * 1024 * 1024}; //!< memory budget of snapshots waiting for write [bytes]
+  QueuePolicy queuePolicy{QueuePolicy::DropSmapsKeepStatm};
+  long maxWriteLatency{5000}; //!< maximum delay of database commit when tick is not finished [ms]
+  bool wal{false}; //!< use write-ahead log, database is not corrupted by crash and may be read during recording
+  long checkpointInterval{10000}; //!< maximum time between checkpoints of write-ahead log [ms]
+  qint64 checkpointSize{16 * 1024 * 1024}; //!< size of write-ahead log that triggers checkpoint [bytes]
+  bool delta{false}; //!< write just changed memory mappings, with periodic keyframes
+  long keyframeInterval{60}; //!< every n-th full smaps snapshot of the process is keyframe in delta mode
+  DataFormat dataFormat{DataFormat::Rows}; //!< how memory mappings of full smaps snapshot are stored
+  QString binLogDirectory; //!< write binary log to this directory instead of database when it is not empty
+  qint64 segmentSize{16 * 1024 * 1024}; //!< size of binary log segment [bytes]
+  long rotateInterval{0}; //!< start new database file after this time [s], zero disables rotation by time
+  qint64 rotateSize{0}; //!< start new database file when it exceeds this size [bytes], zero disables rotation by size
+  long maxFiles{0}; //!< number of rotated database files kept, the oldest are deleted, zero keeps all
+};
 
 class Record : public QObject {
   Q_OBJECT
@@ -37,19 +72,20 @@ class Record : public QObject {
 
 public slots:
   void close();
-  void update();
+  void update(qulonglong missedTicks, qint64 latenessUs);
   void updateProcessList();
   void processInitialized(ProcessId processId, QString name);
   void processExited(ProcessId processId);
+  void tickFinished(TickReport report);
 
 signals:
   void updateRequest(QDateTime time);
+  void recorderStats(QDateTime time, QMap<QString, qlonglong> values);
+  void tickCompleted(QDateTime time);
+  void processRemoved(ProcessId processId);
 
 public:
-  Record(QSet<long> pids,
-         long period,
-         QString databaseFile,
-         QString procFs);
+  explicit Record(const RecordOptions &options);
 
   ~Record();
 
@@ -57,15 +93,26 @@ private:
   void startProcessMonitor(pid_t pid);
 
 private:
-  QTimer timer;
+  TickTimer timer;
+  QElapsedTimer lastTick;
+  int unfinishedTicks{0};
   ThreadPool threadPool;
-  std::vector<QThread*> watcherThreads;
-  uint64_t nextThread{0};
-  QMap<pid_t, ProcessMemoryWatcher *> watchers;
+  TaskScheduler scheduler;
+  QMap<pid_t, std::shared_ptr<ProcessMemoryWatcher>> watchers;
+  ProcessDiscovery discovery;
+  std::vector<pid_t> bornPids;
+  std::vector<pid_t> deadPids;
+  std::vector<ProcessId> exitedProcesses; //!< exited processes still listed (zombies), their pids may be reused
+  ExitWatcher exitWatcher;
+  RecorderStats stats;
   SystemMemoryWatcher systemMemoryWatcher;
-  Feeder feeder;
+  SnapshotQueue queue;
+  QThread *writerThread{nullptr};
+  Feeder *feeder{nullptr}; //!< lives in writerThread
+  QThread *checkpointThread{nullptr};
+  Checkpointer *checkpointer{nullptr}; //!< lives in checkpointThread, just in wal mode
   bool monitorSystem{false};
-  QString procFs;
+  RecordOptions options;
 
   //QTimer shutdownTimer;
 };
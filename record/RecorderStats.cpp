@@ -0,0 +1,42 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "RecorderStats.h"
+
+#include <QMutexLocker>
+
+void RecorderStats::set(const QString &name, qlonglong value)
+{
+  QMutexLocker locker(&mutex);
+  values[name] = value;
+}
+
+void RecorderStats::add(const QString &name, qlonglong value)
+{
+  QMutexLocker locker(&mutex);
+  values[name] += value;
+}
+
+QMap<QString, qlonglong> RecorderStats::take()
+{
+  QMutexLocker locker(&mutex);
+  QMap<QString, qlonglong> result;
+  std::swap(result, values);
+  return result;
+}
@@ -0,0 +1,304 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "SnapshotQueue.h"
+
+#include <algorithm>
+#include <chrono>
+
+size_t ProcessSnapshot::memorySize() const
+{
+  // QList allocates node for every (large) item, strings are mostly shared
+  size_t size = sizeof(ProcessSnapshot) + processName.size() * sizeof(QChar);
+  size += size_t(ranges.size()) * (sizeof(SmapsRange) + sizeof(void*));
+  return size;
+}
+
+SnapshotQueue::SnapshotQueue(size_t budget, QueuePolicy policy):
+  budget(budget), policy(policy)
+{}
+
+bool SnapshotQueue::parsePolicy(const QString &str, QueuePolicy &policy)
+{
+  if (str == "drop-oldest") {
+    policy = QueuePolicy::DropOldest;
+  } else if (str == "drop-smaps-keep-statm") {
+    policy = QueuePolicy::DropSmapsKeepStatm;
+  } else if (str == "block") {
+    policy = QueuePolicy::Block;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool SnapshotQueue::degrade(ProcessSnapshot &snapshot)
+{
+  if (snapshot.sampleType != FullSmaps || snapshot.ranges.isEmpty()) {
+    return false;
+  }
+  // Rss and Pss sums are computed by watcher already
+  snapshot.ranges.clear();
+  snapshot.sampleType = DroppedSmaps;
+  return true;
+}
+
+void SnapshotQueue::makeRoom(size_t required)
+{
+  if (policy == QueuePolicy::DropSmapsKeepStatm) {
+    for (auto it = queue.begin(); it != queue.end() && usage + required > budget; ++it) {
+      size_t size = it->memorySize();
+      if (degrade(*it)) {
+        usage = usage - size + it->memorySize();
+        degraded++;
+      }
+    }
+  }
+  // even with DropSmapsKeepStatm, when degraded snapshots are not enough
+  for (auto it = queue.begin(); it != queue.end() && usage + required > budget;) {
+    if (!it->processName.isEmpty()) {
+      ++it;
+      continue;
+    }
+    usage -= it->memorySize();
+    dropped++;
+    it = queue.erase(it);
+  }
+}
+
+void SnapshotQueue::push(ProcessSnapshot &&snapshot)
+{
+  bool notify = false;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t size = snapshot.memorySize();
+
+    if (policy == QueuePolicy::Block) {
+      if (usage + size > budget && !queue.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        notFull.wait(lock, [&]() { return closed || queue.empty() || usage + size <= budget; });
+        blockedNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+      }
+      if (closed) {
+        dropped++;
+        return;
+      }
+    } else if (usage + size > budget) {
+      makeRoom(size);
+      if (usage + size > budget && policy == QueuePolicy::DropSmapsKeepStatm && degrade(snapshot)) {
+        size = snapshot.memorySize();
+        degraded++;
+      }
+      if (usage + size > budget && snapshot.processName.isEmpty()) {
+        dropped++;
+        return;
+      }
+    }
+
+    usage += size;
+    peakUsage = std::max(peakUsage, usage);
+    queue.push_back(std::move(snapshot));
+    notify = !notified;
+    notified = true;
+  }
+  if (notify) {
+    emit available();
+  }
+}
+
+void SnapshotQueue::take(std::vector<ProcessSnapshot> &snapshots)
+{
+  snapshots.clear();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshots.reserve(queue.size());
+    for (ProcessSnapshot &snapshot: queue) {
+      snapshots.push_back(std::move(snapshot));
+    }
+    queue.clear();
+    usage = 0;
+    notified = false;
+  }
+  notFull.notify_all();
+}
+
+void SnapshotQueue::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+  }
+  notFull.notify_all();
+}
+
+QMap<QString, qlonglong> SnapshotQueue::takeCounters()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  QMap<QString, qlonglong> counters;
+  counters["queue_dropped"] = dropped;
+  counters["queue_degraded"] = degraded;
+  counters["queue_blocked_us"] = blockedNs / 1000;
+  counters["queue_peak_bytes"] = qlonglong(peakUsage);
+  dropped = 0;
+  degraded = 0;
+  blockedNs = 0;
+  peakUsage = usage;
+  return counters;
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+/** Snapshot of single process taken at the second, the first one brings process name */
+ProcessSnapshot snapshot(int second, bool first = false)
+{
+  ProcessSnapshot result;
+  result.time = QDateTime::fromMSecsSinceEpoch(1600000000000 + second * 1000);
+  result.processId = ProcessId(42, ProcessId::StartTime(1234));
+  if (first) {
+    result.processName = "a";
+  }
+  // mappings occupy most of the snapshot
+  for (int i = 0; i < 100; i++) {
+    result.ranges << SmapsRange();
+  }
+  result.rssSum = 100 + second;
+  result.pssSum = 50 + second;
+  result.statm.resident = size_t(200 + second);
+  return result;
+}
+
+std::vector<int> seconds(const std::vector<ProcessSnapshot> &snapshots)
+{
+  std::vector<int> result;
+  for (const ProcessSnapshot &snapshot: snapshots) {
+    result.push_back(int((snapshot.time.toMSecsSinceEpoch() - 1600000000000) / 1000));
+  }
+  return result;
+}
+
+} // namespace
+
+TEST_CASE("queue over budget drops the oldest snapshots") {
+  // the first snapshot and two others fit to the budget
+  SnapshotQueue queue(snapshot(0, true).memorySize() + 2 * snapshot(1).memorySize(), QueuePolicy::DropOldest);
+  queue.push(snapshot(0, true));
+  for (int second = 1; second <= 4; second++) {
+    queue.push(snapshot(second));
+  }
+
+  // the first snapshot of the process is kept, because it brings the name
+  std::vector<ProcessSnapshot> snapshots;
+  queue.take(snapshots);
+  REQUIRE(seconds(snapshots) == std::vector<int>{0, 3, 4});
+  for (const ProcessSnapshot &snapshot: snapshots) {
+    REQUIRE(snapshot.sampleType == FullSmaps);
+    REQUIRE(snapshot.ranges.size() == 100);
+  }
+  QMap<QString, qlonglong> counters = queue.takeCounters();
+  REQUIRE(counters["queue_dropped"] == 2);
+  REQUIRE(counters["queue_degraded"] == 0);
+  REQUIRE(counters["queue_peak_bytes"] <= qlonglong(snapshot(0, true).memorySize() + 2 * snapshot(1).memorySize()));
+
+  // counters are reset by take
+  REQUIRE(queue.takeCounters()["queue_dropped"] == 0);
+}
+
+TEST_CASE("queue over budget drops mappings and keeps statm") {
+  SnapshotQueue queue(snapshot(0, true).memorySize() + 2 * snapshot(1).memorySize(), QueuePolicy::DropSmapsKeepStatm);
+  queue.push(snapshot(0, true));
+  for (int second = 1; second <= 4; second++) {
+    queue.push(snapshot(second));
+  }
+
+  // the oldest snapshots are degraded until the new one fits, no one is dropped;
+  // degraded snapshot still occupies its own size, so the fourth push degrades two of them
+  std::vector<ProcessSnapshot> snapshots;
+  queue.take(snapshots);
+  REQUIRE(seconds(snapshots) == std::vector<int>{0, 1, 2, 3, 4});
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    const ProcessSnapshot &snapshot = snapshots[i];
+    INFO("snapshot " << i);
+    REQUIRE(snapshot.sampleType == (i < 3 ? DroppedSmaps : FullSmaps));
+    REQUIRE(snapshot.ranges.size() == (i < 3 ? 0 : 100));
+    REQUIRE(snapshot.rssSum == qlonglong(100 + i));
+    REQUIRE(snapshot.pssSum == qlonglong(50 + i));
+    REQUIRE(snapshot.statm.resident == 200 + i);
+  }
+  REQUIRE(snapshots[0].processName == "a");
+  QMap<QString, qlonglong> counters = queue.takeCounters();
+  REQUIRE(counters["queue_dropped"] == 0);
+  REQUIRE(counters["queue_degraded"] == 3);
+
+  // snapshot larger than the whole budget is degraded itself
+  SnapshotQueue small(snapshot(1).memorySize() / 2, QueuePolicy::DropSmapsKeepStatm);
+  small.push(snapshot(1));
+  small.take(snapshots);
+  REQUIRE(seconds(snapshots) == std::vector<int>{1});
+  REQUIRE(snapshots[0].sampleType == DroppedSmaps);
+  REQUIRE(small.takeCounters()["queue_degraded"] == 1);
+}
+
+TEST_CASE("queue over budget blocks producer until snapshots are taken") {
+  SnapshotQueue queue(2 * snapshot(1).memorySize(), QueuePolicy::Block);
+  queue.push(snapshot(1));
+  queue.push(snapshot(2));
+
+  std::atomic<bool> pushed{false};
+  std::thread producer([&]() {
+    queue.push(snapshot(3));
+    pushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE(!pushed);
+
+  std::vector<ProcessSnapshot> snapshots;
+  queue.take(snapshots);
+  producer.join();
+  REQUIRE(pushed);
+  REQUIRE(seconds(snapshots) == std::vector<int>{1, 2});
+  queue.take(snapshots);
+  REQUIRE(seconds(snapshots) == std::vector<int>{3});
+  REQUIRE(snapshots[0].ranges.size() == 100);
+
+  QMap<QString, qlonglong> counters = queue.takeCounters();
+  REQUIRE(counters["queue_dropped"] == 0);
+  REQUIRE(counters["queue_degraded"] == 0);
+  REQUIRE(counters["queue_blocked_us"] >= 50000);
+
+  // closed queue releases blocked producer, its snapshot is dropped
+  queue.push(snapshot(4));
+  queue.push(snapshot(5));
+  std::thread blocked([&]() { queue.push(snapshot(6)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  queue.close();
+  blocked.join();
+  queue.take(snapshots);
+  REQUIRE(seconds(snapshots) == std::vector<int>{4, 5});
+  REQUIRE(queue.takeCounters()["queue_dropped"] == 1);
+}
+
+#endif // UNIT_TESTS
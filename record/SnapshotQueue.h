@@ -0,0 +1,111 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <OomScore.h>
+#include <ProcessId.h>
+#include <SmapsRange.h>
+#include <StatM.h>
+#include <Utils.h>
+
+#include <QDateTime>
+#include <QMap>
+#include <QObject>
+#include <QString>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct ProcessSnapshot {
+  QDateTime time;
+  ProcessId processId;
+  QString processName; //!< not empty in the first snapshot of the process
+  SampleType sampleType{FullSmaps};
+  QList<SmapsRange> ranges;
+  qlonglong rssSum{0};
+  qlonglong pssSum{0};
+  StatM statm;
+  OomScore oomScore;
+
+  /** Estimation of memory occupied by the snapshot */
+  size_t memorySize() const;
+};
+
+enum class QueuePolicy {
+  DropOldest,         //!< drop oldest snapshots
+  DropSmapsKeepStatm, //!< drop memory mappings of oldest snapshots, keep statm and Rss/Pss sums
+  Block               //!< block watchers until the snapshots are written
+};
+
+/**
+ * Bounded queue of snapshots between watchers and Feeder.
+ *
+ * Memory occupied by queued snapshots is limited by the budget, policy decides
+ * what happens when it is exceeded. First snapshot of the process is never dropped,
+ * because it brings the process name.
+ */
+class SnapshotQueue : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY_MOVE(SnapshotQueue)
+
+signals:
+  /** Emitted when snapshot is pushed to empty queue */
+  void available();
+
+public:
+  SnapshotQueue(size_t budget, QueuePolicy policy);
+  ~SnapshotQueue() = default;
+
+  /** Thread safe, may block with Block policy */
+  void push(ProcessSnapshot &&snapshot);
+
+  /** Take all queued snapshots */
+  void take(std::vector<ProcessSnapshot> &snapshots);
+
+  /** Wake up and discard blocked producers */
+  void close();
+
+  /** Counters collected since previous call (dropped, degraded snapshots, blocked time...) */
+  QMap<QString, qlonglong> takeCounters();
+
+  static bool parsePolicy(const QString &str, QueuePolicy &policy);
+
+private:
+  void makeRoom(size_t required);
+  static bool degrade(ProcessSnapshot &snapshot);
+
+private:
+  size_t budget;
+  QueuePolicy policy;
+
+  std::mutex mutex;
+  std::condition_variable notFull;
+  std::deque<ProcessSnapshot> queue;
+  size_t usage{0};
+  size_t peakUsage{0};
+  bool notified{false};
+  bool closed{false};
+
+  qlonglong dropped{0};
+  qlonglong degraded{0};
+  qint64 blockedNs{0};
+};
@@ -0,0 +1,311 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TaskScheduler.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <chrono>
+
+struct TaskScheduler::Tick {
+  Tick(const QDateTime &time, size_t tasks, size_t workers):
+    time(time), tasks(tasks), remaining(long(tasks)), busyNs(workers, 0)
+  {
+    timer.start();
+  }
+
+  QDateTime time;
+  QElapsedTimer timer;
+  size_t tasks;
+  std::atomic<long> remaining;
+  std::atomic<long> steals{0};
+  // every worker writes just its own slot, slots are read by the worker finishing the tick
+  std::vector<qint64> busyNs;
+};
+
+TaskScheduler::TaskScheduler(int workerCount)
+{
+  qRegisterMetaType<TickReport>("TickReport");
+
+  workerCount = std::max(workerCount, 1);
+  workers.reserve(workerCount);
+  for (int i = 0; i < workerCount; i++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i]->thread = std::thread([this, i]() { run(i); });
+  }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+  close();
+}
+
+void TaskScheduler::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(waitMutex);
+    if (stopped) {
+      return;
+    }
+    stopped = true;
+  }
+  wakeUp.notify_all();
+  for (auto &worker: workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+    worker->jobs.clear();
+  }
+}
+
+void TaskScheduler::submit(const QDateTime &time, std::vector<Task> &&tasks)
+{
+  if (tasks.empty()) {
+    emit tickFinished(TickReport{time, 0, 0, 0, 0, 0});
+    return;
+  }
+  auto tick = std::make_shared<Tick>(time, tasks.size(), workers.size());
+
+  // distribute tasks round-robin, continue where previous tick ended
+  for (Task &task: tasks) {
+    Worker &worker = *workers[nextWorker++ % workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(Job{tick, std::move(task)});
+  }
+  {
+    std::lock_guard<std::mutex> lock(waitMutex);
+    pending += long(tasks.size());
+  }
+  wakeUp.notify_all();
+}
+
+bool TaskScheduler::pop(size_t index, Job &job)
+{
+  Worker &worker = *workers[index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.jobs.empty()) {
+    return false;
+  }
+  job = std::move(worker.jobs.back());
+  worker.jobs.pop_back();
+  --pending;
+  return true;
+}
+
+bool TaskScheduler::steal(size_t thief, Job &job)
+{
+  for (size_t i = 1; i < workers.size(); i++) {
+    Worker &victim = *workers[(thief + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.jobs.empty()) {
+      continue;
+    }
+    job = std::move(victim.jobs.front());
+    victim.jobs.pop_front();
+    --pending;
+    return true;
+  }
+  return false;
+}
+
+void TaskScheduler::execute(size_t index, Job &job, bool stolen)
+{
+  auto start = std::chrono::steady_clock::now();
+  job.task();
+  auto duration = std::chrono::steady_clock::now() - start;
+
+  Tick &tick = *job.tick;
+  tick.busyNs[index] += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  if (stolen) {
+    ++tick.steals;
+  }
+  if (tick.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    TickReport report;
+    report.time = tick.time;
+    report.durationUs = tick.timer.nsecsElapsed() / 1000;
+    report.tasks = qlonglong(tick.tasks);
+    report.steals = tick.steals;
+    auto [min, max] = std::minmax_element(tick.busyNs.begin(), tick.busyNs.end());
+    report.workerBusyMinUs = *min / 1000;
+    report.workerBusyMaxUs = *max / 1000;
+    emit tickFinished(report);
+  }
+  job = Job();
+}
+
+void TaskScheduler::run(size_t index)
+{
+  for (;;) {
+    Job job;
+    if (pop(index, job)) {
+      execute(index, job, false);
+      continue;
+    }
+    if (steal(index, job)) {
+      execute(index, job, true);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(waitMutex);
+    wakeUp.wait(lock, [this]() { return stopped || pending > 0; });
+    if (stopped) {
+      return;
+    }
+  }
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+/** Reports of finished ticks, they are emitted from worker threads */
+class TickReports {
+public:
+  explicit TickReports(TaskScheduler &scheduler)
+  {
+    QObject::connect(&scheduler, &TaskScheduler::tickFinished, &scheduler, [this](TickReport report) {
+      std::lock_guard<std::mutex> lock(mutex);
+      reports.push_back(report);
+      finished.notify_all();
+    }, Qt::DirectConnection);
+  }
+
+  /** Wait until count of ticks is finished, false on timeout */
+  bool wait(size_t count)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return finished.wait_for(lock, std::chrono::seconds(10), [&]() { return reports.size() >= count; });
+  }
+
+  std::vector<TickReport> take()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TickReport> result;
+    result.swap(reports);
+    return result;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::vector<TickReport> reports;
+};
+
+} // namespace
+
+TEST_CASE("scheduler runs every task of the tick once") {
+  TaskScheduler scheduler(4);
+  TickReports reports(scheduler);
+
+  constexpr int Tasks = 100;
+  std::vector<std::atomic<int>> runs(Tasks);
+  QDateTime start = QDateTime::fromMSecsSinceEpoch(1600000000000);
+  for (int tick = 0; tick < 3; tick++) {
+    std::vector<TaskScheduler::Task> tasks;
+    for (int i = 0; i < Tasks; i++) {
+      tasks.push_back([&runs, i]() { runs[size_t(i)]++; });
+    }
+    scheduler.submit(start.addSecs(tick), std::move(tasks));
+  }
+  REQUIRE(reports.wait(3));
+  for (const std::atomic<int> &count: runs) {
+    REQUIRE(count == 3);
+  }
+  std::vector<TickReport> finished = reports.take();
+  REQUIRE(finished.size() == 3);
+  for (const TickReport &report: finished) {
+    REQUIRE(report.tasks == Tasks);
+    REQUIRE(report.steals <= Tasks);
+    REQUIRE(report.workerBusyMinUs <= report.workerBusyMaxUs);
+  }
+
+  // tick without tasks is finished immediately
+  scheduler.submit(start.addSecs(3), {});
+  finished = reports.take();
+  REQUIRE(finished.size() == 1);
+  REQUIRE(finished[0].time == start.addSecs(3));
+  REQUIRE(finished[0].tasks == 0);
+}
+
+TEST_CASE("scheduler skips busy task and finishes next tick without it") {
+  TaskScheduler scheduler(2);
+  TickReports reports(scheduler);
+
+  // the same as watchers of Record: task is submitted just when previous one is finished
+  constexpr int Tasks = 4;
+  std::vector<std::atomic<bool>> scheduled(Tasks);
+  std::vector<std::atomic<int>> runs(Tasks);
+  std::mutex blockMutex;
+  std::condition_variable unblocked;
+  bool blocked = true;
+  auto tick = [&](const QDateTime &time) {
+    std::vector<TaskScheduler::Task> tasks;
+    for (int i = 0; i < Tasks; i++) {
+      if (scheduled[size_t(i)].exchange(true)) {
+        continue;
+      }
+      tasks.push_back([&, i]() {
+        if (i == 0) {
+          std::unique_lock<std::mutex> lock(blockMutex);
+          unblocked.wait(lock, [&]() { return !blocked; });
+        }
+        runs[size_t(i)]++;
+        scheduled[size_t(i)] = false;
+      });
+    }
+    scheduler.submit(time, std::move(tasks));
+  };
+
+  QDateTime start = QDateTime::fromMSecsSinceEpoch(1600000000000);
+  tick(start);
+  // the first task blocks one worker, the other one runs (or steals) the rest
+  for (int i = 1; i < Tasks; i++) {
+    while (scheduled[size_t(i)]) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  tick(start.addSecs(1));
+  REQUIRE(reports.wait(1));
+  std::vector<TickReport> finished = reports.take();
+  REQUIRE(finished.size() == 1);
+  REQUIRE(finished[0].time == start.addSecs(1));
+  REQUIRE(finished[0].tasks == Tasks - 1);
+
+  {
+    std::lock_guard<std::mutex> lock(blockMutex);
+    blocked = false;
+  }
+  unblocked.notify_all();
+  REQUIRE(reports.wait(1));
+  finished = reports.take();
+  REQUIRE(finished.size() == 1);
+  REQUIRE(finished[0].time == start);
+  REQUIRE(finished[0].tasks == Tasks);
+  REQUIRE(runs[0] == 1);
+  for (int i = 1; i < Tasks; i++) {
+    REQUIRE(runs[size_t(i)] == 2);
+  }
+}
+
+#endif // UNIT_TESTS
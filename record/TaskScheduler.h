@@ -0,0 +1,102 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <Utils.h>
+
+#include <QDateTime>
+#include <QObject>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TickReport {
+  QDateTime time;
+  qint64 durationUs{0}; //!< from submit to finish of the last task
+  qlonglong tasks{0};
+  qlonglong steals{0};
+  qint64 workerBusyMaxUs{0};
+  qint64 workerBusyMinUs{0};
+};
+
+Q_DECLARE_METATYPE(TickReport)
+
+/**
+ * Work-stealing scheduler of per-tick tasks.
+ *
+ * Tasks of the tick are distributed to worker queues, every worker takes tasks
+ * from the back of its own queue. Idle worker steals tasks from the front of others.
+ * When the last task of the tick is done, tickFinished is emitted (from worker thread).
+ */
+class TaskScheduler : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY_MOVE(TaskScheduler)
+
+signals:
+  void tickFinished(TickReport report);
+
+public:
+  using Task = std::function<void()>;
+
+  explicit TaskScheduler(int workerCount);
+  ~TaskScheduler();
+
+  void submit(const QDateTime &time, std::vector<Task> &&tasks);
+
+  /** Stop workers, running tasks are finished, queued tasks are dropped. */
+  void close();
+
+  size_t workerCount() const {
+    return workers.size();
+  }
+
+private:
+  struct Tick;
+
+  struct Job {
+    std::shared_ptr<Tick> tick;
+    Task task;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    std::thread thread;
+  };
+
+  void run(size_t index);
+  bool pop(size_t index, Job &job);
+  bool steal(size_t thief, Job &job);
+  void execute(size_t index, Job &job, bool stolen);
+
+private:
+  std::vector<std::unique_ptr<Worker>> workers;
+  size_t nextWorker{0};
+  std::mutex waitMutex;
+  std::condition_variable wakeUp;
+  std::atomic<long> pending{0};
+  bool stopped{false};
+};
@@ -0,0 +1,156 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TickTimer.h"
+
+#include <QDebug>
+
+#include <cerrno>
+#include <cstdint>
+
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+TickTimer::~TickTimer()
+{
+  stop();
+}
+
+void TickTimer::start(long periodMs)
+{
+  stop();
+  periodNs = qint64(periodMs) * 1000000;
+  expirationCount = 0;
+  started.start();
+
+  timerFd = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (timerFd >= 0) {
+    timespec now{};
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+    itimerspec spec{};
+    spec.it_interval.tv_sec = periodMs / 1000;
+    spec.it_interval.tv_nsec = (periodMs % 1000) * 1000000;
+    spec.it_value.tv_sec = now.tv_sec + spec.it_interval.tv_sec;
+    spec.it_value.tv_nsec = now.tv_nsec + spec.it_interval.tv_nsec;
+    if (spec.it_value.tv_nsec >= 1000000000) {
+      spec.it_value.tv_sec++;
+      spec.it_value.tv_nsec -= 1000000000;
+    }
+
+    if (::timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+      notifier = std::make_unique<QSocketNotifier>(timerFd, QSocketNotifier::Read);
+      connect(notifier.get(), &QSocketNotifier::activated, this, &TickTimer::onActivated);
+      return;
+    }
+    ::close(timerFd);
+    timerFd = -1;
+  }
+
+  qWarning() << "timerfd is not available, using QTimer";
+  fallback.setTimerType(Qt::PreciseTimer);
+  fallback.setSingleShot(false);
+  fallback.setInterval(int(periodMs));
+  connect(&fallback, &QTimer::timeout, this, &TickTimer::onFallbackTimeout, Qt::UniqueConnection);
+  fallback.start();
+}
+
+void TickTimer::stop()
+{
+  fallback.stop();
+  notifier.reset();
+  if (timerFd >= 0) {
+    ::close(timerFd);
+    timerFd = -1;
+  }
+}
+
+void TickTimer::onActivated()
+{
+  uint64_t expirations = 0;
+  ssize_t count;
+  do {
+    count = ::read(timerFd, &expirations, sizeof(expirations));
+  } while (count < 0 && errno == EINTR);
+
+  if (count != sizeof(expirations) || expirations == 0) {
+    return;
+  }
+  expired(expirations);
+}
+
+void TickTimer::onFallbackTimeout()
+{
+  expired(1);
+}
+
+void TickTimer::expired(qulonglong expirations)
+{
+  // deadline of n-th expiration is start + n * period
+  expirationCount += expirations;
+  qint64 lateness = started.nsecsElapsed() - qint64(expirationCount) * periodNs;
+  emit timeout(expirations - 1, lateness / 1000);
+}
+
+#ifdef UNIT_TESTS
+
+#include "TestFixture.h"
+
+#include <catch2/catch.hpp>
+
+#include <thread>
+
+TEST_CASE("tick timer coalesces missed expirations") {
+  TestFixture::Application app;
+
+  struct Tick {
+    qulonglong missed;
+    qint64 latenessUs;
+  };
+  QList<Tick> ticks;
+  TickTimer timer;
+  QObject::connect(&timer, &TickTimer::timeout, [&](qulonglong missed, qint64 latenessUs) {
+    ticks << Tick{missed, latenessUs};
+  });
+  auto processEvents = [&](int count) {
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (ticks.size() < count && elapsed.elapsed() < 5000) {
+      QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+  };
+
+  // event loop is blocked over three deadlines
+  timer.start(20);
+  std::this_thread::sleep_for(std::chrono::milliseconds(75));
+  processEvents(1);
+  REQUIRE(ticks.size() == 1);
+  REQUIRE(ticks[0].missed >= 2);
+  REQUIRE(ticks[0].latenessUs >= 0);
+
+  // deadlines stay aligned to the start, next tick is not late by the blocked time
+  processEvents(2);
+  timer.stop();
+  REQUIRE(ticks.size() == 2);
+  REQUIRE(ticks[1].latenessUs >= 0);
+  REQUIRE(ticks[1].latenessUs < 20000 * qint64(ticks[1].missed + 1));
+}
+
+#endif // UNIT_TESTS
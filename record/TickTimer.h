@@ -0,0 +1,69 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <Utils.h>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <memory>
+
+/**
+ * Periodic timer with absolute deadlines on monotonic clock (timerfd),
+ * so the schedule does not drift when event loop is busy.
+ * Expirations missed meanwhile are coalesced to single timeout.
+ * When timerfd is not available, precise QTimer is used.
+ */
+class TickTimer : public QObject {
+  Q_OBJECT
+  Q_DISABLE_COPY_MOVE(TickTimer)
+
+signals:
+  /**
+   * @param missed number of expirations coalesced to this one
+   * @param latenessUs delay from the deadline of this expiration
+   */
+  void timeout(qulonglong missed, qint64 latenessUs);
+
+public:
+  TickTimer() = default;
+  ~TickTimer();
+
+  void start(long periodMs);
+  void stop();
+
+private slots:
+  void onActivated();
+  void onFallbackTimeout();
+
+private:
+  void expired(qulonglong expirations);
+
+private:
+  qint64 periodNs{0};
+  QElapsedTimer started;
+  qulonglong expirationCount{0};
+  int timerFd{-1};
+  std::unique_ptr<QSocketNotifier> notifier;
+  QTimer fallback;
+};
@@ -26,7 +26,6 @@
 
 #include <QtCore/QCoreApplication>
 #include <QDebug>
-#include <QFileInfo>
 
 #include <iostream>
 #include <optional>
@@ -89,7 +88,8 @@ public:
                 args.databaseFile = QString::fromStdString(value);
               }),
               "database-file",
-              "Sqlite database file with recording. Default is measurement.db");
+              "Sqlite database file with recording, directory or quoted wildcard pattern "s +
+              "(measurement-*.db) of files rotated by memory-record. Default is measurement.db"s);
 
     AddOption(CmdLineStringOption([this](const std::string &value){
                 args.processMemoryType = QString::fromStdString(value);
@@ -127,17 +127,13 @@ Replay::~Replay()
 
 void Replay::run()
 {
-  if (!QFileInfo(db).exists()){
-    qWarning() << "File don't exists" << db;
-    deleteLater();
-    return;
-  }
-
+  // database file, directory or wildcard pattern of files rotated by memory-record
   if (!storage.init(db)){
     qWarning() << "Failed to open database" << db;
     deleteLater();
     return;
   }
+  storage.ensureIndexes();
 
   if (pid.has_value() || processId.has_value()) {
     if (!processId.has_value()) {
@@ -168,6 +164,14 @@ void Replay::run()
       deleteLater();
       return;
     }
+    if (!times.isEmpty()) {
+      series = std::make_unique<StorageSetSeries>(storage, processId.value(), times.first(), times.last());
+      if (!series->isValid()) {
+        qWarning() << "Failed to read measurements" << db;
+        deleteLater();
+        return;
+      }
+    }
   } else {
     if (!storage.getMeasurementTimes(times)) {
       qWarning() << "Failed to get measurement time points" << db;
@@ -192,7 +196,7 @@ void Replay::step()
   }
 
   if (processId.has_value()) {
-    if (!storage.getMeasurementAt(processId.value(), times[cursor], measurement, true)) {
+    if (!series->next(measurement)) {
       qWarning() << "Failed to read measurement";
       deleteLater();
       return;
@@ -18,12 +18,13 @@
 */
 #pragma once
 
-#include <Storage.h>
+#include <StorageSet.h>
 
 #include <QObject>
 #include <QString>
 #include <QTimer>
 
+#include <memory>
 #include <optional>
 
 class Replay : public QObject {
@@ -51,7 +52,8 @@ private:
   std::optional<qulonglong> processId;
   unsigned long interval{20};
   ProcessMemoryType type{Rss};
-  Storage storage;
+  StorageSet storage;
+  std::unique_ptr<StorageSetSeries> series; //!< measurements of the process, destroyed before storage
   QList<QDateTime> times;
   unsigned int cursor{0};
   Measurement measurement;
@@ -0,0 +1,98 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <ProcessId.h>
+#include <SmapsRange.h>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QList>
+
+/**
+ * Recording shared by unit tests: single process with few distinct memory ranges.
+ */
+namespace TestFixture {
+
+/** Application instance, it is required for loading of sql driver */
+class Application {
+  Q_DISABLE_COPY_MOVE(Application)
+
+public:
+  Application() = default;
+
+private:
+  int argc{1};
+  char name[10]{"unittests"};
+  char *argv[2]{name, nullptr};
+  QCoreApplication app{argc, argv};
+};
+
+inline ProcessId processId()
+{
+  return ProcessId(42, ProcessId::StartTime(1234));
+}
+
+/** Time of the first measurement */
+inline QDateTime start()
+{
+  return QDateTime::fromMSecsSinceEpoch(1600000000000);
+}
+
+/**
+ * Ranges of the test process, i-th range is mapped at 0x1000 * (i + 1)
+ * from /usr/lib/libtest<i>.so, private and shared mappings alternate.
+ */
+inline QList<SmapsRange> ranges(int count)
+{
+  QList<SmapsRange> result;
+  for (int i = 0; i < count; i++) {
+    SmapsRange range;
+    range.key.processId = processId();
+    range.key.from = 0x1000 * (i + 1);
+    range.key.to = range.key.from + 0x800;
+    range.key.permission = i % 2 == 0 ? "r-xp" : "rw-s";
+    range.key.name = QString("/usr/lib/libtest%1.so").arg(i);
+    range.rss = 4 * (i + 1);
+    range.pss = i + 1;
+    result << range;
+  }
+  return result;
+}
+
+/**
+ * Begin transaction and insert the process with its ranges, transaction is kept open for measurements.
+ * Writer is Storage or BinLogWriter.
+ */
+template <typename Writer>
+bool insertProcess(Writer &writer, const QList<SmapsRange> &ranges)
+{
+  if (!writer.transaction() || !writer.insertOrIgnoreProcess(processId(), "test")) {
+    return false;
+  }
+  for (const SmapsRange &range: ranges) {
+    if (!writer.insertOrIgnoreRange(range.key)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace TestFixture
@@ -0,0 +1,117 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "BinLog.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+namespace {
+
+struct CrcTable {
+  quint32 values[256];
+
+  constexpr CrcTable(): values()
+  {
+    for (quint32 i = 0; i < 256; i++) {
+      quint32 crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+      }
+      values[i] = crc;
+    }
+  }
+};
+
+constexpr CrcTable crcTable;
+
+// size of fixed part of record, zero for unknown type
+size_t fixedSize(quint32 type)
+{
+  switch (type) {
+    case BinLog::Process: return sizeof(BinLog::ProcessRecord);
+    case BinLog::Range: return sizeof(BinLog::RangeRecord);
+    case BinLog::Measurement: return sizeof(BinLog::MeasurementRecord);
+    case BinLog::Data: return sizeof(BinLog::DataRecord);
+    case BinLog::MemInfo: return sizeof(BinLog::MemInfoRecord);
+    case BinLog::RecorderStat: return sizeof(BinLog::RecorderStatRecord);
+    case BinLog::Commit: return sizeof(BinLog::CommitRecord);
+    default: return 0;
+  }
+}
+
+} // namespace
+
+bool BinLog::isValid(const RecordHeader *header)
+{
+  size_t fixed = fixedSize(header->type);
+  if (fixed == 0 || header->size % Alignment != 0 || header->size < recordSize(fixed)) {
+    return false;
+  }
+  size_t variable = 0;
+  switch (header->type) {
+    case Process: variable = record<ProcessRecord>(header)->nameSize; break;
+    case Range: variable = record<RangeRecord>(header)->nameSize; break;
+    case Data: variable = size_t(record<DataRecord>(header)->count) * sizeof(DataRow); break;
+    case RecorderStat: variable = record<RecorderStatRecord>(header)->nameSize; break;
+    default: break;
+  }
+  return header->size == recordSize(fixed + variable);
+}
+
+quint32 BinLog::crc32(quint32 crc, const char *data, size_t size)
+{
+  crc = ~crc;
+  for (const char *end = data + size; data != end; ++data) {
+    crc = crcTable.values[(crc ^ uchar(*data)) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+QString BinLog::segmentFile(const QString &directory, int index)
+{
+  return QDir(directory).filePath(QString("segment-%1.binlog").arg(index, 6, 10, QChar('0')));
+}
+
+int BinLog::segmentIndex(const QString &file)
+{
+  static const QRegularExpression pattern("^segment-(\\d+)\\.binlog$");
+  QRegularExpressionMatch match = pattern.match(QFileInfo(file).fileName());
+  return match.hasMatch() ? match.captured(1).toInt() : 0;
+}
+
+QStringList BinLog::segmentFiles(const QString &directory)
+{
+  QDir dir(directory);
+  QStringList files;
+  for (const QString &name: dir.entryList({"segment-*.binlog"}, QDir::Files)) {
+    if (segmentIndex(name) > 0) {
+      files << dir.filePath(name);
+    }
+  }
+  // number of digits may exceed the padding
+  std::sort(files.begin(), files.end(), [](const QString &a, const QString &b) {
+    return segmentIndex(a) < segmentIndex(b);
+  });
+  return files;
+}
@@ -0,0 +1,203 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+/**
+ * Append-only binary log, alternative output of memory-record for targets where
+ * SQLite inserts are too expensive. It may be converted to database by memory-migrate.
+ *
+ * Log is directory of segment files (segment-000001.binlog, ...). Segment starts with
+ * SegmentHeader, followed by records. Record is RecordHeader with fixed-layout struct,
+ * optionally followed by variable part (name, data rows), padded to 8 bytes. So records
+ * of mapped segment may be accessed in place. Integers are little-endian.
+ *
+ * Records of one transaction are followed by Commit record with CRC-32 of all previous
+ * bytes of the segment. The last commit is trailing checksum of the segment, records
+ * after it (transaction interrupted by crash) are ignored by the reader.
+ */
+class BinLog {
+public:
+  static constexpr char Magic[8] = {'M', 'W', 'B', 'I', 'N', 'L', 'O', 'G'};
+  static constexpr quint32 Version = 1;
+  static constexpr quint32 Alignment = 8;
+
+  enum RecordType : quint32 {
+    Process = 1,
+    Range = 2,
+    Measurement = 3,
+    Data = 4,
+    MemInfo = 5,
+    RecorderStat = 6,
+    Commit = 7
+  };
+
+  struct SegmentHeader {
+    char magic[8];
+    quint32 version;
+    quint32 reserved;
+  };
+
+  struct RecordHeader {
+    quint32 type; //!< RecordType
+    quint32 size; //!< including header and padding
+  };
+
+  /** Followed by utf-8 name */
+  struct ProcessRecord {
+    qint64 pid;
+    quint64 startTime;
+    quint32 nameSize;
+    quint32 reserved;
+  };
+
+  /** Followed by utf-8 name */
+  struct RangeRecord {
+    qint64 pid;
+    quint64 startTime;
+    quint64 from;
+    quint64 to;
+    qint32 permission; //!< SmapsRange::PermissionFlag
+    quint32 nameSize;
+  };
+
+  struct MeasurementRecord {
+    qint64 pid;
+    quint64 startTime;
+    qint64 time; //!< milliseconds since epoch
+    qint32 sampleType;
+    qint32 oomAdj;
+    qint64 rss;
+    qint64 pss;
+    qint32 oomScore;
+    qint32 oomScoreAdj;
+    quint64 statmSize;
+    quint64 statmResident;
+    quint64 statmShared;
+    quint64 statmText;
+    quint64 statmLib;
+    quint64 statmData;
+    quint64 statmDt;
+  };
+
+  struct DataRow {
+    qint64 rangeId; //!< SmapsRange::Key hash
+    qint64 rss;
+    qint64 pss;
+  };
+
+  /** Data of the measurement with the same process and time, followed by count of DataRow */
+  struct DataRecord {
+    qint64 pid;
+    quint64 startTime;
+    qint64 time;
+    quint32 count;
+    quint32 reserved;
+  };
+
+  struct MemInfoRecord {
+    qint64 time;
+    quint64 memTotal;
+    quint64 memFree;
+    quint64 memAvailable;
+    quint64 buffers;
+    quint64 cached;
+    quint64 swapCache;
+    quint64 swapTotal;
+    quint64 swapFree;
+    quint64 anonPages;
+    quint64 mapped;
+    quint64 shmem;
+    quint64 slab;
+    quint64 sReclaimable;
+  };
+
+  /** Followed by utf-8 name */
+  struct RecorderStatRecord {
+    qint64 time;
+    qint64 value;
+    quint32 nameSize;
+    quint32 reserved;
+  };
+
+  struct CommitRecord {
+    quint32 checksum; //!< CRC-32 of segment bytes before this record
+    quint32 reserved;
+  };
+
+  /** Size of record with given size of fixed and variable part, including header and padding */
+  static constexpr quint32 recordSize(size_t payloadSize)
+  {
+    return quint32((sizeof(RecordHeader) + payloadSize + Alignment - 1) / Alignment * Alignment);
+  }
+
+  /** Record struct following the header */
+  template <typename Record>
+  static const Record *record(const RecordHeader *header)
+  {
+    return reinterpret_cast<const Record*>(header + 1);
+  }
+
+  /** Variable part following record struct */
+  template <typename Record>
+  static const char *tail(const Record *record)
+  {
+    return reinterpret_cast<const char*>(record + 1);
+  }
+
+  template <typename Record>
+  static QString name(const Record *record)
+  {
+    return QString::fromUtf8(tail(record), int(record->nameSize));
+  }
+
+  static const DataRow *rows(const DataRecord *record)
+  {
+    return reinterpret_cast<const DataRow*>(record + 1);
+  }
+
+  /** Check that the record fits to its size, including variable part */
+  static bool isValid(const RecordHeader *header);
+
+  /** CRC-32 (the same as zlib), it may be computed incrementally from previous result */
+  static quint32 crc32(quint32 crc, const char *data, size_t size);
+
+  static QString segmentFile(const QString &directory, int index);
+
+  /** Index of segment from its file name, zero for other files */
+  static int segmentIndex(const QString &file);
+
+  /** Segment files of the directory ordered by index */
+  static QStringList segmentFiles(const QString &directory);
+};
+
+static_assert(Q_BYTE_ORDER == Q_LITTLE_ENDIAN, "Binary log is stored in native little-endian layout");
+static_assert(sizeof(BinLog::SegmentHeader) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::RecordHeader) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::ProcessRecord) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::RangeRecord) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::MeasurementRecord) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::DataRecord) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::MemInfoRecord) % BinLog::Alignment == 0);
+static_assert(sizeof(BinLog::RecorderStatRecord) % BinLog::Alignment == 0);
@@ -0,0 +1,250 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "BinLogReader.h"
+
+#include <QDebug>
+#include <QFileInfo>
+
+#include <cstring>
+
+bool BinLogReader::open(const QString &directory)
+{
+  segments.clear();
+  uncommitted = 0;
+  if (!QFileInfo(directory).isDir()) {
+    qWarning() << "Binary log directory doesn't exist" << directory;
+    return false;
+  }
+  for (const QString &fileName: BinLog::segmentFiles(directory)) {
+    if (!openSegment(fileName)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BinLogReader::openSegment(const QString &fileName)
+{
+  Segment segment;
+  segment.file = std::make_unique<QFile>(fileName);
+  if (!segment.file->open(QIODevice::ReadOnly)) {
+    qWarning() << "Can't open binary log segment" << fileName << segment.file->errorString();
+    return false;
+  }
+  qint64 size = segment.file->size();
+  if (size < qint64(sizeof(BinLog::SegmentHeader))) {
+    // segment was created just before crash
+    qWarning() << "Binary log segment" << fileName << "is empty";
+    uncommitted += size;
+    return true;
+  }
+  segment.data = reinterpret_cast<const char*>(segment.file->map(0, size));
+  if (segment.data == nullptr) {
+    qWarning() << "Can't map binary log segment" << fileName << segment.file->errorString();
+    return false;
+  }
+  const auto *header = reinterpret_cast<const BinLog::SegmentHeader*>(segment.data);
+  if (memcmp(header->magic, BinLog::Magic, sizeof(header->magic)) != 0 || header->version != BinLog::Version) {
+    qWarning() << fileName << "is not binary log segment of version" << BinLog::Version;
+    return false;
+  }
+
+  // checksum of commit covers all previous bytes of the segment
+  qint64 offset = sizeof(BinLog::SegmentHeader);
+  quint32 checksum = BinLog::crc32(0, segment.data, size_t(offset));
+  segment.committedSize = offset;
+  while (size - offset >= qint64(sizeof(BinLog::RecordHeader))) {
+    const auto *record = reinterpret_cast<const BinLog::RecordHeader*>(segment.data + offset);
+    if (record->size > size - offset || !BinLog::isValid(record)) {
+      break;
+    }
+    if (record->type == BinLog::Commit) {
+      if (BinLog::record<BinLog::CommitRecord>(record)->checksum != checksum) {
+        break;
+      }
+      segment.committedSize = offset + record->size;
+    }
+    checksum = BinLog::crc32(checksum, segment.data + offset, record->size);
+    offset += record->size;
+  }
+  if (segment.committedSize < size) {
+    qWarning() << "Binary log segment" << fileName << "has" << (size - segment.committedSize)
+               << "bytes without valid commit, they are skipped";
+    uncommitted += size - segment.committedSize;
+  }
+  segments.push_back(std::move(segment));
+  return true;
+}
+
+bool BinLogReader::scan(const Visitor &visitor) const
+{
+  for (const Segment &segment: segments) {
+    qint64 offset = sizeof(BinLog::SegmentHeader);
+    while (offset < segment.committedSize) {
+      const auto *record = reinterpret_cast<const BinLog::RecordHeader*>(segment.data + offset);
+      if (record->type != BinLog::Commit && !visitor(record)) {
+        return false;
+      }
+      offset += record->size;
+    }
+  }
+  return true;
+}
+
+#ifdef UNIT_TESTS
+
+#include "BinLogWriter.h"
+
+#include <catch2/catch.hpp>
+
+#include <QTemporaryDir>
+
+#include <cstddef>
+
+namespace {
+
+QList<quint32> recordTypes(const BinLogReader &reader)
+{
+  QList<quint32> types;
+  reader.scan([&](const BinLog::RecordHeader *record) {
+    types << record->type;
+    return true;
+  });
+  return types;
+}
+
+} // namespace
+
+TEST_CASE("binary log checksum is crc-32") {
+  REQUIRE(BinLog::crc32(0, "123456789", 9) == 0xCBF43926u);
+  REQUIRE(BinLog::crc32(BinLog::crc32(0, "1234", 4), "56789", 5) == 0xCBF43926u);
+}
+
+TEST_CASE("binary log skips records without valid commit") {
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  ProcessId processId(42, ProcessId::StartTime(1234));
+  SmapsRange range;
+  range.key.processId = processId;
+  range.key.from = 0x1000;
+  range.key.to = 0x2000;
+  range.key.permission = "r-xp";
+  range.key.name = "/usr/lib/libtest.so";
+  range.rss = 4;
+  range.pss = 2;
+  QDateTime time = QDateTime::fromMSecsSinceEpoch(1600000000000);
+  MemInfo memInfo;
+  memInfo.memTotal = 1024;
+
+  QString segment;
+  {
+    BinLogWriter writer;
+    REQUIRE(writer.init(dir.path(), 1024 * 1024));
+    segment = writer.segmentFile();
+    REQUIRE(writer.transaction());
+    REQUIRE(writer.insertOrIgnoreProcess(processId, "test"));
+    REQUIRE(writer.insertOrIgnoreRange(range.key));
+    REQUIRE(writer.insertMeasurement(processId, time, FullSmaps, 4, 2, StatM{}, OomScore{}));
+    REQUIRE(writer.insertData(processId, time, {range}));
+    REQUIRE(writer.commit());
+    // committed immediately outside of transaction
+    REQUIRE(writer.insertSystemMemInfo(time, memInfo));
+  }
+  const QList<quint32> allTypes{BinLog::Process, BinLog::Range, BinLog::Measurement, BinLog::Data, BinLog::MemInfo};
+
+  {
+    BinLogReader reader;
+    REQUIRE(reader.open(dir.path()));
+    REQUIRE(reader.segmentCount() == 1);
+    REQUIRE(reader.uncommittedBytes() == 0);
+    REQUIRE(recordTypes(reader) == allTypes);
+    reader.scan([&](const BinLog::RecordHeader *record) {
+      if (record->type == BinLog::Range) {
+        const auto *rangeRecord = BinLog::record<BinLog::RangeRecord>(record);
+        REQUIRE(BinLog::name(rangeRecord) == range.key.name);
+        REQUIRE(SmapsRange::permissionString(rangeRecord->permission) == range.key.permission);
+      } else if (record->type == BinLog::Data) {
+        const auto *data = BinLog::record<BinLog::DataRecord>(record);
+        REQUIRE(data->time == time.toMSecsSinceEpoch());
+        REQUIRE(data->count == 1);
+        REQUIRE(BinLog::rows(data)[0].rangeId == qint64(range.key.hash()));
+        REQUIRE(BinLog::rows(data)[0].rss == 4);
+        REQUIRE(BinLog::rows(data)[0].pss == 2);
+      }
+      return true;
+    });
+  }
+
+  // records of transaction interrupted by crash
+  QFile file(segment);
+  REQUIRE(file.open(QIODevice::ReadWrite | QIODevice::Append));
+  REQUIRE(file.write(QByteArray(20, 'x')) == 20);
+  file.close();
+  {
+    BinLogReader reader;
+    REQUIRE(reader.open(dir.path()));
+    REQUIRE(reader.uncommittedBytes() == 20);
+    REQUIRE(recordTypes(reader) == allTypes);
+  }
+
+  // corrupted value of the last transaction
+  REQUIRE(file.open(QIODevice::ReadWrite));
+  qint64 memInfoOffset = file.size() - 20 - BinLog::recordSize(sizeof(BinLog::CommitRecord))
+                         - BinLog::recordSize(sizeof(BinLog::MemInfoRecord));
+  REQUIRE(file.seek(memInfoOffset + sizeof(BinLog::RecordHeader) + offsetof(BinLog::MemInfoRecord, memTotal)));
+  REQUIRE(file.write(QByteArray(1, 'x')) == 1);
+  file.close();
+  {
+    BinLogReader reader;
+    REQUIRE(reader.open(dir.path()));
+    REQUIRE(recordTypes(reader) == allTypes.mid(0, 4));
+    REQUIRE(reader.uncommittedBytes() == 20 + BinLog::recordSize(sizeof(BinLog::CommitRecord))
+                                         + BinLog::recordSize(sizeof(BinLog::MemInfoRecord)));
+  }
+}
+
+TEST_CASE("binary log continues in the next segment") {
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  // every commit exceeds the segment size
+  for (int i = 0; i < 2; i++) {
+    BinLogWriter writer;
+    REQUIRE(writer.init(dir.path(), 1));
+    for (int j = 0; j < 2; j++) {
+      REQUIRE(writer.insertSystemMemInfo(QDateTime::fromMSecsSinceEpoch(i * 2 + j), MemInfo{}));
+    }
+  }
+
+  BinLogReader reader;
+  REQUIRE(reader.open(dir.path()));
+  // the last segment of every writer contains just the header
+  REQUIRE(reader.segmentCount() == 6);
+  QList<qint64> times;
+  reader.scan([&](const BinLog::RecordHeader *record) {
+    times << BinLog::record<BinLog::MemInfoRecord>(record)->time;
+    return true;
+  });
+  REQUIRE(times == QList<qint64>{0, 1, 2, 3});
+}
+
+#endif
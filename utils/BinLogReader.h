@@ -0,0 +1,79 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#pragma once
+
+#include "BinLog.h"
+
+#include <QFile>
+#include <QString>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Reader of binary log written by BinLogWriter. Segments are mapped to memory,
+ * records are visited in place without copy. Records that are not followed
+ * by commit with valid checksum (interrupted by crash) are skipped.
+ */
+class BinLogReader {
+  Q_DISABLE_COPY_MOVE(BinLogReader)
+
+public:
+  /**
+   * Record visitor, record is valid while the reader is open.
+   * Scan stops when the visitor returns false.
+   */
+  using Visitor = std::function<bool(const BinLog::RecordHeader *record)>;
+
+  BinLogReader() = default;
+  ~BinLogReader() = default;
+
+  /** Map segments of the directory and validate their checksums */
+  bool open(const QString &directory);
+
+  /** Visit committed records of all segments in order, false when visitor stopped the scan */
+  bool scan(const Visitor &visitor) const;
+
+  int segmentCount() const
+  {
+    return int(segments.size());
+  }
+
+  /** Size of records skipped because their transaction was not committed */
+  qint64 uncommittedBytes() const
+  {
+    return uncommitted;
+  }
+
+private:
+  struct Segment {
+    std::unique_ptr<QFile> file;
+    const char *data{nullptr};
+    qint64 committedSize{0}; //!< end of the last valid commit
+  };
+
+  bool openSegment(const QString &fileName);
+
+private:
+  std::vector<Segment> segments;
+  qint64 uncommitted{0};
+};
@@ -0,0 +1,238 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "BinLogWriter.h"
+
+#include <QDebug>
+#include <QDir>
+
+#include <cstring>
+
+bool BinLogWriter::init(const QString &dir, qint64 size)
+{
+  directory = dir;
+  segmentSize = size;
+  if (!QDir().mkpath(directory)) {
+    qWarning() << "Can't create binary log directory" << directory;
+    return false;
+  }
+  QStringList segments = BinLog::segmentFiles(directory);
+  segmentIndex = segments.isEmpty() ? 0 : BinLog::segmentIndex(segments.last());
+  return openSegment();
+}
+
+bool BinLogWriter::openSegment()
+{
+  file.close();
+  segmentIndex++;
+  file.setFileName(BinLog::segmentFile(directory, segmentIndex));
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Can't open binary log segment" << file.fileName() << file.errorString();
+    return false;
+  }
+  BinLog::SegmentHeader header{};
+  memcpy(header.magic, BinLog::Magic, sizeof(header.magic));
+  header.version = BinLog::Version;
+  if (file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != qint64(sizeof(header)) || !file.flush()) {
+    qWarning() << "Can't write binary log segment" << file.fileName() << file.errorString();
+    file.close();
+    return false;
+  }
+  checksum = BinLog::crc32(0, reinterpret_cast<const char*>(&header), sizeof(header));
+  qDebug() << "Binary log segment opened:" << file.fileName();
+  return true;
+}
+
+template <typename Record>
+Record *BinLogWriter::append(BinLog::RecordType type, size_t tailSize, const char *tail)
+{
+  quint32 size = BinLog::recordSize(sizeof(Record) + tailSize);
+  int offset = buffer.size();
+  buffer.resize(offset + int(size));
+  char *data = buffer.data() + offset;
+  memset(data, 0, size);
+  auto *header = reinterpret_cast<BinLog::RecordHeader*>(data);
+  header->type = type;
+  header->size = size;
+  auto *record = reinterpret_cast<Record*>(header + 1);
+  if (tail != nullptr) {
+    memcpy(record + 1, tail, tailSize);
+  }
+  return record;
+}
+
+bool BinLogWriter::transaction()
+{
+  if (inTransaction) {
+    return false;
+  }
+  inTransaction = true;
+  return true;
+}
+
+bool BinLogWriter::commit()
+{
+  inTransaction = false;
+  return flush();
+}
+
+bool BinLogWriter::rollback()
+{
+  inTransaction = false;
+  buffer.clear();
+  return true;
+}
+
+bool BinLogWriter::autoCommit()
+{
+  return inTransaction || flush();
+}
+
+bool BinLogWriter::flush()
+{
+  if (buffer.isEmpty()) {
+    return true;
+  }
+  if (!file.isOpen()) {
+    // segment was not opened
+    buffer.clear();
+    return false;
+  }
+  quint32 crc = BinLog::crc32(checksum, buffer.constData(), size_t(buffer.size()));
+  append<BinLog::CommitRecord>(BinLog::Commit)->checksum = crc;
+
+  if (file.write(buffer) != buffer.size() || !file.flush()) {
+    qWarning() << "Write of binary log failed" << file.fileName() << file.errorString();
+    buffer.clear();
+    // commits following partial write would not match the checksum, the next segment is started
+    openSegment();
+    return false;
+  }
+  constexpr quint32 commitSize = BinLog::recordSize(sizeof(BinLog::CommitRecord));
+  checksum = BinLog::crc32(crc, buffer.constData() + buffer.size() - commitSize, commitSize);
+  buffer.clear();
+
+  if (file.pos() >= segmentSize) {
+    return openSegment();
+  }
+  return true;
+}
+
+bool BinLogWriter::insertOrIgnoreProcess(const ProcessId &processId, const QString &name)
+{
+  QByteArray utf8 = name.toUtf8();
+  auto *record = append<BinLog::ProcessRecord>(BinLog::Process, size_t(utf8.size()), utf8.constData());
+  record->pid = processId.pid;
+  record->startTime = processId.startTime;
+  record->nameSize = quint32(utf8.size());
+  return autoCommit();
+}
+
+bool BinLogWriter::insertOrIgnoreRange(const SmapsRange::Key &range)
+{
+  QByteArray utf8 = range.name.toUtf8();
+  auto *record = append<BinLog::RangeRecord>(BinLog::Range, size_t(utf8.size()), utf8.constData());
+  record->pid = range.processId.pid;
+  record->startTime = range.processId.startTime;
+  record->from = range.from;
+  record->to = range.to;
+  record->permission = SmapsRange::permissionFlags(range.permission);
+  record->nameSize = quint32(utf8.size());
+  return autoCommit();
+}
+
+bool BinLogWriter::insertMeasurement(const ProcessId &processId,
+                                     const QDateTime &time,
+                                     SampleType sampleType,
+                                     qlonglong rss,
+                                     qlonglong pss,
+                                     const StatM &statm,
+                                     const OomScore &oomScore)
+{
+  auto *record = append<BinLog::MeasurementRecord>(BinLog::Measurement);
+  record->pid = processId.pid;
+  record->startTime = processId.startTime;
+  record->time = time.toMSecsSinceEpoch();
+  record->sampleType = sampleType;
+  record->oomAdj = oomScore.adj;
+  record->rss = rss;
+  record->pss = pss;
+  record->oomScore = oomScore.score;
+  record->oomScoreAdj = oomScore.scoreAdj;
+  record->statmSize = statm.size;
+  record->statmResident = statm.resident;
+  record->statmShared = statm.shared;
+  record->statmText = statm.text;
+  record->statmLib = statm.lib;
+  record->statmData = statm.data;
+  record->statmDt = statm.dt;
+  return autoCommit();
+}
+
+bool BinLogWriter::insertData(const ProcessId &processId,
+                              const QDateTime &time,
+                              const QList<SmapsRange> &ranges)
+{
+  auto *record = append<BinLog::DataRecord>(BinLog::Data, size_t(ranges.size()) * sizeof(BinLog::DataRow));
+  record->pid = processId.pid;
+  record->startTime = processId.startTime;
+  record->time = time.toMSecsSinceEpoch();
+  record->count = quint32(ranges.size());
+  BinLog::DataRow *row = reinterpret_cast<BinLog::DataRow*>(record + 1);
+  for (const SmapsRange &range: ranges) {
+    row->rangeId = qint64(range.key.hash());
+    row->rss = qint64(range.rss);
+    row->pss = qint64(range.pss);
+    ++row;
+  }
+  return autoCommit();
+}
+
+bool BinLogWriter::insertSystemMemInfo(const QDateTime &time, const MemInfo &memInfo)
+{
+  auto *record = append<BinLog::MemInfoRecord>(BinLog::MemInfo);
+  record->time = time.toMSecsSinceEpoch();
+  record->memTotal = memInfo.memTotal;
+  record->memFree = memInfo.memFree;
+  record->memAvailable = memInfo.memAvailable;
+  record->buffers = memInfo.buffers;
+  record->cached = memInfo.cached;
+  record->swapCache = memInfo.swapCache;
+  record->swapTotal = memInfo.swapTotal;
+  record->swapFree = memInfo.swapFree;
+  record->anonPages = memInfo.anonPages;
+  record->mapped = memInfo.mapped;
+  record->shmem = memInfo.shmem;
+  record->slab = memInfo.slab;
+  record->sReclaimable = memInfo.sReclaimable;
+  return autoCommit();
+}
+
+bool BinLogWriter::insertRecorderStats(const QDateTime &time, const QMap<QString, qlonglong> &values)
+{
+  for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
+    QByteArray utf8 = it.key().toUtf8();
+    auto *record = append<BinLog::RecorderStatRecord>(BinLog::RecorderStat, size_t(utf8.size()), utf8.constData());
+    record->time = time.toMSecsSinceEpoch();
+    record->value = it.value();
+    record->nameSize = quint32(utf8.size());
+  }
+  return autoCommit();
+}
@@ -0,0 +1,114 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#pragma once
+
+#include "BinLog.h"
+#include "MemInfo.h"
+#include "OomScore.h"
+#include "ProcessId.h"
+#include "SmapsRange.h"
+#include "StatM.h"
+#include "Utils.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QString>
+
+/**
+ * Writer of append-only binary log, see BinLog. It has the same insert methods
+ * as Storage, records are buffered until the transaction is committed.
+ * Segment is closed after commit when it exceeds segment size, the next one is started.
+ * Writer never appends to existing segment, new one is created when it is opened.
+ */
+class BinLogWriter {
+  Q_DISABLE_COPY_MOVE(BinLogWriter)
+
+public:
+  BinLogWriter() = default;
+  ~BinLogWriter() = default;
+
+  /**
+   * @param directory created when it doesn't exist
+   * @param segmentSize size of segment [bytes] that triggers start of the next one
+   */
+  bool init(const QString &directory, qint64 segmentSize);
+
+  bool transaction();
+  bool commit();
+
+  /** Drop records of the transaction */
+  bool rollback();
+
+  bool insertOrIgnoreProcess(const ProcessId &processId, const QString &name);
+
+  bool insertOrIgnoreRange(const SmapsRange::Key &range);
+
+  bool insertMeasurement(const ProcessId &processId,
+                         const QDateTime &time,
+                         SampleType sampleType,
+                         qlonglong rss,
+                         qlonglong pss,
+                         const StatM &statm,
+                         const OomScore &oomScore);
+
+  bool insertData(const ProcessId &processId,
+                  const QDateTime &time,
+                  const QList<SmapsRange> &ranges);
+
+  bool insertSystemMemInfo(const QDateTime &time, const MemInfo &memInfo);
+
+  bool insertRecorderStats(const QDateTime &time, const QMap<QString, qlonglong> &values);
+
+  /** File of the segment written now */
+  QString segmentFile() const
+  {
+    return file.fileName();
+  }
+
+private:
+  bool openSegment();
+
+  /**
+   * Append zeroed record to the buffer
+   * @param tail copied to variable part of the record when it is not null
+   * @return fixed part of the record, it is valid until the next append
+   */
+  template <typename Record>
+  Record *append(BinLog::RecordType type, size_t tailSize = 0, const char *tail = nullptr);
+
+  /** Commit records appended outside of transaction */
+  bool autoCommit();
+
+  /** Write buffered records with commit record */
+  bool flush();
+
+private:
+  QString directory;
+  qint64 segmentSize{0};
+  int segmentIndex{0};
+  QFile file;
+  quint32 checksum{0}; //!< of the segment bytes written so far
+  QByteArray buffer; //!< records of the transaction
+  bool inTransaction{false};
+};
@@ -0,0 +1,347 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "DataBlob.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+namespace {
+
+void appendVarint(QByteArray &out, quint64 value)
+{
+  while (value >= 0x80) {
+    out.append(char(value | 0x80));
+    value >>= 7;
+  }
+  out.append(char(value));
+}
+
+quint64 zigZag(qint64 value)
+{
+  return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+qint64 unZigZag(quint64 value)
+{
+  return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+/** Read varint and move the iterator after it, false when blob is truncated */
+bool readVarint(const uchar *&it, const uchar *end, quint64 &value)
+{
+  value = 0;
+  for (int shift = 0; it != end && shift < 64; shift += 7) {
+    uchar byte = *it++;
+    value |= quint64(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Append ascending values as the first value and differences to the previous for others */
+template <typename Values>
+void appendAscending(QByteArray &out, const Values &values, bool zigZagFirst)
+{
+  quint64 previous = 0;
+  for (size_t i = 0; i < values.size(); i++) {
+    quint64 value = quint64(values[i]);
+    if (i == 0) {
+      appendVarint(out, zigZagFirst ? zigZag(qint64(value)) : value);
+    } else {
+      appendVarint(out, value - previous);
+    }
+    previous = value;
+  }
+}
+
+/** Read ascending values appended by appendAscending, false when blob is truncated */
+bool readAscending(const uchar *&it, const uchar *end, quint64 count, bool zigZagFirst, std::vector<quint64> &values)
+{
+  values.reserve(count);
+  quint64 value = 0;
+  quint64 previous = 0;
+  for (quint64 i = 0; i < count; i++) {
+    if (!readVarint(it, end, value)) {
+      return false;
+    }
+    if (i == 0) {
+      previous = zigZagFirst ? quint64(unZigZag(value)) : value;
+    } else {
+      previous += value;
+    }
+    values.push_back(previous);
+  }
+  return true;
+}
+
+/** Read reference measurement id and move the iterator after it, zero when blob is self-contained */
+bool readReference(const uchar *&it, const uchar *end, qlonglong &referenceId)
+{
+  if (it == end) {
+    return false;
+  }
+  uchar flags = *it++;
+  referenceId = 0;
+  if (flags & DataBlob::Referenced) {
+    quint64 value = 0;
+    if (!readVarint(it, end, value) || value == 0) {
+      return false;
+    }
+    referenceId = unZigZag(value);
+  }
+  return true;
+}
+
+} // namespace
+
+QByteArray DataBlob::encode(std::vector<MeasurementData> &rows, bool compress,
+                            qlonglong referenceId, const std::vector<qlonglong> &referenceIds)
+{
+  std::stable_sort(rows.begin(), rows.end(), [](const MeasurementData &a, const MeasurementData &b) {
+    return a.rangeId < b.rangeId;
+  });
+  rows.erase(std::unique(rows.begin(), rows.end(), [](const MeasurementData &a, const MeasurementData &b) {
+    return a.rangeId == b.rangeId;
+  }), rows.end());
+
+  // range id differences are usually 8 bytes (ids are hashes), ordinals 1 byte, rss and pss 1-3 bytes
+  QByteArray raw;
+  raw.reserve(int(rows.size()) * 14 + 10);
+  appendVarint(raw, rows.size());
+  // both lists are sorted, so ordinals are found by single pass
+  std::vector<quint64> ordinals;
+  std::vector<qlonglong> ids;
+  ids.reserve(rows.size());
+  auto reference = referenceIds.cbegin();
+  for (const MeasurementData &row: rows) {
+    if (referenceId != 0) {
+      reference = std::lower_bound(reference, referenceIds.cend(), row.rangeId);
+      if (reference != referenceIds.cend() && *reference == row.rangeId) {
+        ordinals.push_back(quint64(reference - referenceIds.cbegin()));
+        continue;
+      }
+    }
+    ids.push_back(row.rangeId);
+  }
+  if (referenceId != 0) {
+    appendVarint(raw, ordinals.size());
+    appendAscending(raw, ordinals, false);
+  }
+  appendAscending(raw, ids, true);
+  for (const MeasurementData &row: rows) {
+    appendVarint(raw, zigZag(row.rss));
+  }
+  for (const MeasurementData &row: rows) {
+    appendVarint(raw, zigZag(row.rss - row.pss));
+  }
+
+  QByteArray blob;
+  blob.reserve(raw.size() + 11);
+  blob.append(char((compress ? Compressed : 0) | (referenceId != 0 ? Referenced : 0)));
+  if (referenceId != 0) {
+    appendVarint(blob, zigZag(referenceId));
+  }
+  blob.append(compress ? qCompress(raw) : raw);
+  return blob;
+}
+
+bool DataBlob::reference(const QByteArray &blob, qlonglong &referenceId)
+{
+  const uchar *it = reinterpret_cast<const uchar*>(blob.constData());
+  if (!readReference(it, it + blob.size(), referenceId)) {
+    qWarning() << "Corrupted data blob";
+    return false;
+  }
+  return true;
+}
+
+bool DataBlob::decode(const QByteArray &blob, QList<MeasurementData> &rows, const std::vector<qlonglong> &referenceIds)
+{
+  QByteArray uncompressed;
+  const uchar *it = reinterpret_cast<const uchar*>(blob.constData());
+  const uchar *end = it + blob.size();
+  qlonglong referenceId = 0;
+  if (!readReference(it, end, referenceId)) {
+    qWarning() << "Corrupted data blob";
+    return false;
+  }
+  if (blob[0] & Compressed) {
+    uncompressed = qUncompress(it, int(end - it));
+    it = reinterpret_cast<const uchar*>(uncompressed.constData());
+    end = it + uncompressed.size();
+  }
+
+  quint64 count = 0;
+  // every row takes at least three bytes
+  if (!readVarint(it, end, count) || count > quint64(end - it) / 3) {
+    qWarning() << "Corrupted data blob";
+    return false;
+  }
+  quint64 referenced = 0;
+  std::vector<quint64> ordinals;
+  if (referenceId != 0 &&
+      (!readVarint(it, end, referenced) || referenced > count ||
+       !readAscending(it, end, referenced, false, ordinals) ||
+       std::any_of(ordinals.cbegin(), ordinals.cend(), [&](quint64 o) { return o >= referenceIds.size(); }))) {
+    qWarning() << "Corrupted data blob";
+    return false;
+  }
+  std::vector<quint64> ids;
+  if (!readAscending(it, end, count - referenced, true, ids)) {
+    qWarning() << "Corrupted data blob";
+    return false;
+  }
+
+  // referenced and other ids are merged to the range id order
+  int first = rows.size();
+  rows.reserve(first + int(count));
+  auto ordinal = ordinals.cbegin();
+  auto id = ids.cbegin();
+  while (ordinal != ordinals.cend() || id != ids.cend()) {
+    if (id == ids.cend() || (ordinal != ordinals.cend() && referenceIds[*ordinal] < qlonglong(*id))) {
+      rows.append(MeasurementData{referenceIds[*ordinal++], 0, 0});
+    } else {
+      rows.append(MeasurementData{qlonglong(*id++), 0, 0});
+    }
+  }
+  quint64 value = 0;
+  auto begin = rows.begin() + first;
+  for (auto row = begin; row != rows.end(); ++row) {
+    if (!readVarint(it, end, value)) {
+      qWarning() << "Corrupted data blob";
+      return false;
+    }
+    row->rss = unZigZag(value);
+  }
+  for (auto row = begin; row != rows.end(); ++row) {
+    if (!readVarint(it, end, value)) {
+      qWarning() << "Corrupted data blob";
+      return false;
+    }
+    row->pss = row->rss - unZigZag(value);
+  }
+  return true;
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+#include <limits>
+
+TEST_CASE("data blob roundtrip") {
+  std::vector<MeasurementData> rows;
+  for (int i = 0; i < 1000; i++) {
+    // ids are hashes, spread over whole 64 bit range
+    qlonglong id = qlonglong(quint64(i) * 0x9E3779B97F4A7C15ull);
+    rows.push_back(MeasurementData{id, i % 7 == 0 ? -1 : i * 4, i % 7 == 0 ? -1 : i * 2});
+  }
+  rows.push_back(MeasurementData{rows[3].rangeId, 1, 1}); // duplicate is ignored
+  rows.push_back(MeasurementData{std::numeric_limits<qlonglong>::min(), 0, 0});
+  rows.push_back(MeasurementData{std::numeric_limits<qlonglong>::max(), 0, 0});
+
+  for (bool compress: {false, true}) {
+    std::vector<MeasurementData> input = rows;
+    QByteArray blob = DataBlob::encode(input, compress);
+    REQUIRE(input.size() == rows.size() - 1);
+
+    QList<MeasurementData> decoded;
+    decoded << MeasurementData{42, 1, 1}; // rows are appended
+    REQUIRE(DataBlob::decode(blob, decoded));
+    REQUIRE(decoded.size() == int(input.size()) + 1);
+    REQUIRE(decoded[0].rangeId == 42);
+    for (size_t i = 0; i < input.size(); i++) {
+      const MeasurementData &row = decoded[int(i) + 1];
+      REQUIRE(row.rangeId == input[i].rangeId);
+      REQUIRE(row.rss == input[i].rss);
+      REQUIRE(row.pss == input[i].pss);
+      if (i > 0) {
+        REQUIRE(row.rangeId > input[i - 1].rangeId);
+      }
+    }
+    auto duplicated = std::find_if(decoded.cbegin(), decoded.cend(), [&](const MeasurementData &row) {
+      return row.rangeId == rows[3].rangeId;
+    });
+    REQUIRE(duplicated != decoded.cend());
+    REQUIRE(duplicated->rss == 12); // the first row
+
+    QList<MeasurementData> truncated;
+    REQUIRE(!DataBlob::decode(blob.left(blob.size() / 2), truncated));
+  }
+
+  QList<MeasurementData> empty;
+  std::vector<MeasurementData> noRows;
+  REQUIRE(DataBlob::decode(DataBlob::encode(noRows, true), empty));
+  REQUIRE(empty.isEmpty());
+}
+
+TEST_CASE("data blob with reference") {
+  std::vector<MeasurementData> referenceRows;
+  for (int i = 0; i < 1000; i++) {
+    referenceRows.push_back(MeasurementData{qlonglong(quint64(i) * 0x9E3779B97F4A7C15ull), i * 4, i * 2});
+  }
+  QByteArray referenceBlob = DataBlob::encode(referenceRows, false);
+  qlonglong referenceId = -1;
+  REQUIRE(DataBlob::reference(referenceBlob, referenceId));
+  REQUIRE(referenceId == 0);
+  std::vector<qlonglong> referenceIds;
+  for (const MeasurementData &row: referenceRows) {
+    referenceIds.push_back(row.rangeId);
+  }
+
+  // some ranges disappeared, some are new
+  std::vector<MeasurementData> rows;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 100 != 0) {
+      rows.push_back(MeasurementData{referenceIds[size_t(i)], i, i});
+    }
+  }
+  for (int i = 0; i < 10; i++) {
+    rows.push_back(MeasurementData{qlonglong(quint64(i + 1000) * 0x9E3779B97F4A7C15ull), -1, -1});
+  }
+
+  for (bool compress: {false, true}) {
+    std::vector<MeasurementData> input = rows;
+    QByteArray blob = DataBlob::encode(input, compress, 42, referenceIds);
+    std::vector<MeasurementData> selfContained = rows;
+    REQUIRE(blob.size() * 2 < DataBlob::encode(selfContained, compress).size());
+    REQUIRE(DataBlob::reference(blob, referenceId));
+    REQUIRE(referenceId == 42);
+
+    QList<MeasurementData> decoded;
+    REQUIRE(DataBlob::decode(blob, decoded, referenceIds));
+    REQUIRE(decoded.size() == int(input.size()));
+    for (size_t i = 0; i < input.size(); i++) {
+      REQUIRE(decoded[int(i)].rangeId == input[i].rangeId);
+      REQUIRE(decoded[int(i)].rss == input[i].rss);
+      REQUIRE(decoded[int(i)].pss == input[i].pss);
+    }
+
+    // ordinals are out of shorter list
+    QList<MeasurementData> missing;
+    REQUIRE(!DataBlob::decode(blob, missing, std::vector<qlonglong>(referenceIds.begin(), referenceIds.begin() + 10)));
+  }
+}
+
+#endif // UNIT_TESTS
@@ -0,0 +1,70 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#pragma once
+
+#include "Utils.h"
+
+#include <QByteArray>
+#include <QList>
+
+#include <vector>
+
+/**
+ * Columnar encoding of measurement data rows to single blob.
+ *
+ * Blob starts with flags byte, blob with reference continues by zig-zag varint
+ * of the reference measurement id. The rest is optionally compressed by qCompress.
+ * It contains number of rows and three columns of varints (7 bits per byte):
+ * range ids sorted in ascending order (zig-zag encoded first id, differences
+ * to the previous id for others), rss values and differences of pss from rss.
+ * Rss and pss are zig-zag encoded, negative values mark removed ranges in delta recordings.
+ *
+ * Range ids are 64 bit hashes, so they take most of the blob. Blob with reference
+ * stores ids found in the sorted range ids of the reference blob as their count and ordinals
+ * (the first ordinal, differences to the previous for others, usually single byte)
+ * before the other ids. Rss and pss columns follow in range id order.
+ */
+class DataBlob {
+public:
+  enum Flag {
+    Compressed = 1,
+    Referenced = 2
+  };
+
+  /**
+   * Encode rows, they are sorted by range id. When range id is duplicated,
+   * just the first row is encoded, the same as with INSERT OR IGNORE to data table.
+   * When reference id is not zero, ids are encoded against reference ids,
+   * sorted range ids of the reference blob.
+   */
+  static QByteArray encode(std::vector<MeasurementData> &rows, bool compress,
+                           qlonglong referenceId = 0, const std::vector<qlonglong> &referenceIds = {});
+
+  /** Measurement id of the reference blob, zero for self-contained blob, false when blob is corrupted */
+  static bool reference(const QByteArray &blob, qlonglong &referenceId);
+
+  /**
+   * Decode rows and append them to the list, false when blob is corrupted.
+   * Blob with reference requires sorted range ids of the reference blob.
+   */
+  static bool decode(const QByteArray &blob, QList<MeasurementData> &rows,
+                     const std::vector<qlonglong> &referenceIds = {});
+};
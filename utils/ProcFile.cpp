@@ -0,0 +1,142 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ProcFile.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+// descriptors for database, threads, event loop, sockets...
+constexpr long ReservedDescriptors = 128;
+// sanity limit when hard limit is unlimited
+constexpr rlim_t MaxDescriptors = 1 << 20;
+} // namespace
+
+std::atomic<long> ProcFile::descriptorBudget{1024 - ReservedDescriptors};
+std::atomic<long> ProcFile::descriptorCount{0};
+
+ProcFile::ProcFile(const QString &path):
+  filePath(path)
+{}
+
+ProcFile::~ProcFile()
+{
+  close();
+}
+
+bool ProcFile::open()
+{
+  if (fd >= 0) {
+    return true;
+  }
+  fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  persistent = acquireDescriptor();
+  return true;
+}
+
+void ProcFile::close()
+{
+  if (fd < 0) {
+    return;
+  }
+  ::close(fd);
+  fd = -1;
+  if (persistent) {
+    releaseDescriptor();
+    persistent = false;
+  }
+}
+
+bool ProcFile::acquireDescriptor()
+{
+  if (++descriptorCount <= descriptorBudget) {
+    return true;
+  }
+  --descriptorCount;
+  return false;
+}
+
+void ProcFile::releaseDescriptor()
+{
+  --descriptorCount;
+}
+
+bool ProcFile::read(char *buffer, size_t size, size_t &length)
+{
+  assert(size > 0);
+  length = 0;
+  return access([&](int descriptor) {
+    while (length < size - 1) {
+      ssize_t count = ::pread(descriptor, buffer + length, size - 1 - length, length);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        buffer[length] = '\0';
+        return false;
+      }
+      if (count == 0) {
+        break;
+      }
+      length += count;
+    }
+    buffer[length] = '\0';
+    return true;
+  });
+}
+
+long ProcFile::initBudget(long budget)
+{
+  rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    if (limit.rlim_cur < limit.rlim_max) {
+      rlimit raised = limit;
+      raised.rlim_cur = std::min(limit.rlim_max, MaxDescriptors);
+      if (setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+        limit = raised;
+      } else {
+        qWarning() << "Failed to raise limit of open files to" << raised.rlim_cur;
+      }
+    }
+  } else {
+    limit.rlim_cur = 1024;
+  }
+
+  long available = std::max(long(std::min(limit.rlim_cur, MaxDescriptors)) - ReservedDescriptors, 0L);
+  if (budget <= 0 || budget > available) {
+    if (budget > available) {
+      qWarning() << "Descriptor budget" << budget << "is over the limit, using" << available;
+    }
+    budget = available;
+  }
+  descriptorBudget = budget;
+  return budget;
+}
@@ -0,0 +1,99 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include "Utils.h"
+
+#include <QString>
+
+#include <atomic>
+
+/**
+ * File from proc filesystem that is opened once and re-read by pread from offset 0.
+ *
+ * Number of descriptors kept open by all instances (and other long-living
+ * descriptors, see acquireDescriptor) is limited by global budget.
+ * When the budget is exhausted, file is opened just for the time of reading.
+ */
+class ProcFile {
+  Q_DISABLE_COPY_MOVE(ProcFile)
+
+public:
+  explicit ProcFile(const QString &path);
+  ~ProcFile();
+
+  const QString &path() const {
+    return filePath;
+  }
+
+  /**
+   * Call function with open file descriptor.
+   * Returns false when file cannot be opened, result of function otherwise.
+   */
+  template<typename Function>
+  bool access(Function &&function) {
+    if (!open()) {
+      return false;
+    }
+    bool result = function(fd);
+    if (!persistent) {
+      close();
+    }
+    return result;
+  }
+
+  /**
+   * Read whole (small) file to the buffer, content is null-terminated.
+   */
+  bool read(char *buffer, size_t size, size_t &length);
+
+  void close();
+
+  /**
+   * Setup global budget of persistent descriptors. Soft RLIMIT_NOFILE is raised
+   * to hard limit, budget is limited by it (minus descriptors reserved for other usage).
+   * @param budget requested budget, zero for maximum possible
+   * @return effective budget
+   */
+  static long initBudget(long budget);
+
+  /** Number of persistent descriptors held by all instances */
+  static long openDescriptors() {
+    return descriptorCount;
+  }
+
+  /**
+   * Account long-living descriptor (not necessary ProcFile) to the budget.
+   * @return false when budget is exhausted
+   */
+  static bool acquireDescriptor();
+  static void releaseDescriptor();
+
+private:
+  bool open();
+
+private:
+  QString filePath;
+  int fd{-1};
+  bool persistent{false};
+
+  static std::atomic<long> descriptorBudget;
+  static std::atomic<long> descriptorCount;
+};
@@ -0,0 +1,330 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "SmapsParser.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+inline bool isHexDigit(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
+
+size_t parseHex(const char *&p, const char *end) {
+  size_t value = 0;
+  for (; p < end; ++p) {
+    char c = *p;
+    if (c >= '0' && c <= '9') {
+      value = (value << 4) | size_t(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = (value << 4) | size_t(c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+inline const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && *p == ' ') {
+    ++p;
+  }
+  return p;
+}
+
+inline const char *skipToken(const char *p, const char *end) {
+  while (p < end && *p != ' ') {
+    ++p;
+  }
+  return p;
+}
+
+template<size_t N>
+inline bool startsWith(const char *begin, const char *end, const char (&prefix)[N]) {
+  constexpr size_t length = N - 1;
+  return size_t(end - begin) >= length && std::memcmp(begin, prefix, length) == 0;
+}
+
+/** Parse value of memory line like "Rss:     1234 kB", p points right after the colon. */
+size_t parseMemory(const char *begin, const char *p, const char *end) {
+  p = skipSpaces(p, end);
+  const char *digits = p;
+  size_t value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    value = value * 10 + size_t(*p - '0');
+  }
+  if (p == digits) {
+    qWarning() << "Can't parse memory line" << QByteArray(begin, end - begin);
+    return 0;
+  }
+  return value;
+}
+
+} // namespace
+
+SmapsParser::SmapsParser(const ProcessId &processId, size_t bufferSize):
+  processId(processId),
+  buffer(std::max(bufferSize, size_t(16)))
+{}
+
+bool SmapsParser::parse(const QString &file, QList<SmapsRange> &ranges)
+{
+  int fd = ::open(QFile::encodeName(file).constData(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool result = parse(fd, ranges);
+  ::close(fd);
+  return result;
+}
+
+bool SmapsParser::parse(int fd, QList<SmapsRange> &ranges)
+{
+  lines = 0;
+  inRange = false;
+
+  size_t pending = 0; // bytes of incomplete line at the buffer begin
+  off_t offset = 0;
+  for (;;) {
+    if (pending == buffer.size()) {
+      // line is longer than whole buffer
+      buffer.resize(buffer.size() * 2);
+    }
+    ssize_t count = ::pread(fd, buffer.data() + pending, buffer.size() - pending, offset);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (count == 0) {
+      break;
+    }
+    offset += count;
+
+    const char *lineBegin = buffer.data();
+    const char *end = buffer.data() + pending + count;
+    for (const char *lineEnd = static_cast<const char*>(std::memchr(lineBegin, '\n', end - lineBegin));
+         lineEnd != nullptr;
+         lineEnd = static_cast<const char*>(std::memchr(lineBegin, '\n', end - lineBegin))) {
+      parseLine(lineBegin, lineEnd, ranges);
+      lineBegin = lineEnd + 1;
+    }
+    pending = end - lineBegin;
+    std::memmove(buffer.data(), lineBegin, pending);
+  }
+
+  if (pending > 0) {
+    parseLine(buffer.data(), buffer.data() + pending, ranges);
+  }
+  if (inRange) {
+    ranges << range;
+    inRange = false;
+  }
+  return true;
+}
+
+void SmapsParser::parseLine(const char *begin, const char *end, QList<SmapsRange> &ranges)
+{
+  if (begin == end) {
+    return;
+  }
+  lines++;
+
+  // range header starts with address in lower-case hex,
+  // attribute names ("Rss:", "VmFlags:"...) starts with upper-case letter
+  if (isHexDigit(*begin)) {
+    if (inRange) {
+      ranges << range;
+    }
+    parseHeader(begin, end);
+    inRange = true;
+  } else if (inRange) {
+    if (startsWith(begin, end, "Rss:")) {
+      range.rss = parseMemory(begin, begin + 4, end);
+    } else if (startsWith(begin, end, "Pss:")) {
+      range.pss = parseMemory(begin, begin + 4, end);
+    }
+  }
+}
+
+void SmapsParser::parseHeader(const char *begin, const char *end)
+{
+  // 7f2c5a1e4000-7f2c5a1e6000 rw-p 00000000 00:00 0     [heap]
+  range.key.processId = processId;
+  range.rss = 0;
+  range.pss = 0;
+
+  const char *p = begin;
+  range.key.from = parseHex(p, end);
+  if (p == end || *p != '-') {
+    qWarning() << "Can't parse range:" << QByteArray(begin, end - begin);
+  } else {
+    ++p;
+  }
+  range.key.to = parseHex(p, end);
+
+  p = skipSpaces(p, end);
+  const char *permissionEnd = skipToken(p, end);
+  if (p == permissionEnd) {
+    qWarning() << "Can't parse range:" << QByteArray(begin, end - begin);
+  }
+  range.key.permission = permissionString(p, permissionEnd);
+  p = permissionEnd;
+
+  // skip offset, device and inode columns
+  for (int i = 0; i < 3; i++) {
+    p = skipToken(skipSpaces(p, end), end);
+  }
+
+  p = skipSpaces(p, end);
+  range.key.name = nameString(p, skipToken(p, end));
+}
+
+const QString &SmapsParser::permissionString(const char *begin, const char *end)
+{
+  size_t length = end - begin;
+  for (const auto &permission: permissions) {
+    if (permission.first.size() == length &&
+        std::memcmp(permission.first.data(), begin, length) == 0) {
+      return permission.second;
+    }
+  }
+  permissions.emplace_back(std::string(begin, length), QString::fromLatin1(begin, int(length)));
+  return permissions.back().second;
+}
+
+const QString &SmapsParser::nameString(const char *begin, const char *end)
+{
+  size_t length = end - begin;
+  if (length == 0) {
+    return emptyName;
+  }
+  if (lastNameBytes.size() != length ||
+      std::memcmp(lastNameBytes.data(), begin, length) != 0) {
+    lastNameBytes.assign(begin, length);
+    lastName = QString::fromUtf8(begin, int(length));
+  }
+  return lastName;
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+#include <QTemporaryFile>
+#include <QTextStream>
+
+namespace {
+void writeRange(QTextStream &stream, size_t from, size_t to,
+                const QString &permission, const QString &name,
+                size_t rss, size_t pss) {
+  stream << QString::asprintf("%zx-%zx ", from, to) << permission
+         << " 00000000 08:01 1234                       " << name << "\n";
+  stream << "Size:                  8 kB\n";
+  stream << "KernelPageSize:        4 kB\n";
+  stream << "Rss:                 " << rss << " kB\n";
+  stream << "Pss:                 " << pss << " kB\n";
+  stream << "Pss_Anon:              1 kB\n";
+  stream << "Shared_Clean:          0 kB\n";
+  stream << "VmFlags: rd wr mr mw me ac sd\n";
+}
+} // namespace
+
+TEST_CASE("smaps parsing test") {
+  QTemporaryFile smaps;
+  REQUIRE(smaps.open());
+  {
+    QTextStream stream(&smaps);
+    writeRange(stream, 0x55d0c4a2b000, 0x55d0c4a2d000, "r--p", "/usr/bin/cat", 8, 4);
+    writeRange(stream, 0x55d0c4a2d000, 0x55d0c4a32000, "r-xp", "/usr/bin/cat", 20, 10);
+    writeRange(stream, 0x55d0c5a5f000, 0x55d0c5a80000, "rw-p", "[heap]", 12, 12);
+    writeRange(stream, 0x7f2c5a1e4000, 0x7f2c5a1e6000, "rw-p", "", 8, 8);
+  }
+  smaps.close();
+
+  ProcessId processId(42, 1234);
+  QList<SmapsRange> ranges;
+  SmapsParser parser(processId);
+  REQUIRE(parser.parse(smaps.fileName(), ranges));
+  REQUIRE(parser.lineCount() == 4 * 8);
+  REQUIRE(ranges.size() == 4);
+
+  REQUIRE(ranges[0].key.processId.pid == 42);
+  REQUIRE(ranges[0].key.from == 0x55d0c4a2b000);
+  REQUIRE(ranges[0].key.to == 0x55d0c4a2d000);
+  REQUIRE(ranges[0].key.permission == "r--p");
+  REQUIRE(ranges[0].key.name == "/usr/bin/cat");
+  REQUIRE(ranges[0].rss == 8);
+  REQUIRE(ranges[0].pss == 4);
+
+  REQUIRE(ranges[1].key.permission == "r-xp");
+  REQUIRE(ranges[1].rss == 20);
+  REQUIRE(ranges[2].key.name == "[heap]");
+  REQUIRE(ranges[3].key.name.isEmpty());
+  REQUIRE(!ranges[3].key.name.isNull());
+  REQUIRE(ranges[3].pss == 8);
+}
+
+TEST_CASE("smaps parsing with lines crossing buffer boundary") {
+  QTemporaryFile smaps;
+  REQUIRE(smaps.open());
+  constexpr size_t rangeCount = 1000;
+  {
+    QTextStream stream(&smaps);
+    for (size_t i = 0; i < rangeCount; i++) {
+      writeRange(stream, 0x1000 * (i + 1), 0x1000 * (i + 2), "rw-p",
+                 QString("/tmp/mapping-%1").arg(i / 3), i, i / 2);
+    }
+  }
+  smaps.close();
+
+  QList<SmapsRange> ranges;
+  SmapsParser parser(ProcessId(), 16);
+  REQUIRE(parser.parse(smaps.fileName(), ranges));
+  REQUIRE(ranges.size() == int(rangeCount));
+  for (size_t i = 0; i < rangeCount; i++) {
+    REQUIRE(ranges[i].key.from == 0x1000 * (i + 1));
+    REQUIRE(ranges[i].key.name == QString("/tmp/mapping-%1").arg(i / 3));
+    REQUIRE(ranges[i].rss == i);
+    REQUIRE(ranges[i].pss == i / 2);
+  }
+}
+
+TEST_CASE("empty smaps of kernel thread") {
+  QTemporaryFile smaps;
+  REQUIRE(smaps.open());
+  smaps.close();
+
+  QList<SmapsRange> ranges;
+  SmapsParser parser;
+  REQUIRE(parser.parse(smaps.fileName(), ranges));
+  REQUIRE(ranges.empty());
+}
+
+#endif // UNIT_TESTS
@@ -0,0 +1,75 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include "ProcessId.h"
+#include "SmapsRange.h"
+
+#include <QList>
+#include <QString>
+
+#include <string>
+#include <vector>
+
+/**
+ * Parser of /proc/<pid>/smaps file.
+ *
+ * File is read to reused byte buffer and every line is parsed in place,
+ * there is no heap allocation per line. Just range header lines and
+ * Rss, Pss values are processed, other attributes are skipped.
+ *
+ * Parser instance is not thread safe, every watcher should use its own.
+ */
+class SmapsParser {
+public:
+  explicit SmapsParser(const ProcessId &processId = ProcessId(),
+                       size_t bufferSize = 64 * 1024);
+
+  /** Open, parse and close given file. */
+  bool parse(const QString &file, QList<SmapsRange> &ranges);
+
+  /** Parse file from given descriptor, it is read by pread from offset 0. */
+  bool parse(int fd, QList<SmapsRange> &ranges);
+
+  /** Number of lines processed by last parse call. */
+  size_t lineCount() const {
+    return lines;
+  }
+
+private:
+  void parseLine(const char *begin, const char *end, QList<SmapsRange> &ranges);
+  void parseHeader(const char *begin, const char *end);
+  const QString &permissionString(const char *begin, const char *end);
+  const QString &nameString(const char *begin, const char *end);
+
+private:
+  ProcessId processId;
+  std::vector<char> buffer;
+  SmapsRange range;
+  bool inRange{false};
+  size_t lines{0};
+
+  // consecutive mappings usually share the name (sections of one library),
+  // permissions are just few distinct values - reuse implicitly shared strings
+  std::string lastNameBytes;
+  QString lastName;
+  QString emptyName{QStringLiteral("")};
+  std::vector<std::pair<std::string, QString>> permissions;
+};
@@ -46,3 +46,53 @@ void SmapsRange::debugPrint() const {
   qDebug() << QString::asprintf("%zx-%zx", key.from, key.to) << key.permission
            << key.name << rss << pss;
 }
+
+int SmapsRange::permissionFlags(const QString &permission) {
+  int flags = 0;
+  if (permission.size() != 4) {
+    return flags;
+  }
+  if (permission[0] == 'r') {
+    flags |= Read;
+  }
+  if (permission[1] == 'w') {
+    flags |= Write;
+  }
+  if (permission[2] == 'x') {
+    flags |= Execute;
+  }
+  if (permission[3] == 's') {
+    flags |= Shared;
+  }
+  return flags;
+}
+
+QString SmapsRange::permissionString(int flags) {
+  QString permission("---p");
+  if (flags & Read) {
+    permission[0] = 'r';
+  }
+  if (flags & Write) {
+    permission[1] = 'w';
+  }
+  if (flags & Execute) {
+    permission[2] = 'x';
+  }
+  if (flags & Shared) {
+    permission[3] = 's';
+  }
+  return permission;
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+TEST_CASE("permission flags roundtrip") {
+  for (const QString permission: {"---p", "r--p", "rw-p", "r-xp", "rwxp", "r--s", "rw-s", "---s"}) {
+    REQUIRE(SmapsRange::permissionString(SmapsRange::permissionFlags(permission)) == permission);
+  }
+  REQUIRE(SmapsRange::permissionFlags("rw-s") == (SmapsRange::Read | SmapsRange::Write | SmapsRange::Shared));
+}
+
+#endif
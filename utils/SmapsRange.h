@@ -24,6 +24,17 @@
 #include <QString>
 
 struct SmapsRange {
+  /** Permission of memory mapping ("rw-p") as bitflags, stored in database */
+  enum PermissionFlag {
+    Read = 1,
+    Write = 2,
+    Execute = 4,
+    Shared = 8 //!< private otherwise
+  };
+
+  static int permissionFlags(const QString &permission);
+  static QString permissionString(int flags);
+
   struct Key {
     ProcessId processId;
 
@@ -0,0 +1,146 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "SqliteStatement.h"
+
+#include <QDebug>
+
+#include <utility>
+
+SqliteStatement::SqliteStatement(SqliteStatement &&other) noexcept:
+  db(std::exchange(other.db, nullptr)),
+  stmt(std::exchange(other.stmt, nullptr)),
+  stepResult(std::exchange(other.stepResult, SQLITE_OK))
+{}
+
+SqliteStatement &SqliteStatement::operator=(SqliteStatement &&other) noexcept
+{
+  if (this != &other) {
+    finalize();
+    db = std::exchange(other.db, nullptr);
+    stmt = std::exchange(other.stmt, nullptr);
+    stepResult = std::exchange(other.stepResult, SQLITE_OK);
+  }
+  return *this;
+}
+
+SqliteStatement::~SqliteStatement()
+{
+  finalize();
+}
+
+bool SqliteStatement::prepare(sqlite3 *database, const QString &sql)
+{
+  finalize();
+  db = database;
+  QByteArray utf8 = sql.toUtf8();
+  if (sqlite3_prepare_v2(db, utf8.constData(), utf8.size(), &stmt, nullptr) != SQLITE_OK) {
+    qWarning() << "Preparing statement failed:" << errorMessage() << sql;
+    finalize();
+    return false;
+  }
+  return true;
+}
+
+void SqliteStatement::finalize()
+{
+  if (stmt != nullptr) {
+    sqlite3_finalize(stmt);
+    stmt = nullptr;
+  }
+  stepResult = SQLITE_OK;
+}
+
+bool SqliteStatement::exec()
+{
+  stepResult = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  return stepResult == SQLITE_DONE || stepResult == SQLITE_ROW;
+}
+
+bool SqliteStatement::next()
+{
+  stepResult = sqlite3_step(stmt);
+  return stepResult == SQLITE_ROW;
+}
+
+void SqliteStatement::reset()
+{
+  sqlite3_reset(stmt);
+  stepResult = SQLITE_OK;
+}
+
+int SqliteStatement::columnIndex(const char *name) const
+{
+  int count = sqlite3_column_count(stmt);
+  for (int column = 0; column < count; column++) {
+    if (qstrcmp(sqlite3_column_name(stmt, column), name) == 0) {
+      return column;
+    }
+  }
+  return -1;
+}
+
+QString SqliteStatement::columnString(int column) const
+{
+  const void *text = sqlite3_column_text16(stmt, column);
+  if (text == nullptr) {
+    return QString();
+  }
+  return QString::fromUtf16(static_cast<const ushort*>(text),
+                            sqlite3_column_bytes16(stmt, column) / int(sizeof(ushort)));
+}
+
+QString SqliteStatement::errorMessage() const
+{
+  return db != nullptr ? QString::fromUtf8(sqlite3_errmsg(db)) : QString("no database");
+}
+
+#ifdef UNIT_TESTS
+
+#include <catch2/catch.hpp>
+
+TEST_CASE("step error is distinguished from the end of rows") {
+  sqlite3 *db = nullptr;
+  REQUIRE(sqlite3_open(":memory:", &db) == SQLITE_OK);
+  REQUIRE(sqlite3_exec(db, "CREATE TABLE `t` (`v` INTEGER);"
+                           "INSERT INTO `t` VALUES (1), (-9223372036854775807 - 1);",
+                       nullptr, nullptr, nullptr) == SQLITE_OK);
+  {
+    SqliteStatement statement;
+    REQUIRE(statement.prepare(db, "SELECT `v` FROM `t`;"));
+    int rows = 0;
+    while (statement.next()) {
+      rows++;
+    }
+    CHECK(rows == 2);
+    CHECK(!statement.hasError());
+
+    // abs of the minimal integer overflows on the second row
+    REQUIRE(statement.prepare(db, "SELECT abs(`v`) FROM `t` ORDER BY `v` DESC;"));
+    CHECK(statement.next());
+    CHECK(!statement.next());
+    CHECK(statement.hasError());
+    statement.reset();
+    CHECK(!statement.hasError());
+  }
+  sqlite3_close(db);
+}
+
+#endif // UNIT_TESTS
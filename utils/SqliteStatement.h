@@ -0,0 +1,114 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+#include <sqlite3.h>
+
+/**
+ * Statement of sqlite3 C API, prepared once and executed many times
+ * without QVariant conversions of QtSql. Statement is finalized by destructor.
+ *
+ * Parameters are indexed from 1, result columns from 0 (as in sqlite3 API).
+ */
+class SqliteStatement {
+  Q_DISABLE_COPY(SqliteStatement)
+
+public:
+  SqliteStatement() = default;
+  SqliteStatement(SqliteStatement &&other) noexcept;
+  SqliteStatement &operator=(SqliteStatement &&other) noexcept;
+  ~SqliteStatement();
+
+  bool prepare(sqlite3 *db, const QString &sql);
+  void finalize();
+
+  bool isValid() const {
+    return stmt != nullptr;
+  }
+
+  void bind(int index, qlonglong value) {
+    sqlite3_bind_int64(stmt, index, value);
+  }
+
+  void bindDouble(int index, double value) {
+    sqlite3_bind_double(stmt, index, value);
+  }
+
+  void bindNull(int index) {
+    sqlite3_bind_null(stmt, index);
+  }
+
+  void bindBlob(int index, const QByteArray &value) {
+    sqlite3_bind_blob(stmt, index, value.constData(), value.size(), SQLITE_TRANSIENT);
+  }
+
+  void bind(int index, const QString &value) {
+    sqlite3_bind_text16(stmt, index, value.utf16(), value.size() * int(sizeof(ushort)), SQLITE_TRANSIENT);
+  }
+
+  /** Bind named parameter (":name"), it is ignored when statement doesn't contain it */
+  void bind(const char *name, qlonglong value) {
+    bind(sqlite3_bind_parameter_index(stmt, name), value);
+  }
+
+  /** Execute statement without result rows, statement is reset for next execution */
+  bool exec();
+
+  /** Step to the next result row, false on the end or error (see hasError) */
+  bool next();
+
+  /** Last step failed, false when it returned row or reached the end of rows */
+  bool hasError() const {
+    return stepResult != SQLITE_OK && stepResult != SQLITE_ROW && stepResult != SQLITE_DONE;
+  }
+
+  /** Reset statement for next execution, bound parameters are kept */
+  void reset();
+
+  qlonglong columnLong(int column) const {
+    return sqlite3_column_int64(stmt, column);
+  }
+
+  bool isNull(int column) const {
+    return sqlite3_column_type(stmt, column) == SQLITE_NULL;
+  }
+
+  /** Index of result column with given name, -1 when there is no such column */
+  int columnIndex(const char *name) const;
+
+  QString columnString(int column) const;
+
+  /** Blob without copy, it is valid until the next step or reset of the statement */
+  QByteArray columnBlob(int column) const {
+    return QByteArray::fromRawData(static_cast<const char*>(sqlite3_column_blob(stmt, column)),
+                                   sqlite3_column_bytes(stmt, column));
+  }
+
+  QString errorMessage() const;
+
+private:
+  sqlite3 *db{nullptr};
+  sqlite3_stmt *stmt{nullptr};
+  int stepResult{SQLITE_OK}; //!< result of the last step, SQLITE_OK after reset
+};
@@ -18,180 +18,593 @@
 */
 
 #include "Storage.h"
+#include "BinLogReader.h"
+#include "DataBlob.h"
 #include "QVariantConverters.h"
 
 #include <QDebug>
+#include <QFileInfo>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QSet>
 
+#include <QSqlDriver>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 
 using namespace converters;
 
-Storage::~Storage()
-{
-  if (db.isValid()) {
-    if (db.isOpen()) {
-      db.close();
-    }
-    db = QSqlDatabase(); // invalidate instance
-  }
-  qDebug() << "Storage is closed";
-}
+namespace {
 
-bool Storage::updateSchema()
-{
-  QStringList tables = db.tables();
+// rows inserted by single multi-row statement, 4 parameters each (default limit of sqlite is 999 parameters)
+constexpr int DataRowsPerStatement = 128;
 
-  if (!tables.contains("process")) {
+// QSQLITE driver binds qulonglong as text, that is converted by integer column affinity
+// to integer when it fits to 64 bit signed integer, to real otherwise. Schema v1 stores
+// hashes this way, v2 stores them as signed integers.
+QString v1Id(const QString &column) {
+  return QString("(CASE WHEN typeof(%1) = 'real' THEN CAST(%1 - 18446744073709551616.0 AS INTEGER) ELSE %1 END)")
+    .arg(column);
+}
 
-    QString sql("CREATE TABLE `process`");
-    sql.append("(").append( "`id` UNSIGNED BIG INT PRIMARY KEY "); // hash of pid and start_time
-    sql.append(",").append( "`pid` INTEGER NOT NULL "); // system process id
-    sql.append(",").append( "`start_time` "); // from /proc/<pid>/stat
-    sql.append(",").append( "`name` varchar(255) NULL ");
-    sql.append(");");
+// schema v1 stores local time as ISO text, v2 milliseconds since epoch
+QString v1Time(const QString &column) {
+  return QString("CAST(ROUND((julianday(%1, 'utc') - 2440587.5) * 86400000.0) AS INTEGER)").arg(column);
+}
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()) {
-      qWarning() << "Creating table process failed" << q.lastError();
-      db.close();
-      return false;
-    }
-  }
+// schema v1 stores permission as text ("rw-p"), v2 as SmapsRange::PermissionFlag
+QString v1Permission(const QString &column) {
+  return QString("((substr(%1, 1, 1) = 'r') * %2 | (substr(%1, 2, 1) = 'w') * %3 | "
+                 "(substr(%1, 3, 1) = 'x') * %4 | (substr(%1, 4, 1) = 's') * %5)")
+    .arg(column)
+    .arg(SmapsRange::Read)
+    .arg(SmapsRange::Write)
+    .arg(SmapsRange::Execute)
+    .arg(SmapsRange::Shared);
+}
 
-  if (!tables.contains("memory_range")) {
+// queries of analysis tools on schema v2, unit test checks that they are resolved by indexes
+const char *const SelectProcessesByPid = "SELECT * FROM `process` WHERE `pid` = :pid;";
+const char *const SelectProcess = "SELECT * FROM `process` WHERE `id` = :id;";
+const char *const SelectRangesOfProcess =
+  "SELECT `r`.`id`, `r`.`from`, `r`.`to`, `r`.`permission`, `s`.`value` AS `name` "
+  "FROM `memory_range` AS `r` JOIN `string` AS `s` ON `s`.`id` = `r`.`name_id` "
+  "WHERE `r`.`process_id` = :process_id;";
+const char *const SelectRangesOfMeasurement =
+  "SELECT `r`.`id`, `r`.`from`, `r`.`to`, `r`.`permission`, `s`.`value` AS `name` "
+  "FROM `memory_range` AS `r` JOIN `string` AS `s` ON `s`.`id` = `r`.`name_id` "
+  "WHERE `r`.`id` IN (SELECT `range_id` FROM `data` WHERE `measurement_id` = :measurement_id);";
+const char *const SelectData = "SELECT * FROM `data` WHERE `measurement_id` = :measurement_id";
+const char *const SelectDataBlob = "SELECT `value` FROM `data_blob` WHERE `measurement_id` = :measurement_id";
+// the same as SelectDataBlob, but it may be used while SelectDataBlob result is decoded
+const char *const SelectReferenceBlob = "SELECT `value` FROM `data_blob` WHERE `measurement_id` = :reference_id";
+const char *const SelectRssPeak =
+  "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `rss_sum` = "
+  "(SELECT MAX(`rss_sum`) FROM `measurement` WHERE `process_id` = :process_id) LIMIT 1;";
+const char *const SelectPssPeak =
+  "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `pss_sum` = "
+  "(SELECT MAX(`pss_sum`) FROM `measurement` WHERE `process_id` = :process_id) LIMIT 1;";
+const char *const SelectStatmPeak =
+  "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `statm_resident` = "
+  "(SELECT MAX(`statm_resident`) FROM `measurement` WHERE `process_id` = :process_id) LIMIT 1;";
+const char *const SelectSystemAtOrBefore =
+  "SELECT * FROM `system_memory` WHERE `time` <= :time ORDER BY `time` DESC LIMIT 1;";
+const char *const SelectSystemAt = "SELECT * FROM `system_memory` WHERE `time` = :time LIMIT 1;";
+const char *const SelectSystemAvailablePeak = "SELECT * FROM `system_memory` ORDER BY `mem_available` ASC LIMIT 1;";
+const char *const SelectSystemComputedPeak =
+  "SELECT * FROM `system_memory` "
+  "ORDER BY (`mem_free` + `buffers` + (`cached` - `shmem`) + `swap_cache` + `s_reclaimable`) ASC LIMIT 1;";
+const char *const SelectSystemProcesses =
+  "SELECT `p`.`pid`, `p`.`start_time`, `p`.`name`, `m`.* "
+  "FROM `measurement` AS `m` JOIN `process` AS `p` ON `p`.id == `m`.`process_id` WHERE `time` == :time";
+const char *const SelectMeasurementAtOrBefore =
+  "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `time` <= :time "
+  "ORDER BY `time` DESC LIMIT 1;";
+const char *const SelectMeasurementAt =
+  "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `time` = :time;";
+const char *const SelectMeasurement = "SELECT * FROM `measurement` WHERE `id` = :id;";
+const char *const SelectProcessTimes =
+  "SELECT `time` FROM `measurement` WHERE `process_id` = :process_id ORDER BY `time`";
+const char *const SelectSystemTimes = "SELECT `time` FROM `system_memory` ORDER BY `time`";
+const char *const SelectFirstSystemTime = "SELECT MIN(`time`) AS `time` FROM `system_memory`";
+// just for recording without system snapshots
+const char *const SelectFirstMeasurementTime = "SELECT MIN(`time`) AS `time` FROM `measurement`";
+const char *const SelectMeasurementExists = "SELECT `id` FROM `measurement` WHERE `id` = :id;";
+// full scan, every measurement is needed
+const char *const SelectAllPeakValues =
+  "SELECT `id`, `process_id`, `rss_sum`, `pss_sum`, `statm_resident` FROM `measurement`";
+// rows of one measurement follow each other, they are ordered by data primary key
+const char *const SelectMeasurementSeries =
+  "SELECT `m`.*, `d`.`range_id`, `d`.`rss`, `d`.`pss`, `b`.`value` AS `blob` FROM `measurement` AS `m` "
+  "LEFT JOIN `data` AS `d` ON `d`.`measurement_id` = `m`.`id` "
+  "LEFT JOIN `data_blob` AS `b` ON `b`.`measurement_id` = `m`.`id` "
+  "WHERE `m`.`process_id` = :process_id AND `m`.`time` >= :from AND `m`.`time` <= :to "
+  "ORDER BY `m`.`time`";
+// series of schema without data_blob table
+const char *const SelectMeasurementSeriesV3 =
+  "SELECT `m`.*, `d`.`range_id`, `d`.`rss`, `d`.`pss` FROM `measurement` AS `m` "
+  "LEFT JOIN `data` AS `d` ON `d`.`measurement_id` = `m`.`id` "
+  "WHERE `m`.`process_id` = :process_id AND `m`.`time` >= :from AND `m`.`time` <= :to "
+  "ORDER BY `m`.`time`";
+// rows of deltas of the keyframe up to the time, they are applied to keyframe data in time order
+const char *const SelectDeltas =
+  "SELECT `d`.`range_id`, `d`.`rss`, `d`.`pss` FROM `measurement` AS `m` "
+  "JOIN `data` AS `d` ON `d`.`measurement_id` = `m`.`id` "
+  "WHERE `m`.`keyframe_id` = :keyframe_id AND `m`.`time` <= :time "
+  "ORDER BY `m`.`time`";
+// blobs of deltas of the keyframe up to the time, see SelectDeltas
+const char *const SelectDeltaBlobs =
+  "SELECT `b`.`value` FROM `measurement` AS `m` "
+  "JOIN `data_blob` AS `b` ON `b`.`measurement_id` = `m`.`id` "
+  "WHERE `m`.`keyframe_id` = :keyframe_id AND `m`.`time` <= :time "
+  "ORDER BY `m`.`time`";
+
+// all rows of one measurement in single value, see DataBlob
+const char *const CreateDataBlob =
+  "CREATE TABLE `data_blob` ("
+  "  `measurement_id` INTEGER PRIMARY KEY REFERENCES measurement(id) ON DELETE CASCADE,"
+  "  `value` BLOB NOT NULL"
+  ");";
+
+// rss of delta row for range that disappeared since previous measurement
+constexpr qlonglong RemovedRange = -1;
+
+MeasurementData dataRow(const SmapsRange &range)
+{
+  return MeasurementData{qlonglong(range.key.hash()), qlonglong(range.rss), qlonglong(range.pss)};
+}
 
-    QString sql("CREATE TABLE `memory_range`");
-    sql.append("(").append( "`id` UNSIGNED BIG INT PRIMARY KEY "); // hash of process_id, from, to and permission columns
-    sql.append(",").append( "`process_id` UNSIGNED BIG INT NOT NULL REFERENCES process(id) ON DELETE CASCADE ");
-    sql.append(",").append( "`from` INTEGER NOT NULL ");
-    sql.append(",").append( "`to` INTEGER NOT NULL ");
-    sql.append(",").append( "`permission` varchar(255) NULL ");
-    sql.append(",").append( "`name` varchar(255) NULL ");
-    sql.append(");");
+const MeasurementData &dataRow(const MeasurementData &row)
+{
+  return row;
+}
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()) {
-      qWarning() << "Creating table memory_range failed" << q.lastError();
-      db.close();
-      return false;
-    }
+void applyDelta(QMap<qlonglong, MeasurementData> &data, const MeasurementData &row)
+{
+  if (row.rss == RemovedRange) {
+    data.remove(row.rangeId);
+  } else {
+    data.insert(row.rangeId, row);
   }
+}
 
-  if (!tables.contains("measurement")) {
+struct Index {
+  const char *name;
+  const char *v1; //!< table and columns in schema v1, nullptr when it is not needed
+  const char *v2; //!< table and columns in schema v2, nullptr when it is not needed
+  int minVersion{1}; //!< index is not created for older schema, it uses columns added later
+  bool unique{false}; //!< unique in schema v2
+};
+
+// indexes used by analysis queries, they are created with the schema, recordings
+// created before are indexed when analysis tool opens them first time
+const Index AnalysisIndexes[] = {
+  {"idx_process_pid",
+   "`process`(`pid`, `start_time`, `name`)",
+   "`process`(`pid`, `start_time`, `name`)"},
+  {"idx_memory_range_process_id",
+   "`memory_range`(`process_id`)",
+   "`memory_range`(`process_id`, `from`, `to`, `permission`, `name_id`)"},
+  {"idx_measurement_process_time", // single measurement of process per time, id doesn't ensure it in v2
+   "`measurement`(`process_id`, `time`)",
+   "`measurement`(`process_id`, `time`)",
+   1,
+   true},
+  {"idx_measurement_time",
+   "`measurement`(`time`)",
+   "`measurement`(`time`)"},
+  {"idx_measurement_process_rss",
+   "`measurement`(`process_id`, `rss_sum`)",
+   "`measurement`(`process_id`, `rss_sum`)"},
+  {"idx_measurement_process_pss",
+   "`measurement`(`process_id`, `pss_sum`)",
+   "`measurement`(`process_id`, `pss_sum`)"},
+  {"idx_measurement_process_statm",
+   "`measurement`(`process_id`, `statm_resident`)",
+   "`measurement`(`process_id`, `statm_resident`)"},
+  {"idx_system_memory_time", // time is primary key in v2
+   "`system_memory`(`time`)",
+   nullptr},
+  {"idx_system_memory_available",
+   "`system_memory`(`mem_available`)",
+   "`system_memory`(`mem_available`)"},
+  {"idx_system_memory_available_computed",
+   "`system_memory`((`mem_free` + `buffers` + (`cached` - `shmem`) + `swap_cache` + `s_reclaimable`))",
+   "`system_memory`((`mem_free` + `buffers` + (`cached` - `shmem`) + `swap_cache` + `s_reclaimable`))"},
+  {"idx_measurement_keyframe", // deltas of keyframe in time order, seek doesn't depend on recording length
+   nullptr,
+   "`measurement`(`keyframe_id`, `time`) WHERE `keyframe_id` IS NOT NULL",
+   3},
+};
+
+/** Statement creating the index for given schema version, empty when it is not used by the version */
+QString createIndexStatement(const Index &index, int version)
+{
+  const char *definition = version >= 2 ? index.v2 : index.v1;
+  if (definition == nullptr || version < index.minVersion) {
+    return QString();
+  }
+  return QString("CREATE %1INDEX IF NOT EXISTS `%2` ON %3;")
+    .arg(index.unique && version >= 2 ? "UNIQUE " : "", index.name, definition);
+}
 
-    QString sql("CREATE TABLE `measurement`");
-    sql.append("(").append( "`id` UNSIGNED BIG INT PRIMARY KEY "); // hash of process_id and time
-    sql.append(",").append( "`process_id` UNSIGNED BIG INT NOT NULL REFERENCES process(id) ON DELETE CASCADE ");
-    sql.append(",").append( "`time` datetime NOT NULL ");
-    sql.append(",").append( "`rss_sum` INTEGER NOT NULL ");
-    sql.append(",").append( "`pss_sum` INTEGER NOT NULL ");
+/** Finish cached query on scope exit, so it doesn't keep read transaction of the connection open */
+class QueryFinisher {
+  Q_DISABLE_COPY_MOVE(QueryFinisher)
+public:
+  explicit QueryFinisher(QSqlQuery &query):
+    query(query)
+  {}
+
+  ~QueryFinisher()
+  {
+    query.finish();
+  }
 
-    sql.append(",").append( "`oom_adj` INTEGER NOT NULL ");
-    sql.append(",").append( "`oom_score` INTEGER NOT NULL ");
-    sql.append(",").append( "`oom_score_adj` INTEGER NOT NULL ");
+private:
+  QSqlQuery &query;
+};
+
+/** Reset native statement on scope exit, the same as QueryFinisher does for QSqlQuery */
+class StatementResetter {
+  Q_DISABLE_COPY_MOVE(StatementResetter)
+public:
+  explicit StatementResetter(SqliteStatement &statement):
+    statement(statement)
+  {}
+
+  ~StatementResetter()
+  {
+    statement.reset();
+  }
 
-    sql.append(",").append( "`statm_size` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_resident` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_shared` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_text` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_lib` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_data` INTEGER NOT NULL ");
-    sql.append(",").append( "`statm_dt` INTEGER NOT NULL ");
+private:
+  SqliteStatement &statement;
+};
+
+// columns decoded by native reads, their indexes in the result are resolved once per statement
+enum MeasurementColumn {
+  MeasurementId, MeasurementProcessId, MeasurementTime, MeasurementSampleType, MeasurementRssSum,
+  MeasurementPssSum, MeasurementOomAdj, MeasurementOomScore, MeasurementOomScoreAdj, MeasurementStatmSize,
+  MeasurementStatmResident, MeasurementStatmShared, MeasurementStatmText, MeasurementStatmLib,
+  MeasurementStatmData, MeasurementStatmDt, MeasurementKeyframeId,
+  MeasurementPid, MeasurementProcessName // just in SelectSystemProcesses
+};
+const std::vector<const char*> MeasurementColumns{
+  "id", "process_id", "time", "sample_type", "rss_sum",
+  "pss_sum", "oom_adj", "oom_score", "oom_score_adj", "statm_size",
+  "statm_resident", "statm_shared", "statm_text", "statm_lib",
+  "statm_data", "statm_dt", "keyframe_id",
+  "pid", "name"
+};
+
+enum SeriesColumn {
+  SeriesRangeId = MeasurementProcessName + 1, SeriesRss, SeriesPss, SeriesBlob
+};
+std::vector<const char*> seriesColumns()
+{
+  std::vector<const char*> columns = MeasurementColumns;
+  columns.insert(columns.end(), {"range_id", "rss", "pss", "blob"});
+  return columns;
+}
 
-    sql.append(");");
+enum RangeColumn {
+  RangeId, RangeFrom, RangeTo, RangePermission, RangeName
+};
+const std::vector<const char*> RangeColumns{"id", "from", "to", "permission", "name"};
+
+enum DataColumn {
+  DataRangeId, DataRss, DataPss
+};
+const std::vector<const char*> DataColumns{"range_id", "rss", "pss"};
+
+const std::vector<const char*> BlobColumns{"value"};
+
+enum ProcessColumn {
+  ProcessPid, ProcessName
+};
+const std::vector<const char*> ProcessColumns{"pid", "name"};
+
+enum SystemMemoryColumn {
+  SystemTime, SystemMemTotal, SystemMemFree, SystemMemAvailable, SystemBuffers, SystemCached,
+  SystemSwapCache, SystemSwapTotal, SystemSwapFree, SystemAnonPages, SystemMapped, SystemShmem,
+  SystemSlab, SystemSReclaimable
+};
+const std::vector<const char*> SystemMemoryColumns{
+  "time", "mem_total", "mem_free", "mem_available", "buffers", "cached",
+  "swap_cache", "swap_total", "swap_free", "anon_pages", "mapped", "shmem",
+  "slab", "s_reclaimable"
+};
+
+const std::vector<const char*> TimeColumns{"time"};
+
+// every instance has own connection, storage may be used from multiple threads
+QString uniqueConnectionName() {
+  static std::atomic_int counter{0};
+  return QString("storage-%1").arg(counter++);
+}
 
-    QSqlQuery q = db.exec(sql);
-    if (q.lastError().isValid()) {
-      qWarning() << "Creating measurement table failed" << q.lastError();
+} // namespace
+
+Storage::~Storage()
+{
+  // statements have to be finalized before the database connection is closed
+  for (SqliteStatement *statement: {&nativeProcessInsert, &nativeRangeInsert, &nativeMeasurementInsert,
+                                    &nativeDataInsert, &nativeDataBulkInsert, &nativeDataBlobInsert, &nativeSystemInsert,
+                                    &nativeRecorderStatsInsert}) {
+    statement->finalize();
+  }
+  // queries keep the connection in use
+  for (QSqlQuery *query: {&sqlProcessInsert, &sqlRangeInsert, &sqlMeasurementInsert,
+                          &sqlDataInsert, &sqlDataBlobInsert, &sqlSystemInsert, &sqlRecorderStatsInsert,
+                          &sqlStringInsert, &sqlStringSelect}) {
+    *query = QSqlQuery();
+  }
+  readQueries.clear();
+  nativeQueries.clear();
+  if (db.isValid()) {
+    if (db.isOpen()) {
       db.close();
-      return false;
     }
+    db = QSqlDatabase(); // invalidate instance
+    QSqlDatabase::removeDatabase(connectionName);
   }
+  qDebug() << "Storage is closed";
+}
 
-  if (!tables.contains("data")) {
+bool Storage::readSchemaVersion()
+{
+  QSqlQuery q = db.exec("PRAGMA user_version;");
+  if (q.lastError().isValid() || !q.next()) {
+    qWarning() << "Reading schema version failed" << q.lastError();
+    return false;
+  }
+  version = int(varToLong(q.value(0), 0));
+  if (version == 0 && db.tables().contains("measurement")) {
+    // created before schema versioning
+    version = 1;
+  }
+  return true;
+}
 
-    QString sql("CREATE TABLE `data`");
-    sql.append("(").append( "`range_id` UNSIGNED BIG INT NOT NULL REFERENCES memory_range(id) ON DELETE CASCADE");
-    sql.append(",").append( "`measurement_id` UNSIGNED BIG INT NOT NULL REFERENCES measurement(id) ON DELETE CASCADE");
-    sql.append(",").append( "`rss` INTEGER NOT NULL ");
-    sql.append(",").append( "`pss` INTEGER NOT NULL ");
-    sql.append(");");
+bool Storage::updateSchema()
+{
+  if (version == 0) {
+    return createSchema();
+  }
+  if (version >= 2 && version < SchemaVersion) {
+    return upgradeSchema();
+  }
+  if (version < SchemaVersion) {
+    qWarning() << "Database has schema version" << version << ", it is possible to read it,"
+               << "but it has to be converted by memory-migrate tool before writing";
+    return false;
+  }
+  if (version > SchemaVersion) {
+    qWarning() << "Database has unknown schema version" << version;
+    return false;
+  }
+  return true;
+}
 
-    //
+bool Storage::createSchema()
+{
+  QStringList statements{
+    "CREATE TABLE `process` ("
+    "  `id` INTEGER PRIMARY KEY," // hash of pid and start_time
+    "  `pid` INTEGER NOT NULL," // system process id
+    "  `start_time` INTEGER NOT NULL," // from /proc/<pid>/stat
+    "  `name` varchar(255) NULL"
+    ");",
+
+    // names of memory ranges, the same names are used by many processes
+    "CREATE TABLE `string` ("
+    "  `id` INTEGER PRIMARY KEY,"
+    "  `value` TEXT NOT NULL UNIQUE"
+    ");",
+
+    "CREATE TABLE `memory_range` ("
+    "  `id` INTEGER PRIMARY KEY," // hash of process_id, from, to and permission columns
+    "  `process_id` INTEGER NOT NULL REFERENCES process(id) ON DELETE CASCADE,"
+    "  `from` INTEGER NOT NULL,"
+    "  `to` INTEGER NOT NULL,"
+    "  `permission` INTEGER NOT NULL," // SmapsRange::PermissionFlag
+    "  `name_id` INTEGER NOT NULL REFERENCES string(id)"
+    ");",
+
+    "CREATE TABLE `measurement` ("
+    "  `id` INTEGER PRIMARY KEY," // grows with time, see Storage::nextMeasurementId
+    "  `process_id` INTEGER NOT NULL REFERENCES process(id) ON DELETE CASCADE,"
+    "  `time` INTEGER NOT NULL," // milliseconds since epoch
+    "  `sample_type` INTEGER NOT NULL DEFAULT 0," // SampleType
+    "  `rss_sum` INTEGER NOT NULL,"
+    "  `pss_sum` INTEGER NOT NULL,"
+    "  `oom_adj` INTEGER NOT NULL,"
+    "  `oom_score` INTEGER NOT NULL,"
+    "  `oom_score_adj` INTEGER NOT NULL,"
+    "  `statm_size` INTEGER NOT NULL,"
+    "  `statm_resident` INTEGER NOT NULL,"
+    "  `statm_shared` INTEGER NOT NULL,"
+    "  `statm_text` INTEGER NOT NULL,"
+    "  `statm_lib` INTEGER NOT NULL,"
+    "  `statm_data` INTEGER NOT NULL,"
+    "  `statm_dt` INTEGER NOT NULL,"
+    "  `keyframe_id` INTEGER NULL" // measurement with all ranges, null for keyframe and full recording
+    ");",
+
+    // rows of one measurement are stored together, without rowid and extra index
+    "CREATE TABLE `data` ("
+    "  `measurement_id` INTEGER NOT NULL REFERENCES measurement(id) ON DELETE CASCADE,"
+    "  `range_id` INTEGER NOT NULL REFERENCES memory_range(id) ON DELETE CASCADE,"
+    "  `rss` INTEGER NOT NULL,"
+    "  `pss` INTEGER NOT NULL,"
+    "  PRIMARY KEY (`measurement_id`, `range_id`)"
+    ") WITHOUT ROWID;",
+
+    CreateDataBlob,
+
+    "CREATE TABLE `system_memory` ("
+    "  `time` INTEGER PRIMARY KEY," // milliseconds since epoch
+    "  `mem_total` INTEGER NOT NULL,"
+    "  `mem_free` INTEGER NOT NULL,"
+    "  `mem_available` INTEGER NOT NULL,"
+    "  `buffers` INTEGER NOT NULL,"
+    "  `cached` INTEGER NOT NULL,"
+    "  `swap_cache` INTEGER NOT NULL,"
+    "  `swap_total` INTEGER NOT NULL,"
+    "  `swap_free` INTEGER NOT NULL,"
+    "  `anon_pages` INTEGER NOT NULL,"
+    "  `mapped` INTEGER NOT NULL,"
+    "  `shmem` INTEGER NOT NULL,"
+    "  `slab` INTEGER NOT NULL,"
+    "  `s_reclaimable` INTEGER NOT NULL"
+    ");",
+
+    "CREATE TABLE `recorder_stats` ("
+    "  `time` INTEGER NOT NULL," // milliseconds since epoch
+    "  `name` varchar(255) NOT NULL,"
+    "  `value` INTEGER NOT NULL"
+    ");",
+
+    QString("PRAGMA user_version = %1;").arg(SchemaVersion)
+  };
+
+  // single row per process and tick is indexed, data rows are ordered by primary key,
+  // so recorder is not slowed down and analysis tools don't need to create indexes
+  // while the recording is in progress
+  for (const Index &index: AnalysisIndexes) {
+    if (QString sql = createIndexStatement(index, SchemaVersion); !sql.isEmpty()) {
+      statements << sql;
+    }
+  }
 
+  if (!db.transaction()) {
+    qWarning() << "Begin of schema transaction failed" << db.lastError();
+    return false;
+  }
+  for (const QString &sql: statements) {
     QSqlQuery q = db.exec(sql);
     if (q.lastError().isValid()) {
-      qWarning() << "Creating data table failed" << q.lastError();
-      db.close();
-      return false;
-    }
-
-    QSqlQuery q2 = db.exec("CREATE INDEX idx_data_measurement_id ON data(measurement_id);");
-    if (q2.lastError().isValid()) {
-      qWarning() << "Creating data index failed" << q2.lastError();
+      qWarning() << "Creating schema failed" << sql << q.lastError();
+      db.rollback();
       db.close();
       return false;
     }
   }
+  if (!db.commit()) {
+    qWarning() << "Commit of schema failed" << db.lastError();
+    db.close();
+    return false;
+  }
+  version = SchemaVersion;
+  return true;
+}
 
-  if (!tables.contains("system_memory")) {
-    QString sql("CREATE TABLE `system_memory`");
-    sql.append("(").append("`time` datetime NOT NULL ");
-    sql.append(",").append("`mem_total` INTEGER NOT NULL ");
-    sql.append(",").append("`mem_free` INTEGER NOT NULL ");
-    sql.append(",").append("`mem_available` INTEGER NOT NULL ");
-    sql.append(",").append("`buffers` INTEGER NOT NULL ");
-    sql.append(",").append("`cached` INTEGER NOT NULL ");
-    sql.append(",").append("`swap_cache` INTEGER NOT NULL ");
-    sql.append(",").append("`swap_total` INTEGER NOT NULL ");
-    sql.append(",").append("`swap_free` INTEGER NOT NULL ");
-    sql.append(",").append("`anon_pages` INTEGER NOT NULL ");
-    sql.append(",").append("`mapped` INTEGER NOT NULL ");
-    sql.append(",").append("`shmem` INTEGER NOT NULL ");
-    sql.append(",").append("`slab` INTEGER NOT NULL ");
-    sql.append(",").append("`s_reclaimable` INTEGER NOT NULL ");
-
-    sql.append(");");
+bool Storage::upgradeSchema()
+{
+  QStringList statements;
+  if (version < 3) {
+    // v3 just adds column, existing measurements are full
+    statements << "ALTER TABLE `measurement` ADD COLUMN `keyframe_id` INTEGER NULL;";
+  }
+  if (version < 4) {
+    // v4 adds table, existing measurements have data rows
+    statements << CreateDataBlob;
+  }
+  statements << QString("PRAGMA user_version = %1;").arg(SchemaVersion);
 
+  if (!db.transaction()) {
+    qWarning() << "Begin of schema upgrade failed" << db.lastError();
+    return false;
+  }
+  for (const QString &sql: statements) {
     QSqlQuery q = db.exec(sql);
     if (q.lastError().isValid()) {
-      qWarning() << "Creating data table failed" << q.lastError();
-      db.close();
+      qWarning() << "Upgrading schema failed" << sql << q.lastError();
+      db.rollback();
       return false;
     }
   }
-
+  if (!db.commit()) {
+    qWarning() << "Commit of schema upgrade failed" << db.lastError();
+    return false;
+  }
+  qDebug() << "Schema upgraded from version" << version << "to" << SchemaVersion;
+  version = SchemaVersion;
   return true;
 }
 
-bool Storage::init(QString file)
+bool Storage::init(QString file, StorageMode mode)
 {
   // Find QSLite driver
-  db = QSqlDatabase::addDatabase("QSQLITE", "storage");
+  connectionName = uniqueConnectionName();
+  db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
   if (!db.isValid()){
     qWarning() << "Could not find QSQLITE backend";
     return false;
   }
 
   db.setDatabaseName(file);
+  if (mode == StorageMode::ReadOnly) {
+    db.setConnectOptions("QSQLITE_OPEN_READONLY");
+  }
   if (!db.open()){
     qWarning() << "Open database failed" << db.lastError();
     return false;
   }
   qDebug() << "Storage database opened:" << file;
 
-  // following pragmas speed up operations a bit, but are dangerous
-  // https://stackoverflow.com/questions/1711631/improve-insert-per-second-performance-of-sqlite
-  if (QSqlQuery q = db.exec("PRAGMA synchronous = OFF;");
-      q.lastError().isValid()){
-    qWarning() << "Setup synchronous writes fails:" << q.lastError();
+  if (!readSchemaVersion()) {
+    return false;
   }
 
-  if (QSqlQuery q = db.exec("PRAGMA journal_mode = MEMORY;");
-      q.lastError().isValid()){
-    qWarning() << "Setup memory journal fails:" << q.lastError();
+  if (mode == StorageMode::Fast) {
+    // following pragmas speed up operations a bit, but are dangerous
+    // https://stackoverflow.com/questions/1711631/improve-insert-per-second-performance-of-sqlite
+    if (QSqlQuery q = db.exec("PRAGMA synchronous = OFF;");
+        q.lastError().isValid()){
+      qWarning() << "Setup synchronous writes fails:" << q.lastError();
+    }
+
+    if (QSqlQuery q = db.exec("PRAGMA journal_mode = MEMORY;");
+        q.lastError().isValid()){
+      qWarning() << "Setup memory journal fails:" << q.lastError();
+    }
+  } else if (mode == StorageMode::Wal) {
+    // with write-ahead log, normal synchronous mode is safe against corruption,
+    // transactions are not synced on commit, just on checkpoint
+    if (QSqlQuery q = db.exec("PRAGMA journal_mode = WAL;");
+        q.lastError().isValid() || !q.next() || q.value(0).toString().toLower() != "wal"){
+      qWarning() << "Setup write-ahead log fails:" << q.lastError();
+      return false;
+    }
+
+    if (QSqlQuery q = db.exec("PRAGMA synchronous = NORMAL;");
+        q.lastError().isValid()){
+      qWarning() << "Setup synchronous writes fails:" << q.lastError();
+    }
+
+    // checkpoints are done by another connection, writer is not blocked by them
+    if (QSqlQuery q = db.exec("PRAGMA wal_autocheckpoint = 0;");
+        q.lastError().isValid()){
+      qWarning() << "Disabling automatic checkpoints fails:" << q.lastError();
+    }
+
+    // writer rewinds the log after complete checkpoint, the log file is truncated then,
+    // so its size is the size of frames written since the last complete checkpoint
+    if (QSqlQuery q = db.exec("PRAGMA journal_size_limit = 0;");
+        q.lastError().isValid()){
+      qWarning() << "Setup of journal size limit fails:" << q.lastError();
+    }
+  }
+
+  if (mode == StorageMode::ReadOnly) {
+    // schema can't be created, just reads are possible
+    nativeReads = version >= 2 && initNativeHandle();
+    return true;
   }
 
   if (!updateSchema()){
@@ -208,36 +621,311 @@ bool Storage::init(QString file)
     sqlProcessInsert = QSqlQuery(db);
     sqlProcessInsert.prepare("INSERT OR IGNORE INTO `process` (`id`, `pid`, `start_time`, `name`) VALUES (:id, :pid, :start_time, :name)");
 
+    sqlStringInsert = QSqlQuery(db);
+    sqlStringInsert.prepare("INSERT OR IGNORE INTO `string` (`value`) VALUES (:value)");
+
+    sqlStringSelect = QSqlQuery(db);
+    sqlStringSelect.prepare("SELECT `id` FROM `string` WHERE `value` = :value");
+
     sqlRangeInsert = QSqlQuery(db);
-    sqlRangeInsert.prepare("INSERT OR IGNORE INTO `memory_range` (`id`, `process_id`, `from`, `to`, `permission`, `name`) VALUES (:id, :process_id, :from, :to, :permission, :name)");
+    sqlRangeInsert.prepare("INSERT OR IGNORE INTO `memory_range` (`id`, `process_id`, `from`, `to`, `permission`, `name_id`) VALUES (:id, :process_id, :from, :to, :permission, :name_id)");
 
     sqlMeasurementInsert = QSqlQuery(db);
     sqlMeasurementInsert.prepare("INSERT INTO `measurement` ("
-                                 "  `id`, `process_id`, `time`, `rss_sum`, `pss_sum`,"
+                                 "  `id`, `process_id`, `time`, `sample_type`, `rss_sum`, `pss_sum`,"
                                  "  `oom_adj`, `oom_score`, `oom_score_adj`, "
-                                 "  `statm_size`, `statm_resident`, `statm_shared`, `statm_text`, `statm_lib`, `statm_data`, `statm_dt` "
+                                 "  `statm_size`, `statm_resident`, `statm_shared`, `statm_text`, `statm_lib`, `statm_data`, `statm_dt`, "
+                                 "  `keyframe_id` "
                                  ") VALUES ("
-                                 "  :id, :process_id, :time, :rss, :pss, "
+                                 "  :id, :process_id, :time, :sample_type, :rss, :pss, "
                                  "  :oom_adj, :oom_score, :oom_score_adj, "
-                                 "  :statm_size, :statm_resident, :statm_shared, :statm_text, :statm_lib, :statm_data, :statm_dt"
+                                 "  :statm_size, :statm_resident, :statm_shared, :statm_text, :statm_lib, :statm_data, :statm_dt, "
+                                 "  :keyframe_id"
                                  ")");
 
     sqlDataInsert = QSqlQuery(db);
-    sqlDataInsert.prepare("INSERT INTO `data` (`range_id`, `measurement_id`, `rss`, `pss`) VALUES (:range_id, :measurement_id, :rss, :pss)");
+    sqlDataInsert.prepare("INSERT OR IGNORE INTO `data` (`measurement_id`, `range_id`, `rss`, `pss`) VALUES (:measurement_id, :range_id, :rss, :pss)");
+
+    sqlDataBlobInsert = QSqlQuery(db);
+    sqlDataBlobInsert.prepare("INSERT OR IGNORE INTO `data_blob` (`measurement_id`, `value`) VALUES (:measurement_id, :value)");
 
     sqlSystemInsert = QSqlQuery(db);
     sqlSystemInsert.prepare("INSERT INTO `system_memory` (`time`, `mem_total`, `mem_free`, `mem_available`, `buffers`, `cached`, `swap_cache`, "
                             "   `swap_total`, `swap_free`, `anon_pages`, `mapped`, `shmem`, `slab`, `s_reclaimable`"
                             ") VALUES (:time, :mem_total, :mem_free, :mem_available, :buffers, :cached, :swap_cache, "
                             "   :swap_total, :swap_free, :anon_pages, :mapped, :shmem, :slab, :s_reclaimable)");
+
+    sqlRecorderStatsInsert = QSqlQuery(db);
+    sqlRecorderStatsInsert.prepare("INSERT INTO `recorder_stats` (`time`, `name`, `value`) VALUES (:time, :name, :value)");
+  }
+  if (valid && initNativeHandle()) {
+    nativeAvailable = initNativeWrites();
+    nativeWrites = nativeAvailable;
+    nativeReads = version >= 2;
   }
   return valid;
 }
 
+bool Storage::initNativeHandle()
+{
+  QVariant driverHandle = db.driver()->handle();
+  if (!driverHandle.isValid() || qstrcmp(driverHandle.typeName(), "sqlite3*") != 0) {
+    qWarning() << "Can't get sqlite3 handle from database driver, native reads and writes are disabled";
+    return false;
+  }
+  handle = *static_cast<sqlite3 **>(driverHandle.data());
+  if (handle == nullptr) {
+    return false;
+  }
+
+  // QSQLITE driver may be built with its own copy of sqlite
+  QSqlQuery versionQuery = db.exec("SELECT sqlite_version();");
+  if (!versionQuery.next() || versionQuery.value(0).toString() != QLatin1String(sqlite3_libversion())) {
+    qWarning() << "Database driver uses different sqlite library than" << sqlite3_libversion() <<
+               ", native reads and writes are disabled";
+    handle = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool Storage::initNativeWrites()
+{
+  QString dataBulkSql("INSERT OR IGNORE INTO `data` (`measurement_id`, `range_id`, `rss`, `pss`) VALUES ");
+  for (int i = 0; i < DataRowsPerStatement; i++) {
+    dataBulkSql.append(i == 0 ? "(?, ?, ?, ?)" : ", (?, ?, ?, ?)");
+  }
+
+  return nativeProcessInsert.prepare(handle, "INSERT OR IGNORE INTO `process` (`id`, `pid`, `start_time`, `name`) VALUES (?, ?, ?, ?)") &&
+    nativeRangeInsert.prepare(handle, "INSERT OR IGNORE INTO `memory_range` (`id`, `process_id`, `from`, `to`, `permission`, `name_id`) VALUES (?, ?, ?, ?, ?, ?)") &&
+    nativeMeasurementInsert.prepare(handle, "INSERT INTO `measurement` ("
+                                            "  `id`, `process_id`, `time`, `sample_type`, `rss_sum`, `pss_sum`,"
+                                            "  `oom_adj`, `oom_score`, `oom_score_adj`, "
+                                            "  `statm_size`, `statm_resident`, `statm_shared`, `statm_text`, `statm_lib`, `statm_data`, `statm_dt`, "
+                                            "  `keyframe_id` "
+                                            ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)") &&
+    nativeDataInsert.prepare(handle, "INSERT OR IGNORE INTO `data` (`measurement_id`, `range_id`, `rss`, `pss`) VALUES (?, ?, ?, ?)") &&
+    nativeDataBulkInsert.prepare(handle, dataBulkSql) &&
+    nativeDataBlobInsert.prepare(handle, "INSERT OR IGNORE INTO `data_blob` (`measurement_id`, `value`) VALUES (?, ?)") &&
+    nativeSystemInsert.prepare(handle, "INSERT INTO `system_memory` (`time`, `mem_total`, `mem_free`, `mem_available`, `buffers`, `cached`, `swap_cache`, "
+                                       "   `swap_total`, `swap_free`, `anon_pages`, `mapped`, `shmem`, `slab`, `s_reclaimable`"
+                                       ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)") &&
+    nativeRecorderStatsInsert.prepare(handle, "INSERT INTO `recorder_stats` (`time`, `name`, `value`) VALUES (?, ?, ?)");
+}
+
+bool Storage::importV1(const QString &file)
+{
+  if (version != SchemaVersion) {
+    qWarning() << "Recording may be imported just to database with schema" << SchemaVersion;
+    return false;
+  }
+
+  // ranges may be referenced by data when their hashes collided in v1,
+  // foreign keys can't be disabled inside transaction
+  db.exec("PRAGMA foreign_keys = OFF;");
+  QSqlQuery attach(db);
+  attach.prepare("ATTACH DATABASE :file AS `v1`;");
+  attach.bindValue(":file", file);
+  if (!attach.exec()) {
+    qWarning() << "Attaching database" << file << "failed" << attach.lastError();
+    db.exec("PRAGMA foreign_keys = ON;");
+    return false;
+  }
+
+  // older recordings don't contain all tables and columns
+  QStringList tables;
+  QSqlQuery tablesQuery = db.exec("SELECT `name` FROM `v1`.`sqlite_master` WHERE `type` = 'table';");
+  while (tablesQuery.next()) {
+    tables << varToString(tablesQuery.value(0));
+  }
+  bool hasSampleType = false;
+  QSqlQuery columnsQuery = db.exec("PRAGMA `v1`.table_info(`measurement`);");
+  while (columnsQuery.next()) {
+    hasSampleType |= varToString(columnsQuery.value("name")) == "sample_type";
+  }
+
+  QStringList statements;
+  for (const QString &table: {"process", "memory_range", "measurement", "data"}) {
+    if (!tables.contains(table)) {
+      qWarning() << "Table" << table << "is missing in" << file;
+      db.exec("DETACH DATABASE `v1`;");
+      db.exec("PRAGMA foreign_keys = ON;");
+      return false;
+    }
+  }
+  statements << QString("INSERT OR IGNORE INTO `process` (`id`, `pid`, `start_time`, `name`) "
+                        "SELECT %1, `pid`, COALESCE(`start_time`, 0), `name` FROM `v1`.`process`;")
+                  .arg(v1Id("`id`"));
+  statements << "INSERT OR IGNORE INTO `string` (`value`) "
+                "SELECT DISTINCT COALESCE(`name`, '') FROM `v1`.`memory_range`;";
+  statements << QString("INSERT OR IGNORE INTO `memory_range` (`id`, `process_id`, `from`, `to`, `permission`, `name_id`) "
+                        "SELECT %1, %2, `r`.`from`, `r`.`to`, %3, `s`.`id` FROM `v1`.`memory_range` AS `r` "
+                        "JOIN `string` AS `s` ON `s`.`value` = COALESCE(`r`.`name`, '');")
+                  .arg(v1Id("`r`.`id`"), v1Id("`r`.`process_id`"), v1Permission("`r`.`permission`"));
+  statements << QString("INSERT OR IGNORE INTO `measurement` ("
+                        "  `id`, `process_id`, `time`, `sample_type`, `rss_sum`, `pss_sum`,"
+                        "  `oom_adj`, `oom_score`, `oom_score_adj`, "
+                        "  `statm_size`, `statm_resident`, `statm_shared`, `statm_text`, `statm_lib`, `statm_data`, `statm_dt` "
+                        ") SELECT `id`, %1, %2, %3, `rss_sum`, `pss_sum`,"
+                        "  `oom_adj`, `oom_score`, `oom_score_adj`, "
+                        "  `statm_size`, `statm_resident`, `statm_shared`, `statm_text`, `statm_lib`, `statm_data`, `statm_dt` "
+                        "FROM `v1`.`measurement`;")
+                  .arg(v1Id("`process_id`"), v1Time("`time`"), hasSampleType ? "`sample_type`" : "0");
+  // sorted rows are appended to the end of data table
+  statements << QString("INSERT OR IGNORE INTO `data` (`measurement_id`, `range_id`, `rss`, `pss`) "
+                        "SELECT `measurement_id`, %1, `rss`, `pss` FROM `v1`.`data` ORDER BY 1, 2;")
+                  .arg(v1Id("`range_id`"));
+  if (tables.contains("system_memory")) {
+    statements << QString("INSERT OR REPLACE INTO `system_memory` (`time`, `mem_total`, `mem_free`, `mem_available`, "
+                          "  `buffers`, `cached`, `swap_cache`, `swap_total`, `swap_free`, `anon_pages`, `mapped`, "
+                          "  `shmem`, `slab`, `s_reclaimable`"
+                          ") SELECT %1, `mem_total`, `mem_free`, `mem_available`, "
+                          "  `buffers`, `cached`, `swap_cache`, `swap_total`, `swap_free`, `anon_pages`, `mapped`, "
+                          "  `shmem`, `slab`, `s_reclaimable` "
+                          "FROM `v1`.`system_memory`;")
+                    .arg(v1Time("`time`"));
+  }
+  if (tables.contains("recorder_stats")) {
+    statements << QString("INSERT INTO `recorder_stats` (`time`, `name`, `value`) "
+                          "SELECT %1, `name`, `value` FROM `v1`.`recorder_stats`;")
+                    .arg(v1Time("`time`"));
+  }
+
+  bool result = db.transaction();
+  for (const QString &sql: statements) {
+    if (!result) {
+      break;
+    }
+    QSqlQuery q = db.exec(sql);
+    if (q.lastError().isValid()) {
+      qWarning() << "Import failed" << sql << q.lastError();
+      result = false;
+    }
+  }
+  if (result) {
+    result = db.commit();
+  } else {
+    db.rollback();
+  }
+  stringIds.clear();
+
+  db.exec("DETACH DATABASE `v1`;");
+  db.exec("PRAGMA foreign_keys = ON;");
+  return result;
+}
+
+bool Storage::checkpoint(int &walFrames, int &checkpointedFrames, bool &busy)
+{
+  QSqlQuery q = db.exec("PRAGMA wal_checkpoint(PASSIVE);");
+  if (q.lastError().isValid() || !q.next()) {
+    qWarning() << "Checkpoint fails:" << q.lastError();
+    return false;
+  }
+  busy = q.value(0).toInt() != 0;
+  walFrames = q.value(1).toInt();
+  checkpointedFrames = q.value(2).toInt();
+  return true;
+}
+
+bool Storage::setNativeWrites(bool enabled)
+{
+  nativeWrites = enabled && nativeAvailable;
+  return nativeWrites;
+}
+
+void Storage::setDeltaRecording(int interval)
+{
+  keyframeInterval = qMax(interval, 0);
+  deltaStates.clear();
+}
+
+void Storage::setDataFormat(DataFormat format)
+{
+  dataFormat = format;
+  // deltas of one keyframe are read per format, so the new format starts with keyframe
+  deltaStates.clear();
+}
+
+bool Storage::parseDataFormat(const QString &str, DataFormat &format)
+{
+  if (str == "rows") {
+    format = DataFormat::Rows;
+  } else if (str == "blob") {
+    format = DataFormat::Blob;
+  } else if (str == "compressed-blob") {
+    format = DataFormat::CompressedBlob;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void Storage::forgetProcess(const ProcessId &processId)
+{
+  deltaStates.remove(processId.hash());
+  insertedMeasurements.remove(processId.hash());
+  blobReferences.remove(processId.hash());
+}
+
+qlonglong Storage::deltaKeyframe(qulonglong processId, qlonglong measurementId)
+{
+  DeltaState &state = deltaStates[processId];
+  state.measurementId = measurementId;
+  if (state.keyframeId != 0 && state.deltas + 1 < keyframeInterval) {
+    state.deltas++;
+    return state.keyframeId;
+  }
+  state.keyframeId = measurementId;
+  state.deltas = 0;
+  return 0;
+}
+
+qlonglong Storage::stringId(const QString &value)
+{
+  auto it = stringIds.constFind(value);
+  if (it != stringIds.cend()) {
+    return it.value();
+  }
+
+  // null string would violate not null constraint
+  QString str = value.isNull() ? QString("") : value;
+  sqlStringInsert.bindValue(":value", str);
+  sqlStringInsert.exec();
+  if (sqlStringInsert.lastError().isValid()) {
+    qWarning() << "Insert string failed" << sqlStringInsert.lastError();
+    return -1;
+  }
+
+  sqlStringSelect.bindValue(":value", str);
+  sqlStringSelect.exec();
+  if (sqlStringSelect.lastError().isValid() || !sqlStringSelect.next()) {
+    qWarning() << "Select string failed" << sqlStringSelect.lastError();
+    return -1;
+  }
+  qlonglong id = varToLong(sqlStringSelect.value(0));
+  sqlStringSelect.finish();
+
+  stringIds.insert(value, id);
+  return id;
+}
+
 bool Storage::insertOrIgnoreProcess(const ProcessId &processId, const QString &name) {
-  sqlProcessInsert.bindValue(":id", processId.hash());
+  if (nativeWrites) {
+    nativeProcessInsert.bind(1, qlonglong(processId.hash()));
+    nativeProcessInsert.bind(2, qlonglong(processId.pid));
+    nativeProcessInsert.bind(3, qlonglong(processId.startTime));
+    nativeProcessInsert.bind(4, name);
+    if (!nativeProcessInsert.exec()) {
+      qWarning() << "Insert process (pid" << processId.pid <<
+                 "hash" << processId.hash() << ") failed" << nativeProcessInsert.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  sqlProcessInsert.bindValue(":id", qlonglong(processId.hash()));
   sqlProcessInsert.bindValue(":pid", processId.pid);
-  sqlProcessInsert.bindValue(":start_time", processId.startTime);
+  sqlProcessInsert.bindValue(":start_time", qlonglong(processId.startTime));
   sqlProcessInsert.bindValue(":name", name);
 
   sqlProcessInsert.exec();
@@ -249,40 +937,102 @@ bool Storage::insertOrIgnoreProcess(const ProcessId &processId, const QString &n
   return true;
 }
 
-qlonglong Storage::insertOrIgnoreRange(const SmapsRange::Key &range)
+bool Storage::insertOrIgnoreRange(const SmapsRange::Key &range)
 {
-  sqlRangeInsert.bindValue(":id", range.hash());
-  sqlRangeInsert.bindValue(":process_id", range.processId.hash());
+  qlonglong nameId = stringId(range.name);
+  if (nameId < 0) {
+    return false;
+  }
+
+  if (nativeWrites) {
+    nativeRangeInsert.bind(1, qlonglong(range.hash()));
+    nativeRangeInsert.bind(2, qlonglong(range.processId.hash()));
+    nativeRangeInsert.bind(3, qlonglong(range.from));
+    nativeRangeInsert.bind(4, qlonglong(range.to));
+    nativeRangeInsert.bind(5, qlonglong(SmapsRange::permissionFlags(range.permission)));
+    nativeRangeInsert.bind(6, nameId);
+    if (!nativeRangeInsert.exec()) {
+      qWarning() << "Insert range failed" << nativeRangeInsert.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  sqlRangeInsert.bindValue(":id", qlonglong(range.hash()));
+  sqlRangeInsert.bindValue(":process_id", qlonglong(range.processId.hash()));
   sqlRangeInsert.bindValue(":from", qlonglong(range.from));
   sqlRangeInsert.bindValue(":to", qlonglong(range.to));
-  sqlRangeInsert.bindValue(":permission", range.permission);
-  sqlRangeInsert.bindValue(":name", range.name);
+  sqlRangeInsert.bindValue(":permission", SmapsRange::permissionFlags(range.permission));
+  sqlRangeInsert.bindValue(":name_id", nameId);
 
   sqlRangeInsert.exec();
   if (sqlRangeInsert.lastError().isValid()) {
     qWarning() << "Insert range failed" << sqlRangeInsert.lastError();
-    return 0;
+    return false;
   }
 
-  return varToLong(sqlRangeInsert.lastInsertId());
+  return true;
 }
 
-qlonglong measurementHash(const ProcessId &processId,
-                          const QDateTime &time) {
-  return processId.hash() ^ qHash(time);
+qlonglong Storage::nextMeasurementId(const QDateTime &time)
+{
+  // ids grow with time, so rows of new measurement are appended to the end of data table
+  // ordered by primary key; low 20 bits distinguish measurements of the same millisecond
+  lastMeasurementId = qMax(time.toMSecsSinceEpoch() << 20, lastMeasurementId + 1);
+  return lastMeasurementId;
 }
 
 qlonglong Storage::insertMeasurement(const ProcessId &processId,
                                      const QDateTime &time,
+                                     SampleType sampleType,
                                      qlonglong rss,
                                      qlonglong pss,
                                      const StatM &statm,
                                      const OomScore &oomScore)
 {
-  sqlMeasurementInsert.bindValue(":id", measurementHash(processId, time));
-  sqlMeasurementInsert.bindValue(":process_id", processId.hash());
+  qlonglong measurementId = nextMeasurementId(time);
+  qlonglong keyframeId = 0;
+  if (keyframeInterval > 0 && sampleType == FullSmaps) {
+    keyframeId = deltaKeyframe(processId.hash(), measurementId);
+  }
+
+  if (nativeWrites) {
+    nativeMeasurementInsert.bind(1, measurementId);
+    nativeMeasurementInsert.bind(2, qlonglong(processId.hash()));
+    nativeMeasurementInsert.bind(3, time.toMSecsSinceEpoch());
+    nativeMeasurementInsert.bind(4, qlonglong(sampleType));
+    nativeMeasurementInsert.bind(5, rss);
+    nativeMeasurementInsert.bind(6, pss);
+    nativeMeasurementInsert.bind(7, qlonglong(oomScore.adj));
+    nativeMeasurementInsert.bind(8, qlonglong(oomScore.score));
+    nativeMeasurementInsert.bind(9, qlonglong(oomScore.scoreAdj));
+    nativeMeasurementInsert.bind(10, qlonglong(statm.size));
+    nativeMeasurementInsert.bind(11, qlonglong(statm.resident));
+    nativeMeasurementInsert.bind(12, qlonglong(statm.shared));
+    nativeMeasurementInsert.bind(13, qlonglong(statm.text));
+    nativeMeasurementInsert.bind(14, qlonglong(statm.lib));
+    nativeMeasurementInsert.bind(15, qlonglong(statm.data));
+    nativeMeasurementInsert.bind(16, qlonglong(statm.dt));
+    if (keyframeId != 0) {
+      nativeMeasurementInsert.bind(17, keyframeId);
+    } else {
+      nativeMeasurementInsert.bindNull(17);
+    }
+    if (!nativeMeasurementInsert.exec()) {
+      qWarning() << "Insert measurement failed" << nativeMeasurementInsert.errorMessage();
+      deltaStates.remove(processId.hash());
+      insertedMeasurements.remove(processId.hash());
+      return 0;
+    }
+    insertedMeasurements[processId.hash()] = InsertedMeasurement{time.toMSecsSinceEpoch(), measurementId};
+    return measurementId;
+  }
+
+  sqlMeasurementInsert.bindValue(":id", measurementId);
+  sqlMeasurementInsert.bindValue(":process_id", qlonglong(processId.hash()));
 
-  sqlMeasurementInsert.bindValue(":time", time);
+  sqlMeasurementInsert.bindValue(":time", time.toMSecsSinceEpoch());
+  sqlMeasurementInsert.bindValue(":sample_type", int(sampleType));
   sqlMeasurementInsert.bindValue(":rss", rss);
   sqlMeasurementInsert.bindValue(":pss", pss);
 
@@ -298,26 +1048,81 @@ qlonglong Storage::insertMeasurement(const ProcessId &processId,
   sqlMeasurementInsert.bindValue(":statm_data", (qlonglong)statm.data);
   sqlMeasurementInsert.bindValue(":statm_dt", (qlonglong)statm.dt);
 
+  sqlMeasurementInsert.bindValue(":keyframe_id", keyframeId != 0 ? QVariant(keyframeId) : QVariant(QVariant::LongLong));
+
   sqlMeasurementInsert.exec();
   if (sqlMeasurementInsert.lastError().isValid()) {
     qWarning() << "Insert measurement failed" << sqlMeasurementInsert.lastError();
+    deltaStates.remove(processId.hash());
+    insertedMeasurements.remove(processId.hash());
     return 0;
   }
 
-  return varToLong(sqlMeasurementInsert.lastInsertId());
+  insertedMeasurements[processId.hash()] = InsertedMeasurement{time.toMSecsSinceEpoch(), measurementId};
+  return measurementId;
 }
 
-bool Storage::insertData(const ProcessId &processId,
-                         const QDateTime &time,
-                         const QList<SmapsRange> &ranges)
+template <typename Row>
+bool Storage::nativeInsertData(qlonglong measurementId, const QList<Row> &rows)
 {
-  qlonglong measurementId = measurementHash(processId, time);
+  int i = 0;
+  for (; i + DataRowsPerStatement <= rows.size(); i += DataRowsPerStatement) {
+    int param = 1;
+    for (int j = i; j < i + DataRowsPerStatement; j++) {
+      const MeasurementData &m = dataRow(rows[j]);
+      nativeDataBulkInsert.bind(param++, measurementId);
+      nativeDataBulkInsert.bind(param++, m.rangeId);
+      nativeDataBulkInsert.bind(param++, m.rss);
+      nativeDataBulkInsert.bind(param++, m.pss);
+    }
+    if (!nativeDataBulkInsert.exec()) {
+      qWarning() << "Insert data failed" << nativeDataBulkInsert.errorMessage();
+      return false;
+    }
+  }
+  for (; i < rows.size(); i++) {
+    const MeasurementData &m = dataRow(rows[i]);
+    nativeDataInsert.bind(1, measurementId);
+    nativeDataInsert.bind(2, m.rangeId);
+    nativeDataInsert.bind(3, m.rss);
+    nativeDataInsert.bind(4, m.pss);
+    if (!nativeDataInsert.exec()) {
+      qWarning() << "Insert data failed" << nativeDataInsert.errorMessage();
+      return false;
+    }
+  }
+  return true;
+}
 
-  for (const auto &m: ranges) {
-    sqlDataInsert.bindValue(":range_id", m.key.hash());
+template <typename Row>
+bool Storage::insertDataRows(qulonglong processId, qlonglong measurementId, const QList<Row> &rows, bool delta)
+{
+  if (dataFormat != DataFormat::Rows) {
+    if (rows.isEmpty()) {
+      if (!delta) {
+        // process has no ranges now, there is nothing to refer
+        blobReferences.remove(processId);
+      }
+      return true;
+    }
+    std::vector<MeasurementData> blobRows;
+    blobRows.reserve(size_t(rows.size()));
+    for (const Row &row: rows) {
+      blobRows.push_back(dataRow(row));
+    }
+    return insertDataBlob(processId, measurementId, blobRows, delta);
+  }
+
+  if (nativeWrites) {
+    return nativeInsertData(measurementId, rows);
+  }
+
+  for (const Row &row: rows) {
+    const MeasurementData &m = dataRow(row);
     sqlDataInsert.bindValue(":measurement_id", measurementId);
-    sqlDataInsert.bindValue(":rss", qlonglong(m.rss));
-    sqlDataInsert.bindValue(":pss", qlonglong(m.pss));
+    sqlDataInsert.bindValue(":range_id", m.rangeId);
+    sqlDataInsert.bindValue(":rss", m.rss);
+    sqlDataInsert.bindValue(":pss", m.pss);
 
     sqlDataInsert.exec();
     if (sqlDataInsert.lastError().isValid()) {
@@ -329,8 +1134,194 @@ bool Storage::insertData(const ProcessId &processId,
   return true;
 }
 
+bool Storage::insertDataBlob(qulonglong processId, qlonglong measurementId, std::vector<MeasurementData> &rows,
+                             bool delta)
+{
+  // blob refers the last self-contained blob of the process, until too many of its ranges are new,
+  // just complete data become new reference
+  auto reference = blobReferences.find(processId);
+  bool referenced = reference != blobReferences.end();
+  if (referenced && !delta) {
+    size_t unknown = 0;
+    for (const MeasurementData &row: rows) {
+      if (!std::binary_search(reference->rangeIds.cbegin(), reference->rangeIds.cend(), row.rangeId)) {
+        unknown++;
+      }
+    }
+    referenced = unknown <= rows.size() / 8;
+  }
+  QByteArray blob = referenced ?
+                    DataBlob::encode(rows, dataFormat == DataFormat::CompressedBlob,
+                                     reference->measurementId, reference->rangeIds) :
+                    DataBlob::encode(rows, dataFormat == DataFormat::CompressedBlob);
+
+  if (nativeWrites) {
+    nativeDataBlobInsert.bind(1, measurementId);
+    nativeDataBlobInsert.bindBlob(2, blob);
+    if (!nativeDataBlobInsert.exec()) {
+      qWarning() << "Insert data blob failed" << nativeDataBlobInsert.errorMessage();
+      return false;
+    }
+  } else {
+    sqlDataBlobInsert.bindValue(":measurement_id", measurementId);
+    sqlDataBlobInsert.bindValue(":value", blob);
+    sqlDataBlobInsert.exec();
+    if (sqlDataBlobInsert.lastError().isValid()) {
+      qWarning() << "Insert data blob failed" << sqlDataBlobInsert.lastError();
+      return false;
+    }
+  }
+
+  if (!referenced && !delta) {
+    BlobReference &newReference = blobReferences[processId];
+    newReference.measurementId = measurementId;
+    newReference.rangeIds.clear();
+    newReference.rangeIds.reserve(rows.size());
+    for (const MeasurementData &row: rows) {
+      newReference.rangeIds.push_back(row.rangeId);
+    }
+  }
+  return true;
+}
+
+bool Storage::decodeDataBlob(const QByteArray &blob, QList<MeasurementData> &rows)
+{
+  qlonglong referenceId = 0;
+  if (!DataBlob::reference(blob, referenceId)) {
+    return false;
+  }
+  if (referenceId == 0) {
+    return DataBlob::decode(blob, rows);
+  }
+  if (decodedReference.measurementId != referenceId) {
+    // blob may point to result of caller's statement, so reference is read by another one
+    QList<MeasurementData> referenceRows;
+    bool found = false;
+    if (nativeReads) {
+      NativeQuery &query = nativeQuery(SelectReferenceBlob, BlobColumns);
+      StatementResetter resetter(query.statement);
+      query.statement.bind(":reference_id", referenceId);
+      if (query.statement.next()) {
+        found = true;
+        if (!DataBlob::decode(query.statement.columnBlob(query.columns[0]), referenceRows)) {
+          return false;
+        }
+      } else if (query.statement.hasError()) {
+        qWarning() << "Select reference blob failed" << query.statement.errorMessage();
+        return false;
+      }
+    } else {
+      QSqlQuery &sql = readQuery(SelectReferenceBlob);
+      QueryFinisher finisher(sql);
+      sql.bindValue(":reference_id", referenceId);
+      sql.exec();
+      if (sql.lastError().isValid()) {
+        qWarning() << "Select reference blob failed" << sql.lastError();
+        return false;
+      }
+      if (sql.next()) {
+        found = true;
+        if (!DataBlob::decode(sql.value(0).toByteArray(), referenceRows)) {
+          return false;
+        }
+      }
+    }
+    if (!found) {
+      qWarning() << "Reference of data blob not found" << referenceId;
+      return false;
+    }
+    decodedReference.measurementId = referenceId;
+    decodedReference.rangeIds.clear();
+    decodedReference.rangeIds.reserve(size_t(referenceRows.size()));
+    for (const MeasurementData &row: referenceRows) {
+      decodedReference.rangeIds.push_back(row.rangeId);
+    }
+  }
+  return DataBlob::decode(blob, rows, decodedReference.rangeIds);
+}
+
+bool Storage::insertData(const ProcessId &processId,
+                         const QDateTime &time,
+                         const QList<SmapsRange> &ranges)
+{
+  auto inserted = insertedMeasurements.constFind(processId.hash());
+  if (inserted == insertedMeasurements.constEnd() || inserted->time != time.toMSecsSinceEpoch()) {
+    qWarning() << "Insert data failed, measurement of process" << processId.pid << "at" << time << "was not inserted";
+    return false;
+  }
+  qlonglong measurementId = inserted->id;
+  if (keyframeInterval > 0) {
+    auto it = deltaStates.find(processId.hash());
+    if (it != deltaStates.end() && it->measurementId == measurementId) {
+      if (!insertDeltaData(*it, processId.hash(), measurementId, ranges)) {
+        // next measurement of the process will be keyframe
+        deltaStates.erase(it);
+        return false;
+      }
+      return true;
+    }
+  }
+  return insertDataRows(processId.hash(), measurementId, ranges);
+}
+
+bool Storage::insertDeltaData(DeltaState &state, qulonglong processId, qlonglong measurementId,
+                              const QList<SmapsRange> &ranges)
+{
+  bool keyframe = measurementId == state.keyframeId;
+  QHash<qlonglong, MeasurementData> current;
+  current.reserve(ranges.size());
+  QList<MeasurementData> changed;
+  for (const SmapsRange &range: ranges) {
+    MeasurementData row = dataRow(range);
+    if (current.contains(row.rangeId)) {
+      continue; // the first one is stored, the same as by INSERT OR IGNORE
+    }
+    current.insert(row.rangeId, row);
+    if (keyframe) {
+      continue;
+    }
+    auto previous = state.ranges.constFind(row.rangeId);
+    if (previous == state.ranges.constEnd() || previous->rss != row.rss || previous->pss != row.pss) {
+      changed << row;
+    }
+  }
+  if (!keyframe) {
+    for (auto it = state.ranges.constBegin(); it != state.ranges.constEnd(); ++it) {
+      if (!current.contains(it.key())) {
+        changed << MeasurementData{it.key(), RemovedRange, RemovedRange};
+      }
+    }
+  }
+  state.ranges.swap(current);
+  return keyframe ?
+         insertDataRows(processId, measurementId, ranges) :
+         insertDataRows(processId, measurementId, changed, true);
+}
+
 bool Storage::insertSystemMemInfo(const QDateTime &time, const MemInfo &memInfo) {
-  sqlSystemInsert.bindValue(":time", time);
+  if (nativeWrites) {
+    nativeSystemInsert.bind(1, time.toMSecsSinceEpoch());
+    nativeSystemInsert.bind(2, qlonglong(memInfo.memTotal));
+    nativeSystemInsert.bind(3, qlonglong(memInfo.memFree));
+    nativeSystemInsert.bind(4, qlonglong(memInfo.memAvailable));
+    nativeSystemInsert.bind(5, qlonglong(memInfo.buffers));
+    nativeSystemInsert.bind(6, qlonglong(memInfo.cached));
+    nativeSystemInsert.bind(7, qlonglong(memInfo.swapCache));
+    nativeSystemInsert.bind(8, qlonglong(memInfo.swapTotal));
+    nativeSystemInsert.bind(9, qlonglong(memInfo.swapFree));
+    nativeSystemInsert.bind(10, qlonglong(memInfo.anonPages));
+    nativeSystemInsert.bind(11, qlonglong(memInfo.mapped));
+    nativeSystemInsert.bind(12, qlonglong(memInfo.shmem));
+    nativeSystemInsert.bind(13, qlonglong(memInfo.slab));
+    nativeSystemInsert.bind(14, qlonglong(memInfo.sReclaimable));
+    if (!nativeSystemInsert.exec()) {
+      qWarning() << "Insert data failed" << nativeSystemInsert.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  sqlSystemInsert.bindValue(":time", time.toMSecsSinceEpoch());
   sqlSystemInsert.bindValue(":mem_total", (qlonglong)memInfo.memTotal);
   sqlSystemInsert.bindValue(":mem_free", (qlonglong)memInfo.memFree);
   sqlSystemInsert.bindValue(":mem_available", (qlonglong)memInfo.memAvailable);
@@ -354,6 +1345,294 @@ bool Storage::insertSystemMemInfo(const QDateTime &time, const MemInfo &memInfo)
   return true;
 }
 
+bool Storage::insertRecorderStats(const QDateTime &time, const QMap<QString, qlonglong> &values) {
+  qlonglong msecs = time.toMSecsSinceEpoch();
+  if (nativeWrites) {
+    for (auto it = values.cbegin(); it != values.cend(); ++it) {
+      nativeRecorderStatsInsert.bind(1, msecs);
+      nativeRecorderStatsInsert.bind(2, it.key());
+      nativeRecorderStatsInsert.bind(3, it.value());
+      if (!nativeRecorderStatsInsert.exec()) {
+        qWarning() << "Insert recorder stats failed" << nativeRecorderStatsInsert.errorMessage();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  for (auto it = values.cbegin(); it != values.cend(); ++it) {
+    sqlRecorderStatsInsert.bindValue(":time", msecs);
+    sqlRecorderStatsInsert.bindValue(":name", it.key());
+    sqlRecorderStatsInsert.bindValue(":value", it.value());
+
+    sqlRecorderStatsInsert.exec();
+    if (sqlRecorderStatsInsert.lastError().isValid()) {
+      qWarning() << "Insert recorder stats failed" << sqlRecorderStatsInsert.lastError();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Storage::importBinLog(const QString &directory)
+{
+  if (version != SchemaVersion) {
+    qWarning() << "Binary log may be imported just to database with schema" << SchemaVersion;
+    return false;
+  }
+  BinLogReader reader;
+  if (!reader.open(directory)) {
+    return false;
+  }
+  if (!transaction()) {
+    qWarning() << "Begin of import transaction failed" << db.lastError();
+    return false;
+  }
+
+  // records that can't be inserted are skipped, the same as by recorder
+  qint64 failed = 0;
+  reader.scan([&](const BinLog::RecordHeader *header) {
+    bool inserted = true;
+    switch (header->type) {
+      case BinLog::Process: {
+        const auto *record = BinLog::record<BinLog::ProcessRecord>(header);
+        inserted = insertOrIgnoreProcess(ProcessId(pid_t(record->pid), record->startTime), BinLog::name(record));
+        break;
+      }
+      case BinLog::Range: {
+        const auto *record = BinLog::record<BinLog::RangeRecord>(header);
+        SmapsRange::Key key;
+        key.processId = ProcessId(pid_t(record->pid), record->startTime);
+        key.from = record->from;
+        key.to = record->to;
+        key.permission = SmapsRange::permissionString(record->permission);
+        key.name = BinLog::name(record);
+        inserted = insertOrIgnoreRange(key);
+        break;
+      }
+      case BinLog::Measurement: {
+        const auto *record = BinLog::record<BinLog::MeasurementRecord>(header);
+        StatM statm;
+        statm.size = record->statmSize;
+        statm.resident = record->statmResident;
+        statm.shared = record->statmShared;
+        statm.text = record->statmText;
+        statm.lib = record->statmLib;
+        statm.data = record->statmData;
+        statm.dt = record->statmDt;
+        OomScore oomScore;
+        oomScore.adj = record->oomAdj;
+        oomScore.score = record->oomScore;
+        oomScore.scoreAdj = record->oomScoreAdj;
+        inserted = insertMeasurement(ProcessId(pid_t(record->pid), record->startTime),
+                                     QDateTime::fromMSecsSinceEpoch(record->time),
+                                     SampleType(record->sampleType), record->rss, record->pss,
+                                     statm, oomScore) != 0;
+        break;
+      }
+      case BinLog::Data: {
+        const auto *record = BinLog::record<BinLog::DataRecord>(header);
+        const BinLog::DataRow *rows = BinLog::rows(record);
+        QList<MeasurementData> data;
+        data.reserve(int(record->count));
+        for (quint32 i = 0; i < record->count; i++) {
+          data << MeasurementData{rows[i].rangeId, rows[i].rss, rows[i].pss};
+        }
+        // data record follows measurement record of the process
+        auto measurement = insertedMeasurements.constFind(ProcessId(pid_t(record->pid), record->startTime).hash());
+        if (measurement == insertedMeasurements.constEnd() || measurement->time != qint64(record->time)) {
+          qWarning() << "Data record without measurement of process" << record->pid;
+          inserted = false;
+          break;
+        }
+        inserted = insertDataRows(measurement.key(), measurement->id, data);
+        break;
+      }
+      case BinLog::MemInfo: {
+        const auto *record = BinLog::record<BinLog::MemInfoRecord>(header);
+        MemInfo memInfo;
+        memInfo.memTotal = record->memTotal;
+        memInfo.memFree = record->memFree;
+        memInfo.memAvailable = record->memAvailable;
+        memInfo.buffers = record->buffers;
+        memInfo.cached = record->cached;
+        memInfo.swapCache = record->swapCache;
+        memInfo.swapTotal = record->swapTotal;
+        memInfo.swapFree = record->swapFree;
+        memInfo.anonPages = record->anonPages;
+        memInfo.mapped = record->mapped;
+        memInfo.shmem = record->shmem;
+        memInfo.slab = record->slab;
+        memInfo.sReclaimable = record->sReclaimable;
+        inserted = insertSystemMemInfo(QDateTime::fromMSecsSinceEpoch(record->time), memInfo);
+        break;
+      }
+      case BinLog::RecorderStat: {
+        const auto *record = BinLog::record<BinLog::RecorderStatRecord>(header);
+        inserted = insertRecorderStats(QDateTime::fromMSecsSinceEpoch(record->time),
+                                       {{BinLog::name(record), record->value}});
+        break;
+      }
+      default:
+        break;
+    }
+    if (!inserted) {
+      failed++;
+    }
+    return true;
+  });
+
+  if (!commit()) {
+    qWarning() << "Commit of import failed" << db.lastError();
+    return false;
+  }
+  if (failed > 0) {
+    qWarning() << failed << "records of binary log were not imported";
+  }
+  return true;
+}
+
+QVariant Storage::idValue(qulonglong id) const
+{
+  return version >= 2 ? QVariant(qlonglong(id)) : QVariant(id);
+}
+
+qulonglong Storage::idFromValue(const QVariant &value) const
+{
+  return version >= 2 ? qulonglong(varToLong(value, 0)) : varToULong(value);
+}
+
+QVariant Storage::timeValue(const QDateTime &time) const
+{
+  return version >= 2 ? QVariant(time.toMSecsSinceEpoch()) : QVariant(time);
+}
+
+QDateTime Storage::timeFromValue(const QVariant &value) const
+{
+  return version >= 2 ? QDateTime::fromMSecsSinceEpoch(varToLong(value, 0)) : varToDateTime(value);
+}
+
+bool Storage::ensureIndexes()
+{
+  QSet<QString> existing;
+  QSqlQuery indexQuery = db.exec("SELECT `name` FROM `sqlite_master` WHERE `type` = 'index';");
+  while (indexQuery.next()) {
+    existing << varToString(indexQuery.value(0));
+  }
+  indexQuery.finish();
+
+  QStringList statements;
+  for (const Index &index: AnalysisIndexes) {
+    if (QString sql = createIndexStatement(index, version); !sql.isEmpty() && !existing.contains(index.name)) {
+      statements << sql;
+    }
+  }
+  if (statements.isEmpty()) {
+    return true;
+  }
+
+  // index creation holds write lock until all indexes are built, recorder would wait
+  // for it, so it is skipped when the recording may be in progress: write-ahead log
+  // contains frames of the recorder or another connection holds the lock
+  QFileInfo wal(db.databaseName() + "-wal");
+  if (wal.exists() && wal.size() > 0) {
+    qWarning() << "Recording" << db.databaseName() << "may be in progress, indexes are not created, analysis may be slow";
+    return false;
+  }
+
+  // analysis tools open the recording read-only, indexes are created by another connection
+  qDebug() << "Creating" << statements.size() << "indexes, it may take a while";
+  bool result = false;
+  QString name = connectionName + "-indexes";
+  {
+    QSqlDatabase indexDb = QSqlDatabase::addDatabase("QSQLITE", name);
+    indexDb.setDatabaseName(db.databaseName());
+    // don't wait for the write lock
+    indexDb.setConnectOptions("QSQLITE_BUSY_TIMEOUT=0");
+    if (!indexDb.open()) {
+      qWarning() << "Can't open database for index creation" << indexDb.lastError();
+    } else if (QSqlQuery q = indexDb.exec("BEGIN IMMEDIATE;"); q.lastError().isValid()) {
+      qWarning() << "Database" << db.databaseName() << "is locked, indexes are not created" << q.lastError();
+    } else {
+      result = true;
+    }
+    bool transaction = result;
+    for (const QString &sql: statements) {
+      if (!result) {
+        break;
+      }
+      QSqlQuery q = indexDb.exec(sql);
+      if (q.lastError().isValid()) {
+        qWarning() << "Creating index failed" << sql << q.lastError();
+        result = false;
+      }
+    }
+    if (result) {
+      QSqlQuery q = indexDb.exec("COMMIT;");
+      if (q.lastError().isValid()) {
+        qWarning() << "Commit of indexes failed" << q.lastError();
+        indexDb.exec("ROLLBACK;");
+        result = false;
+      }
+    } else if (transaction) {
+      indexDb.exec("ROLLBACK;");
+    }
+    indexDb.close();
+  }
+  QSqlDatabase::removeDatabase(name);
+  if (!result) {
+    qWarning() << "Indexes are missing, analysis may be slow";
+  }
+  return result;
+}
+
+bool Storage::setNativeReads(bool enabled)
+{
+  nativeReads = enabled && handle != nullptr && version >= 2;
+  return nativeReads;
+}
+
+void Storage::setStatementCache(bool enabled)
+{
+  statementCache = enabled;
+  if (!enabled) {
+    readQueries.clear();
+    nativeQueries.clear();
+  }
+}
+
+QSqlQuery &Storage::readQuery(const char *statement)
+{
+  auto it = readQueries.find(statement);
+  if (it != readQueries.end() && statementCache) {
+    return it.value();
+  }
+  QSqlQuery query(db);
+  if (!query.prepare(statement)) {
+    qWarning() << "Prepare of query failed" << statement << query.lastError();
+  }
+  return readQueries.insert(statement, query).value();
+}
+
+Storage::NativeQuery &Storage::nativeQuery(const char *statement, const std::vector<const char*> &columns)
+{
+  auto it = nativeQueries.find(statement);
+  if (it != nativeQueries.end() && statementCache) {
+    return it->second;
+  }
+  NativeQuery &query = nativeQueries[statement];
+  query.columns.clear();
+  if (query.statement.prepare(handle, statement)) {
+    for (const char *column: columns) {
+      query.columns.push_back(query.statement.columnIndex(column));
+    }
+  } else {
+    query.columns.resize(columns.size(), -1);
+  }
+  return query;
+}
+
 bool Storage::getRanges(QMap<qulonglong, Range> &rangeMap, QSqlQuery &sql)
 {
   sql.exec();
@@ -362,23 +1641,51 @@ bool Storage::getRanges(QMap<qulonglong, Range> &rangeMap, QSqlQuery &sql)
     return false;
   }
   rangeMap.clear();
-  while (sql.next()){
+  while (sql.next()){
+    Range range;
+    range.from = varToLong(sql.value("from"));
+    range.to = varToLong(sql.value("to"));
+    range.permission = version >= 2 ?
+                       SmapsRange::permissionString(int(varToLong(sql.value("permission"), 0))) :
+                       varToString(sql.value("permission"));
+    range.name = varToString(sql.value("name"));
+    rangeMap[idFromValue(sql.value("id"))] = range;
+  }
+  return true;
+}
+
+bool Storage::getRanges(QMap<qulonglong, Range> &rangeMap, NativeQuery &query)
+{
+  rangeMap.clear();
+  while (query.statement.next()){
     Range range;
-    range.from = varToLong(sql.value("from"));
-    range.to = varToLong(sql.value("to"));
-    range.permission = varToString(sql.value("permission"));
-    range.name = varToString(sql.value("name"));
-    rangeMap[varToULong(sql.value("id"))] = range;
+    range.from = query.value(RangeFrom);
+    range.to = query.value(RangeTo);
+    range.permission = SmapsRange::permissionString(int(query.value(RangePermission)));
+    range.name = query.statement.columnString(query.columns[RangeName]);
+    rangeMap[qulonglong(query.value(RangeId))] = range;
+  }
+  if (query.statement.hasError()) {
+    qWarning() << "Select ranges failed" << query.statement.errorMessage();
+    return false;
   }
   return true;
 }
 
 bool Storage::getAllRanges(qulonglong processId, QMap<qulonglong, Range> &rangeMap)
 {
-  QSqlQuery sql(db);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectRangesOfProcess, RangeColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":process_id", qlonglong(processId));
+    return getRanges(rangeMap, query);
+  }
 
-  sql.prepare("SELECT * FROM `memory_range` WHERE process_id = :process_id;");
-  sql.bindValue(":process_id", processId);
+  QSqlQuery &sql = readQuery(version >= 2 ?
+                              SelectRangesOfProcess :
+                              "SELECT * FROM `memory_range` WHERE `process_id` = :process_id;");
+  QueryFinisher finisher(sql);
+  sql.bindValue(":process_id", idValue(processId));
   return getRanges(rangeMap, sql);
 }
 
@@ -395,10 +1702,51 @@ bool Storage::execAndGetMeasurement(Measurement &measurement, QSqlQuery &measure
   return getMeasurement(measurement, measurementQuery, cacheRanges);
 }
 
+bool Storage::execAndGetMeasurement(Measurement &measurement, NativeQuery &measurementQuery, bool cacheRanges) {
+  if (!measurementQuery.statement.next()) {
+    qWarning() << "No measurement found" << measurementQuery.statement.errorMessage();
+    return false;
+  }
+  decodeMeasurement(measurementQuery, measurement);
+  return getMeasurementDetails(measurement, cacheRanges);
+}
+
+void Storage::decodeMeasurement(const NativeQuery &query, Measurement &measurement)
+{
+  measurement.id = qulonglong(query.value(MeasurementId));
+  measurement.processId = qulonglong(query.value(MeasurementProcessId));
+  measurement.time = QDateTime::fromMSecsSinceEpoch(query.value(MeasurementTime));
+  measurement.sampleType = SampleType(query.value(MeasurementSampleType));
+  measurement.rssSum = query.value(MeasurementRssSum);
+  measurement.pssSum = query.value(MeasurementPssSum);
+
+  measurement.oomScore.adj = query.value(MeasurementOomAdj);
+  measurement.oomScore.score = query.value(MeasurementOomScore);
+  measurement.oomScore.scoreAdj = query.value(MeasurementOomScoreAdj);
+
+  measurement.statm.size = query.value(MeasurementStatmSize);
+  measurement.statm.resident = query.value(MeasurementStatmResident);
+  measurement.statm.shared = query.value(MeasurementStatmShared);
+  measurement.statm.text = query.value(MeasurementStatmText);
+  measurement.statm.lib = query.value(MeasurementStatmLib);
+  measurement.statm.data = query.value(MeasurementStatmData);
+  measurement.statm.dt = query.value(MeasurementStatmDt);
+  measurement.keyframeId = qulonglong(query.value(MeasurementKeyframeId));
+}
+
 bool Storage::getMeasurement(Measurement &measurement, QSqlQuery &measurementQuery, bool cacheRanges) {
-  measurement.id = varToULong(measurementQuery.value("id"));
-  measurement.processId = varToULong(measurementQuery.value("process_id"));
-  measurement.time = varToDateTime(measurementQuery.value("time"));
+  decodeMeasurement(measurementQuery, measurement);
+  return getMeasurementDetails(measurement, cacheRanges);
+}
+
+void Storage::decodeMeasurement(const QSqlQuery &measurementQuery, Measurement &measurement) const
+{
+  measurement.id = idFromValue(measurementQuery.value("id"));
+  measurement.processId = idFromValue(measurementQuery.value("process_id"));
+  measurement.time = timeFromValue(measurementQuery.value("time"));
+  measurement.sampleType = SampleType(varToLong(measurementQuery.value("sample_type"), FullSmaps));
+  measurement.rssSum = varToLong(measurementQuery.value("rss_sum"));
+  measurement.pssSum = varToLong(measurementQuery.value("pss_sum"));
 
   measurement.oomScore.adj = varToLong(measurementQuery.value("oom_adj"));
   measurement.oomScore.score = varToLong(measurementQuery.value("oom_score"));
@@ -411,18 +1759,56 @@ bool Storage::getMeasurement(Measurement &measurement, QSqlQuery &measurementQue
   measurement.statm.lib = varToLong(measurementQuery.value("statm_lib"));
   measurement.statm.data = varToLong(measurementQuery.value("statm_data"));
   measurement.statm.dt = varToLong(measurementQuery.value("statm_dt"));
+  measurement.keyframeId = version >= 3 ? idFromValue(measurementQuery.value("keyframe_id")) : 0;
+}
 
-  QSqlQuery sql(db);
+bool Storage::getMeasurementDetails(Measurement &measurement, bool cacheRanges) {
+  // data
+  bool blob = false;
+  if (measurement.keyframeId != 0) {
+    QMap<qlonglong, MeasurementData> data;
+    if (!getDeltaData(measurement, data)) {
+      return false;
+    }
+    measurement.data = data.values();
+  } else if (!getData(qlonglong(measurement.id), measurement.data, blob)) {
+    return false;
+  }
 
   // ranges
   if (cacheRanges){
     if (measurement.rangeMap.empty()){
       getAllRanges(measurement.processId, measurement.rangeMap);
     }
-  }else {
-    sql.prepare(
-      "SELECT * FROM `memory_range` WHERE `id` IN (SELECT `range_id` FROM `data` WHERE `measurement_id` = :measurement_id);");
-    sql.bindValue(":measurement_id", measurement.id);
+  } else if (measurement.keyframeId != 0 || blob) {
+    // ranges are not referenced by data table, just ranges of the data are kept
+    if (!getAllRanges(measurement.processId, measurement.rangeMap)) {
+      return false;
+    }
+    QSet<qlonglong> rangeIds;
+    rangeIds.reserve(measurement.data.size());
+    for (const MeasurementData &data: measurement.data) {
+      rangeIds.insert(data.rangeId);
+    }
+    for (auto it = measurement.rangeMap.begin(); it != measurement.rangeMap.end();) {
+      if (rangeIds.contains(qlonglong(it.key()))) {
+        ++it;
+      } else {
+        it = measurement.rangeMap.erase(it);
+      }
+    }
+  } else if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectRangesOfMeasurement, RangeColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":measurement_id", qlonglong(measurement.id));
+    getRanges(measurement.rangeMap, query);
+  } else {
+    QSqlQuery &sql = readQuery(version >= 2 ?
+                                SelectRangesOfMeasurement :
+                                "SELECT * FROM `memory_range` WHERE `id` IN "
+                                "(SELECT `range_id` FROM `data` WHERE `measurement_id` = :measurement_id);");
+    QueryFinisher finisher(sql);
+    sql.bindValue(":measurement_id", idValue(measurement.id));
 
     measurement.rangeMap.clear();
     if (!getRanges(measurement.rangeMap, sql)) {
@@ -431,29 +1817,173 @@ bool Storage::getMeasurement(Measurement &measurement, QSqlQuery &measurementQue
     }
   }
 
-  // data
-  sql.prepare("SELECT * FROM `data` WHERE `measurement_id` = :measurement_id");
-  sql.bindValue(":measurement_id", measurement.id);
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Select data failed" << sql.lastError();
+  return true;
+}
+
+bool Storage::getData(qlonglong measurementId, QList<MeasurementData> &data, bool &blob)
+{
+  data.clear();
+  blob = false;
+  if (nativeReads) {
+    {
+      NativeQuery &query = nativeQuery(SelectData, DataColumns);
+      StatementResetter resetter(query.statement);
+      query.statement.bind(":measurement_id", measurementId);
+      while (query.statement.next()) {
+        MeasurementData row;
+        row.rangeId = query.value(DataRangeId);
+        row.rss = query.value(DataRss);
+        row.pss = query.value(DataPss);
+        data << row;
+      }
+      if (query.statement.hasError()) {
+        qWarning() << "Select data failed" << query.statement.errorMessage();
+        return false;
+      }
+    }
+    if (version >= 4) {
+      NativeQuery &query = nativeQuery(SelectDataBlob, BlobColumns);
+      StatementResetter resetter(query.statement);
+      query.statement.bind(":measurement_id", measurementId);
+      if (query.statement.next()) {
+        blob = true;
+        return decodeDataBlob(query.statement.columnBlob(query.columns[0]), data);
+      }
+      if (query.statement.hasError()) {
+        qWarning() << "Select data blob failed" << query.statement.errorMessage();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  {
+    QSqlQuery &sql = readQuery(SelectData);
+    QueryFinisher finisher(sql);
+    sql.bindValue(":measurement_id", idValue(qulonglong(measurementId)));
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Select data failed" << sql.lastError();
+      return false;
+    }
+    while (sql.next()) {
+      MeasurementData row;
+      row.rangeId = idFromValue(sql.value("range_id"));
+      row.rss = varToLong(sql.value("rss"));
+      row.pss = varToLong(sql.value("pss"));
+      data << row;
+    }
+  }
+  if (version >= 4) {
+    QSqlQuery &sql = readQuery(SelectDataBlob);
+    QueryFinisher finisher(sql);
+    sql.bindValue(":measurement_id", measurementId);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Select data blob failed" << sql.lastError();
+      return false;
+    }
+    if (sql.next()) {
+      blob = true;
+      return decodeDataBlob(sql.value(0).toByteArray(), data);
+    }
+  }
+  return true;
+}
+
+bool Storage::getDeltaData(const Measurement &measurement, QMap<qlonglong, MeasurementData> &data)
+{
+  // keyframe is read by primary key, its deltas by keyframe index
+  data.clear();
+  QList<MeasurementData> rows;
+  bool blob = false;
+  if (!getData(qlonglong(measurement.keyframeId), rows, blob)) {
     return false;
   }
-  measurement.data.clear();
-  while (sql.next()) {
-    MeasurementData data;
-    data.rangeId = varToULong(sql.value("range_id"));;
-    data.rss = varToLong(sql.value("rss"));
-    data.pss = varToLong(sql.value("pss"));
-    measurement.data << data;
+  for (const MeasurementData &row: rows) {
+    data.insert(row.rangeId, row);
+  }
+
+  // keyframe without data has neither rows nor blob, format of its deltas is unknown,
+  // so both tables are searched
+  if (nativeReads) {
+    {
+      NativeQuery &query = nativeQuery(SelectDeltas, DataColumns);
+      StatementResetter resetter(query.statement);
+      query.statement.bind(":keyframe_id", qlonglong(measurement.keyframeId));
+      query.statement.bind(":time", measurement.time.toMSecsSinceEpoch());
+      while (query.statement.next()) {
+        applyDelta(data, MeasurementData{query.value(DataRangeId), query.value(DataRss), query.value(DataPss)});
+      }
+      if (query.statement.hasError()) {
+        qWarning() << "Select deltas failed" << query.statement.errorMessage();
+        return false;
+      }
+    }
+    if (version >= 4) {
+      NativeQuery &query = nativeQuery(SelectDeltaBlobs, BlobColumns);
+      StatementResetter resetter(query.statement);
+      query.statement.bind(":keyframe_id", qlonglong(measurement.keyframeId));
+      query.statement.bind(":time", measurement.time.toMSecsSinceEpoch());
+      while (query.statement.next()) {
+        rows.clear();
+        if (!decodeDataBlob(query.statement.columnBlob(query.columns[0]), rows)) {
+          return false;
+        }
+        for (const MeasurementData &row: rows) {
+          applyDelta(data, row);
+        }
+      }
+      if (query.statement.hasError()) {
+        qWarning() << "Select delta blobs failed" << query.statement.errorMessage();
+        return false;
+      }
+    }
+    return true;
   }
 
+  {
+    QSqlQuery &sql = readQuery(SelectDeltas);
+    QueryFinisher finisher(sql);
+    sql.bindValue(":keyframe_id", idValue(measurement.keyframeId));
+    sql.bindValue(":time", timeValue(measurement.time));
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Select of delta data failed" << sql.lastError();
+      return false;
+    }
+    while (sql.next()) {
+      applyDelta(data, MeasurementData{qlonglong(idFromValue(sql.value("range_id"))),
+                                       varToLong(sql.value("rss")),
+                                       varToLong(sql.value("pss"))});
+    }
+  }
+  if (version >= 4) {
+    QSqlQuery &sql = readQuery(SelectDeltaBlobs);
+    QueryFinisher finisher(sql);
+    sql.bindValue(":keyframe_id", idValue(measurement.keyframeId));
+    sql.bindValue(":time", timeValue(measurement.time));
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Select of delta blobs failed" << sql.lastError();
+      return false;
+    }
+    while (sql.next()) {
+      rows.clear();
+      if (!decodeDataBlob(sql.value(0).toByteArray(), rows)) {
+        return false;
+      }
+      for (const MeasurementData &row: rows) {
+        applyDelta(data, row);
+      }
+    }
+  }
   return true;
 }
 
 bool Storage::lookupPid(pid_t pid, QMap<ProcessId, QString> &processes) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `process` WHERE pid = :pid;");
+  QSqlQuery &sql = readQuery(SelectProcessesByPid);
+  QueryFinisher finisher(sql);
 
   sql.bindValue(":pid", pid);
   sql.exec();
@@ -469,10 +1999,22 @@ bool Storage::lookupPid(pid_t pid, QMap<ProcessId, QString> &processes) {
 }
 
 bool Storage::getProcess(qulonglong processId, pid_t &pid, QString &processName) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `process` WHERE id = :id;");
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectProcess, ProcessColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":id", qlonglong(processId));
+    if (!query.statement.next()) {
+      return false;
+    }
+    pid = pid_t(query.value(ProcessPid));
+    processName = query.statement.columnString(query.columns[ProcessName]);
+    return true;
+  }
 
-  sql.bindValue(":id", processId);
+  QSqlQuery &sql = readQuery(SelectProcess);
+  QueryFinisher finisher(sql);
+
+  sql.bindValue(":id", idValue(processId));
   sql.exec();
   if (sql.lastError().isValid()) {
     qWarning() << "Select of process failed" << sql.lastError();
@@ -493,92 +2035,162 @@ bool Storage::getMemoryPeak(qulonglong processId, Measurement &measurement, Proc
     return false;
   }
 
-  QSqlQuery sql(db);
-
   // measurement
+  const char *statement;
   if (type == Rss) {
-    sql.prepare(QString("SELECT * FROM `measurement` WHERE process_id = :process_id AND rss_sum = ")
-                .append("(SELECT MAX(rss_sum) FROM `measurement` WHERE process_id = :process_id) LIMIT 1;"));
+    statement = SelectRssPeak;
   }else if (type == StatmRss){
-    sql.prepare(QString("SELECT * FROM `measurement` WHERE process_id = :process_id AND statm_resident = ")
-                .append("(SELECT MAX(statm_resident) FROM `measurement` WHERE process_id = :process_id) LIMIT 1;"));
+    statement = SelectStatmPeak;
   }else{
     assert(type == Pss);
-    sql.prepare(QString("SELECT * FROM `measurement` WHERE process_id = :process_id AND pss_sum = ")
-                .append("(SELECT MAX(pss_sum) FROM `measurement` WHERE process_id = :process_id) LIMIT 1;"));
+    statement = SelectPssPeak;
   }
-  sql.bindValue(":process_id", processId);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(statement, MeasurementColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":process_id", qlonglong(processId));
+    return execAndGetMeasurement(measurement, query, false);
+  }
+  QSqlQuery &sql = readQuery(statement);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":process_id", idValue(processId));
 
   return execAndGetMeasurement(measurement, sql, false);
 }
 
+bool Storage::getProcessPeaks(QHash<qulonglong, ProcessPeaks> &peaks)
+{
+  auto update = [](PeakValue &peak, qulonglong measurementId, qlonglong value) {
+    if (value > peak.value) {
+      peak.measurementId = measurementId;
+      peak.value = value;
+    }
+  };
+
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectAllPeakValues, {"id", "process_id", "rss_sum", "pss_sum", "statm_resident"});
+    StatementResetter resetter(query.statement);
+    while (query.statement.next()) {
+      qulonglong measurementId = qulonglong(query.value(0));
+      ProcessPeaks &processPeaks = peaks[qulonglong(query.value(1))];
+      update(processPeaks.rss, measurementId, query.value(2));
+      update(processPeaks.pss, measurementId, query.value(3));
+      update(processPeaks.statm, measurementId, query.value(4));
+    }
+    if (query.statement.hasError()) {
+      qWarning() << "Select peaks failed" << query.statement.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  QSqlQuery &sql = readQuery(SelectAllPeakValues);
+  QueryFinisher finisher(sql);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Select of measurements failed" << sql.lastError();
+    return false;
+  }
+  while (sql.next()) {
+    qulonglong measurementId = idFromValue(sql.value(0));
+    ProcessPeaks &processPeaks = peaks[idFromValue(sql.value(1))];
+    update(processPeaks.rss, measurementId, varToLong(sql.value(2)));
+    update(processPeaks.pss, measurementId, varToLong(sql.value(3)));
+    update(processPeaks.statm, measurementId, varToLong(sql.value(4)));
+  }
+  return true;
+}
+
 bool Storage::getSystemMemoryAtOrBefore(const QDateTime &time,
                                         QDateTime &exactTime,
                                         MemInfo &memInfo,
-                                        QList<Measurement> &processes) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `system_memory` WHERE "
-              "CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) <= CAST(STRFTIME('%s',:time, 'UTC') AS INTEGER) "
-              "ORDER BY CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) DESC "
-              "LIMIT 1;");
-  sql.bindValue(":time", time);
-  return execAndGetSystemMemory(sql, exactTime, memInfo, processes);
+                                        QList<Measurement> &processes,
+                                        bool withRanges) {
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectSystemAtOrBefore, SystemMemoryColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":time", time.toMSecsSinceEpoch());
+    return execAndGetSystemMemory(query, exactTime, memInfo, processes, withRanges);
+  }
+
+  QSqlQuery &sql = readQuery(version >= 2 ?
+                              SelectSystemAtOrBefore :
+                              "SELECT * FROM `system_memory` WHERE "
+                              "CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) <= CAST(STRFTIME('%s',:time, 'UTC') AS INTEGER) "
+                              "ORDER BY CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) DESC "
+                              "LIMIT 1;");
+  QueryFinisher finisher(sql);
+  sql.bindValue(":time", timeValue(time));
+  return execAndGetSystemMemory(sql, exactTime, memInfo, processes, withRanges);
 }
 
 bool Storage::getSystemMemoryAt(const QDateTime &time,
                                 MemInfo &memInfo,
-                                QList<Measurement> &processes) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `system_memory` WHERE `time` = :time LIMIT 1;");
-  sql.bindValue(":time", time);
+                                QList<Measurement> &processes,
+                                bool withRanges) {
   QDateTime timeOut;
-  return execAndGetSystemMemory(sql, timeOut, memInfo, processes);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectSystemAt, SystemMemoryColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":time", time.toMSecsSinceEpoch());
+    return execAndGetSystemMemory(query, timeOut, memInfo, processes, withRanges);
+  }
+
+  QSqlQuery &sql = readQuery(SelectSystemAt);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":time", timeValue(time));
+  return execAndGetSystemMemory(sql, timeOut, memInfo, processes, withRanges);
 }
 
 bool Storage::getSystemMemoryPeak(SystemMemoryType memoryType,
                                   QDateTime &time,
                                   MemInfo &memInfo,
-                                  QList<Measurement> &processes) {
-  QSqlQuery sql(db);
-  if (memoryType == MemAvailable) {
-    sql.prepare("SELECT * FROM `system_memory` ORDER BY `mem_available` ASC LIMIT 1;");
-  } else {
-    assert(memoryType == MemAvailableComputed);
-    sql.prepare(
-      "SELECT * FROM `system_memory` ORDER BY (`mem_free` + `buffers` + (`cached` - `shmem`) + `swap_cache` + `s_reclaimable`) ASC LIMIT 1;");
+                                  QList<Measurement> &processes,
+                                  bool withRanges) {
+  assert(memoryType == MemAvailable || memoryType == MemAvailableComputed);
+  const char *statement = memoryType == MemAvailable ? SelectSystemAvailablePeak : SelectSystemComputedPeak;
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(statement, SystemMemoryColumns);
+    StatementResetter resetter(query.statement);
+    return execAndGetSystemMemory(query, time, memInfo, processes, withRanges);
   }
-  return execAndGetSystemMemory(sql, time, memInfo, processes);
+
+  QSqlQuery &sql = readQuery(statement);
+  QueryFinisher finisher(sql);
+  return execAndGetSystemMemory(sql, time, memInfo, processes, withRanges);
 }
 
-bool Storage::execAndGetSystemMemory(QSqlQuery &sql, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes) {
+bool Storage::execAndGetSystemMemory(QSqlQuery &systemQuery, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes,
+                                     bool withRanges) {
 
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Select of system_memory failed" << sql.lastError();
+  systemQuery.exec();
+  if (systemQuery.lastError().isValid()) {
+    qWarning() << "Select of system_memory failed" << systemQuery.lastError();
     return false;
   }
-  if (!sql.next()) {
+  if (!systemQuery.next()) {
     return false;
   }
 
-  time = varToDateTime(sql.value("time"));
-  memInfo.memTotal = varToULong(sql.value("mem_total"));
-  memInfo.memFree = varToULong(sql.value("mem_free"));
-  memInfo.memAvailable = varToULong(sql.value("mem_available"));
-  memInfo.buffers = varToULong(sql.value("buffers"));
-  memInfo.cached = varToULong(sql.value("cached"));
-  memInfo.swapCache = varToULong(sql.value("swap_cache"));
-  memInfo.anonPages = varToULong(sql.value("anon_pages"));
-  memInfo.mapped = varToULong(sql.value("mapped"));
-  memInfo.swapTotal = varToULong(sql.value("swap_total"));
-  memInfo.swapFree = varToULong(sql.value("swap_free"));
-  memInfo.shmem = varToULong(sql.value("shmem"));
-  memInfo.slab = varToULong(sql.value("slab"));
-  memInfo.sReclaimable = varToULong(sql.value("s_reclaimable"));
-
-  sql.prepare(QString("SELECT `p`.`pid`, `p`.`start_time`, `p`.`name`, `m`.* ")
-              .append("FROM `measurement` AS `m` JOIN `process` AS `p` ON `p`.id == `m`.`process_id` WHERE `time` == :time"));
-  sql.bindValue(":time", time);
+  time = timeFromValue(systemQuery.value("time"));
+  memInfo.memTotal = varToULong(systemQuery.value("mem_total"));
+  memInfo.memFree = varToULong(systemQuery.value("mem_free"));
+  memInfo.memAvailable = varToULong(systemQuery.value("mem_available"));
+  memInfo.buffers = varToULong(systemQuery.value("buffers"));
+  memInfo.cached = varToULong(systemQuery.value("cached"));
+  memInfo.swapCache = varToULong(systemQuery.value("swap_cache"));
+  memInfo.anonPages = varToULong(systemQuery.value("anon_pages"));
+  memInfo.mapped = varToULong(systemQuery.value("mapped"));
+  memInfo.swapTotal = varToULong(systemQuery.value("swap_total"));
+  memInfo.swapFree = varToULong(systemQuery.value("swap_free"));
+  memInfo.shmem = varToULong(systemQuery.value("shmem"));
+  memInfo.slab = varToULong(systemQuery.value("slab"));
+  memInfo.sReclaimable = varToULong(systemQuery.value("s_reclaimable"));
+  systemQuery.finish();
+
+  QSqlQuery &sql = readQuery(SelectSystemProcesses);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":time", timeValue(time));
   sql.exec();
   if (sql.lastError().isValid()) {
     qWarning() << "Select of measurement failed" << sql.lastError();
@@ -588,7 +2200,8 @@ bool Storage::execAndGetSystemMemory(QSqlQuery &sql, QDateTime &time, MemInfo &m
     Measurement measurement;
     measurement.pid = varToULong(sql.value("pid"));
     measurement.processName = varToString(sql.value("name"));
-    if (!getMeasurement(measurement, sql, false)) {
+    decodeMeasurement(sql, measurement);
+    if (withRanges && !getMeasurementDetails(measurement, false)) {
       qWarning() << "Select of measurement failed" << sql.lastError();
       return false;
     }
@@ -597,10 +2210,53 @@ bool Storage::execAndGetSystemMemory(QSqlQuery &sql, QDateTime &time, MemInfo &m
   return true;
 }
 
+bool Storage::execAndGetSystemMemory(NativeQuery &systemQuery, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes,
+                                     bool withRanges) {
+  if (!systemQuery.statement.next()) {
+    return false;
+  }
+
+  time = QDateTime::fromMSecsSinceEpoch(systemQuery.value(SystemTime));
+  memInfo.memTotal = systemQuery.value(SystemMemTotal);
+  memInfo.memFree = systemQuery.value(SystemMemFree);
+  memInfo.memAvailable = systemQuery.value(SystemMemAvailable);
+  memInfo.buffers = systemQuery.value(SystemBuffers);
+  memInfo.cached = systemQuery.value(SystemCached);
+  memInfo.swapCache = systemQuery.value(SystemSwapCache);
+  memInfo.anonPages = systemQuery.value(SystemAnonPages);
+  memInfo.mapped = systemQuery.value(SystemMapped);
+  memInfo.swapTotal = systemQuery.value(SystemSwapTotal);
+  memInfo.swapFree = systemQuery.value(SystemSwapFree);
+  memInfo.shmem = systemQuery.value(SystemShmem);
+  memInfo.slab = systemQuery.value(SystemSlab);
+  memInfo.sReclaimable = systemQuery.value(SystemSReclaimable);
+  systemQuery.statement.reset();
+
+  NativeQuery &query = nativeQuery(SelectSystemProcesses, MeasurementColumns);
+  StatementResetter resetter(query.statement);
+  query.statement.bind(":time", time.toMSecsSinceEpoch());
+  while (query.statement.next()) {
+    Measurement measurement;
+    decodeMeasurement(query, measurement);
+    measurement.pid = pid_t(query.value(MeasurementPid));
+    measurement.processName = query.statement.columnString(query.columns[MeasurementProcessName]);
+    if (withRanges && !getMeasurementDetails(measurement, false)) {
+      qWarning() << "Select of measurement failed";
+      return false;
+    }
+    processes << measurement;
+  }
+  if (query.statement.hasError()) {
+    qWarning() << "Select processes failed" << query.statement.errorMessage();
+    return false;
+  }
+  return true;
+}
+
 qint64 Storage::measurementCount()
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT COUNT(*) AS `cnt` FROM `measurement`");
+  QSqlQuery &sql = readQuery("SELECT COUNT(*) AS `cnt` FROM `measurement`");
+  QueryFinisher finisher(sql);
   sql.exec();
   if (sql.lastError().isValid()) {
     qWarning() << "Select count of measurements failed" << sql.lastError();
@@ -610,6 +2266,38 @@ qint64 Storage::measurementCount()
   return varToLong(sql.value("cnt"));
 }
 
+bool Storage::getFirstTime(QDateTime &time)
+{
+  for (const char *statement: {SelectFirstSystemTime, SelectFirstMeasurementTime}) {
+    QSqlQuery &sql = readQuery(statement);
+    QueryFinisher finisher(sql);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Select of first time failed" << sql.lastError();
+      return false;
+    }
+    if (sql.next() && !sql.value("time").isNull()) {
+      time = timeFromValue(sql.value("time"));
+      return true;
+    }
+  }
+  time = QDateTime();
+  return true;
+}
+
+bool Storage::containsMeasurement(qlonglong id)
+{
+  QSqlQuery &sql = readQuery(SelectMeasurementExists);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":id", id);
+  sql.exec();
+  if (sql.lastError().isValid()) {
+    qWarning() << "Select of measurement failed" << sql.lastError();
+    return false;
+  }
+  return sql.next();
+}
+
 bool Storage::getMeasurementAtOrBefore(qulonglong processId,
                                        const QDateTime &time,
                                        Measurement &measurement,
@@ -620,13 +2308,23 @@ bool Storage::getMeasurementAtOrBefore(qulonglong processId,
     return false;
   }
 
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `measurement` WHERE `process_id` = :process_id AND "
-              "CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) <= CAST(STRFTIME('%s',:time, 'UTC') AS INTEGER) "
-              "ORDER BY CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) DESC "
-              "LIMIT 1;");
-  sql.bindValue(":process_id", processId);
-  sql.bindValue(":time", time);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectMeasurementAtOrBefore, MeasurementColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":process_id", qlonglong(processId));
+    query.statement.bind(":time", time.toMSecsSinceEpoch());
+    return execAndGetMeasurement(measurement, query, cacheRanges);
+  }
+
+  QSqlQuery &sql = readQuery(version >= 2 ?
+                              SelectMeasurementAtOrBefore :
+                              "SELECT * FROM `measurement` WHERE `process_id` = :process_id AND "
+                              "CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) <= CAST(STRFTIME('%s',:time, 'UTC') AS INTEGER) "
+                              "ORDER BY CAST(STRFTIME('%s',`time`, 'UTC') AS INTEGER) DESC "
+                              "LIMIT 1;");
+  QueryFinisher finisher(sql);
+  sql.bindValue(":process_id", idValue(processId));
+  sql.bindValue(":time", timeValue(time));
   return execAndGetMeasurement(measurement, sql, cacheRanges);
 }
 
@@ -640,25 +2338,54 @@ bool Storage::getMeasurementAt(qulonglong processId,
     return false;
   }
 
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `measurement` WHERE `process_id` = :process_id AND `time` = :time;");
-  sql.bindValue(":process_id", processId);
-  sql.bindValue(":time", time);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectMeasurementAt, MeasurementColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":process_id", qlonglong(processId));
+    query.statement.bind(":time", time.toMSecsSinceEpoch());
+    return execAndGetMeasurement(measurement, query, cacheRanges);
+  }
+
+  QSqlQuery &sql = readQuery(SelectMeasurementAt);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":process_id", idValue(processId));
+  sql.bindValue(":time", timeValue(time));
   return execAndGetMeasurement(measurement, sql, cacheRanges);
 }
 
 bool Storage::getMeasurement(Measurement &measurement, qlonglong &id, bool cacheRanges)
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `measurement` WHERE `id` = :id;");
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectMeasurement, MeasurementColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":id", id);
+    return execAndGetMeasurement(measurement, query, cacheRanges);
+  }
+
+  QSqlQuery &sql = readQuery(SelectMeasurement);
+  QueryFinisher finisher(sql);
   sql.bindValue(":id", id);
   return execAndGetMeasurement(measurement, sql, cacheRanges);
 }
 
 bool Storage::getMeasurementTimes(qulonglong processId, QList<QDateTime> &times) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `time` FROM `measurement` WHERE `process_id` = :process_id ORDER BY `time`");
-  sql.bindValue(":process_id", processId);
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectProcessTimes, TimeColumns);
+    StatementResetter resetter(query.statement);
+    query.statement.bind(":process_id", qlonglong(processId));
+    while (query.statement.next()) {
+      times << QDateTime::fromMSecsSinceEpoch(query.value(0));
+    }
+    if (query.statement.hasError()) {
+      qWarning() << "Select times failed" << query.statement.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  QSqlQuery &sql = readQuery(SelectProcessTimes);
+  QueryFinisher finisher(sql);
+  sql.bindValue(":process_id", idValue(processId));
   sql.exec();
   if (sql.lastError().isValid()) {
     qWarning() << "Select ranges failed" << sql.lastError();
@@ -666,15 +2393,28 @@ bool Storage::getMeasurementTimes(qulonglong processId, QList<QDateTime> &times)
   }
 
   while (sql.next()) {
-    times << varToDateTime(sql.value("time"));
+    times << timeFromValue(sql.value("time"));
   }
 
   return true;
 }
 
 bool Storage::getMeasurementTimes(QList<QDateTime> &times) {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `time` FROM `system_memory` ORDER BY `time`");
+  if (nativeReads) {
+    NativeQuery &query = nativeQuery(SelectSystemTimes, TimeColumns);
+    StatementResetter resetter(query.statement);
+    while (query.statement.next()) {
+      times << QDateTime::fromMSecsSinceEpoch(query.value(0));
+    }
+    if (query.statement.hasError()) {
+      qWarning() << "Select times failed" << query.statement.errorMessage();
+      return false;
+    }
+    return true;
+  }
+
+  QSqlQuery &sql = readQuery(SelectSystemTimes);
+  QueryFinisher finisher(sql);
   sql.exec();
   if (sql.lastError().isValid()) {
     qWarning() << "Select ranges failed" << sql.lastError();
@@ -682,8 +2422,688 @@ bool Storage::getMeasurementTimes(QList<QDateTime> &times) {
   }
 
   while (sql.next()) {
-    times << varToDateTime(sql.value("time"));
+    times << timeFromValue(sql.value("time"));
+  }
+
+  return true;
+}
+
+bool Storage::getMeasurementSeries(qulonglong processId,
+                                   const QDateTime &from,
+                                   const QDateTime &to,
+                                   const std::function<bool(const Measurement&)> &callback)
+{
+  MeasurementSeries series(*this, processId, from, to);
+  if (!series.isValid()) {
+    return false;
+  }
+  Measurement measurement;
+  while (series.next(measurement)) {
+    if (!callback(measurement)) {
+      return true;
+    }
+  }
+  return !series.hasError();
+}
+
+MeasurementSeries::MeasurementSeries(Storage &storage,
+                                     qulonglong processId,
+                                     const QDateTime &from,
+                                     const QDateTime &to):
+  storage(storage),
+  native(storage.nativeReads)
+{
+  if (!storage.getProcess(processId, pid, processName)) {
+    qWarning() << "Failed to read process details";
+    return;
+  }
+  if (!storage.getAllRanges(processId, ranges)) {
+    return;
+  }
+
+  const char *statement = storage.version >= 4 ? SelectMeasurementSeries : SelectMeasurementSeriesV3;
+  if (native) {
+    if (!nativeQuery.statement.prepare(storage.handle, statement)) {
+      return;
+    }
+    for (const char *column: seriesColumns()) {
+      nativeQuery.columns.push_back(nativeQuery.statement.columnIndex(column));
+    }
+    nativeQuery.statement.bind(":process_id", qlonglong(processId));
+    nativeQuery.statement.bind(":from", from.toMSecsSinceEpoch());
+    nativeQuery.statement.bind(":to", to.toMSecsSinceEpoch());
+  } else {
+    query = QSqlQuery(storage.db);
+    query.setForwardOnly(true);
+    query.prepare(statement);
+    query.bindValue(":process_id", storage.idValue(processId));
+    query.bindValue(":from", storage.timeValue(from));
+    query.bindValue(":to", storage.timeValue(to));
+    if (!query.exec()) {
+      qWarning() << "Select of measurement series failed" << query.lastError();
+      return;
+    }
+  }
+  valid = true;
+  hasRow = step();
+}
+
+MeasurementSeries::~MeasurementSeries()
+{
+  // query keeps the connection in use
+  nativeQuery.statement.finalize();
+  query = QSqlQuery();
+}
+
+bool MeasurementSeries::step()
+{
+  if (native ? nativeQuery.statement.next() : query.next()) {
+    return true;
+  }
+  if (native ? nativeQuery.statement.hasError() : query.lastError().isValid()) {
+    qWarning() << "Read of measurement series failed"
+               << (native ? nativeQuery.statement.errorMessage() : query.lastError().text());
+    failed = true;
+  }
+  return false;
+}
+
+qulonglong MeasurementSeries::rowMeasurementId() const
+{
+  return native ?
+         qulonglong(nativeQuery.value(MeasurementId)) :
+         storage.idFromValue(query.value("id"));
+}
+
+bool MeasurementSeries::next(Measurement &measurement)
+{
+  if (!hasRow) {
+    return false;
+  }
+  if (native) {
+    Storage::decodeMeasurement(nativeQuery, measurement);
+  } else {
+    storage.decodeMeasurement(query, measurement);
+  }
+  measurement.pid = pid;
+  measurement.processName = processName;
+  measurement.rangeMap = ranges;
+  measurement.data.clear();
+
+  // measurements without data (smaps_rollup samples) have single row with null data columns,
+  // measurement with data blob has single row too
+  bool blobs = storage.version >= 4;
+  do {
+    MeasurementData data;
+    if (native) {
+      if (blobs && !nativeQuery.statement.isNull(nativeQuery.columns[SeriesBlob])) {
+        if (!storage.decodeDataBlob(nativeQuery.statement.columnBlob(nativeQuery.columns[SeriesBlob]), measurement.data)) {
+          failed = true;
+          hasRow = false;
+          return false;
+        }
+        continue;
+      }
+      if (nativeQuery.statement.isNull(nativeQuery.columns[SeriesRangeId])) {
+        continue;
+      }
+      data.rangeId = nativeQuery.value(SeriesRangeId);
+      data.rss = nativeQuery.value(SeriesRss);
+      data.pss = nativeQuery.value(SeriesPss);
+    } else {
+      if (blobs) {
+        QVariant blob = query.value("blob");
+        if (!blob.isNull()) {
+          if (!storage.decodeDataBlob(blob.toByteArray(), measurement.data)) {
+            failed = true;
+            hasRow = false;
+            return false;
+          }
+          continue;
+        }
+      }
+      QVariant rangeId = query.value("range_id");
+      if (rangeId.isNull()) {
+        continue;
+      }
+      data.rangeId = storage.idFromValue(rangeId);
+      data.rss = varToLong(query.value("rss"));
+      data.pss = varToLong(query.value("pss"));
+    }
+    measurement.data << data;
+  } while ((hasRow = step()) && rowMeasurementId() == measurement.id);
+  if (failed) {
+    // rows of the measurement may be incomplete
+    return false;
   }
 
+  if (measurement.keyframeId == 0) {
+    if (measurement.sampleType == FullSmaps) {
+      keyframeId = measurement.id;
+      keyframeData = measurement.data;
+    }
+    return true;
+  }
+  if (chainKeyframeId != measurement.keyframeId) {
+    chainKeyframeId = measurement.keyframeId;
+    chainData.clear();
+    if (keyframeId != measurement.keyframeId) {
+      // series starts after the keyframe
+      if (!storage.getDeltaData(measurement, chainData)) {
+        chainKeyframeId = 0;
+        failed = true;
+        hasRow = false;
+        return false;
+      }
+      measurement.data = chainData.values();
+      return true;
+    }
+    for (const MeasurementData &data: keyframeData) {
+      chainData.insert(data.rangeId, data);
+    }
+  }
+  for (const MeasurementData &data: measurement.data) {
+    applyDelta(chainData, data);
+  }
+  measurement.data = chainData.values();
   return true;
 }
+
+#ifdef UNIT_TESTS
+
+#include "BinLogWriter.h"
+#include "TestFixture.h"
+
+#include <catch2/catch.hpp>
+
+#include <QRegularExpression>
+#include <QTemporaryDir>
+
+TEST_CASE("analysis queries are resolved by indexes") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  QString file = dir.filePath("measurement.db");
+  {
+    Storage storage;
+    REQUIRE(storage.init(file));
+  }
+  {
+    Storage storage;
+    REQUIRE(storage.init(file, StorageMode::ReadOnly));
+    REQUIRE(storage.ensureIndexes());
+  }
+
+  sqlite3 *db = nullptr;
+  REQUIRE(sqlite3_open_v2(file.toUtf8().constData(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK);
+
+  // full scan of system_memory is expected when all times are selected, but they should not be sorted
+  QRegularExpression fullScan("^SCAN (TABLE )?\\S+$");
+  for (const char *sql: {SelectProcessesByPid, SelectProcess, SelectRangesOfProcess, SelectRangesOfMeasurement,
+                         SelectData, SelectRssPeak, SelectPssPeak, SelectStatmPeak, SelectSystemAtOrBefore,
+                         SelectSystemAt, SelectSystemAvailablePeak, SelectSystemComputedPeak, SelectSystemProcesses,
+                         SelectMeasurementAtOrBefore, SelectMeasurementAt, SelectMeasurement, SelectProcessTimes,
+                         SelectSystemTimes, SelectMeasurementSeries, SelectDeltas,
+                         SelectDataBlob, SelectReferenceBlob, SelectDeltaBlobs, SelectFirstSystemTime,
+                         SelectFirstMeasurementTime, SelectMeasurementExists}) {
+    SqliteStatement plan;
+    REQUIRE(plan.prepare(db, QString("EXPLAIN QUERY PLAN ") + sql));
+    while (plan.next()) {
+      QString detail = plan.columnString(3);
+      INFO(sql << " -> " << detail.toStdString());
+      CHECK(!detail.contains("TEMP B-TREE"));
+      if (sql != SelectSystemTimes) {
+        CHECK(!fullScan.match(detail).hasMatch());
+      }
+    }
+  }
+
+  sqlite3_close(db);
+}
+
+TEST_CASE("index creation doesn't wait for recorder") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  QString file = dir.filePath("measurement.db");
+  {
+    Storage storage;
+    REQUIRE(storage.init(file));
+  }
+
+  // index is missing and another connection holds the write lock
+  sqlite3 *db = nullptr;
+  REQUIRE(sqlite3_open_v2(file.toUtf8().constData(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK);
+  REQUIRE(sqlite3_exec(db, "DROP INDEX `idx_measurement_time`; BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK);
+  {
+    Storage storage;
+    REQUIRE(storage.init(file, StorageMode::ReadOnly));
+    CHECK(!storage.ensureIndexes());
+  }
+  REQUIRE(sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr) == SQLITE_OK);
+  sqlite3_close(db);
+  {
+    Storage storage;
+    REQUIRE(storage.init(file, StorageMode::ReadOnly));
+    CHECK(storage.ensureIndexes());
+  }
+
+  // recording with write-ahead log in progress
+  QString walFile = dir.filePath("wal.db");
+  Storage recorder;
+  REQUIRE(recorder.init(walFile, StorageMode::Wal));
+  REQUIRE(sqlite3_open_v2(walFile.toUtf8().constData(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK);
+  REQUIRE(sqlite3_exec(db, "DROP INDEX `idx_measurement_time`;", nullptr, nullptr, nullptr) == SQLITE_OK);
+  sqlite3_close(db);
+  {
+    Storage storage;
+    REQUIRE(storage.init(walFile, StorageMode::ReadOnly));
+    CHECK(!storage.ensureIndexes());
+  }
+}
+
+TEST_CASE("measurement ids grow in order of inserts") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  Storage storage;
+  REQUIRE(storage.init(dir.filePath("measurement.db")));
+
+  ProcessId processId = TestFixture::processId();
+  ProcessId other(43, ProcessId::StartTime(1234));
+  QList<SmapsRange> ranges = TestFixture::ranges(3);
+  REQUIRE(TestFixture::insertProcess(storage, ranges));
+  REQUIRE(storage.insertOrIgnoreProcess(other, "other"));
+
+  // processes of one tick are measured at the same time
+  QDateTime start = TestFixture::start();
+  qlonglong previous = 0;
+  for (int tick = 0; tick < 3; tick++) {
+    for (const ProcessId &id: {processId, other}) {
+      qlonglong measurementId = storage.insertMeasurement(id, start.addSecs(tick), FullSmaps, 1, 1, StatM{}, OomScore{});
+      REQUIRE(measurementId > previous);
+      previous = measurementId;
+    }
+    REQUIRE(storage.insertData(processId, start.addSecs(tick), ranges));
+  }
+  // even when the time goes back
+  REQUIRE(storage.insertMeasurement(other, start.addSecs(-10), FullSmaps, 1, 1, StatM{}, OomScore{}) > previous);
+
+  // data belong to the last measurement of the process
+  REQUIRE(!storage.insertData(processId, start, ranges));
+  REQUIRE(!storage.insertData(other, start.addSecs(2), ranges));
+  // process has single measurement per time
+  REQUIRE(storage.insertMeasurement(processId, start.addSecs(1), FullSmaps, 1, 1, StatM{}, OomScore{}) == 0);
+  REQUIRE(!storage.insertData(processId, start.addSecs(2), ranges));
+  REQUIRE(storage.commit());
+
+  Measurement measurement;
+  REQUIRE(storage.getMeasurementAt(processId.hash(), start.addSecs(2), measurement));
+  REQUIRE(measurement.data.size() == ranges.size());
+  REQUIRE(storage.getMeasurementAt(other.hash(), start.addSecs(2), measurement));
+  REQUIRE(measurement.data.isEmpty());
+}
+
+TEST_CASE("native reads decode the same values as QtSql") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  Storage storage;
+  REQUIRE(storage.init(dir.filePath("measurement.db")));
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(3);
+  QDateTime time = TestFixture::start().addMSecs(123);
+  StatM statm;
+  statm.resident = 100;
+  statm.size = 200;
+  OomScore oomScore;
+  oomScore.score = 5;
+  oomScore.scoreAdj = -3;
+  MemInfo memInfo;
+  memInfo.memTotal = 1000;
+  memInfo.memAvailable = 500;
+  memInfo.sReclaimable = 7;
+
+  REQUIRE(TestFixture::insertProcess(storage, ranges));
+  qlonglong measurementId = storage.insertMeasurement(processId, time, FullSmaps, 12, 6, statm, oomScore);
+  REQUIRE(measurementId != 0);
+  REQUIRE(storage.insertData(processId, time, ranges));
+  REQUIRE(storage.insertSystemMemInfo(time, memInfo));
+  REQUIRE(storage.commit());
+
+  if (!storage.setNativeReads(true)) {
+    WARN("Native reads are not available");
+    return;
+  }
+  Measurement native;
+  REQUIRE(storage.getMeasurementAt(processId.hash(), time, native));
+  MemInfo nativeMemInfo;
+  QList<Measurement> nativeProcesses;
+  REQUIRE(storage.getSystemMemoryAt(time, nativeMemInfo, nativeProcesses, true));
+
+  storage.setNativeReads(false);
+  Measurement qtSql;
+  REQUIRE(storage.getMeasurementAt(processId.hash(), time, qtSql));
+  MemInfo qtSqlMemInfo;
+  QList<Measurement> qtSqlProcesses;
+  REQUIRE(storage.getSystemMemoryAt(time, qtSqlMemInfo, qtSqlProcesses, true));
+
+  for (const Measurement *m: {&native, &qtSql}) {
+    REQUIRE(m->id == qulonglong(measurementId));
+    REQUIRE(m->processId == processId.hash());
+    REQUIRE(m->pid == 42);
+    REQUIRE(m->processName == "test");
+    REQUIRE(m->time == time);
+    REQUIRE(m->rssSum == 12);
+    REQUIRE(m->pssSum == 6);
+    REQUIRE(m->statm.resident == 100);
+    REQUIRE(m->statm.size == 200);
+    REQUIRE(m->oomScore.score == 5);
+    REQUIRE(m->oomScore.scoreAdj == -3);
+    REQUIRE(m->data.size() == ranges.size());
+    REQUIRE(m->rangeMap.size() == ranges.size());
+  }
+  for (int i = 0; i < native.data.size(); i++) {
+    const MeasurementData &data = native.data[i];
+    REQUIRE(data.rangeId == qtSql.data[i].rangeId);
+    REQUIRE(data.rss == qtSql.data[i].rss);
+    REQUIRE(data.pss == qtSql.data[i].pss);
+    const Range &range = native.rangeMap[data.rangeId];
+    REQUIRE(range.from == qtSql.rangeMap[data.rangeId].from);
+    REQUIRE(range.to == qtSql.rangeMap[data.rangeId].to);
+    REQUIRE(range.permission == qtSql.rangeMap[data.rangeId].permission);
+    REQUIRE(range.name == qtSql.rangeMap[data.rangeId].name);
+  }
+
+  REQUIRE(nativeMemInfo.memTotal == 1000);
+  REQUIRE(qtSqlMemInfo.memTotal == 1000);
+  REQUIRE(nativeMemInfo.memAvailable == qtSqlMemInfo.memAvailable);
+  REQUIRE(nativeMemInfo.sReclaimable == qtSqlMemInfo.sReclaimable);
+  REQUIRE(nativeProcesses.size() == 1);
+  REQUIRE(qtSqlProcesses.size() == 1);
+  REQUIRE(nativeProcesses.first().pid == qtSqlProcesses.first().pid);
+  REQUIRE(nativeProcesses.first().processName == qtSqlProcesses.first().processName);
+  REQUIRE(nativeProcesses.first().data.size() == qtSqlProcesses.first().data.size());
+
+  // summary without ranges
+  QList<Measurement> summary;
+  REQUIRE(storage.getSystemMemoryAt(time, qtSqlMemInfo, summary));
+  REQUIRE(summary.size() == 1);
+  REQUIRE(summary.first().statm.resident == 100);
+  REQUIRE(summary.first().pssSum == 6);
+  REQUIRE(summary.first().data.isEmpty());
+  REQUIRE(summary.first().rangeMap.isEmpty());
+}
+
+TEST_CASE("measurement series groups data rows by measurement") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  Storage storage;
+  REQUIRE(storage.init(dir.filePath("measurement.db")));
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(4);
+  REQUIRE(TestFixture::insertProcess(storage, ranges));
+  QDateTime start = TestFixture::start();
+  for (int i = 0; i < 5; i++) {
+    QDateTime time = start.addSecs(i);
+    // the middle one is smaps_rollup sample, without data
+    REQUIRE(storage.insertMeasurement(processId, time, i == 2 ? SmapsRollup : FullSmaps, i, i, StatM{}, OomScore{}) != 0);
+    if (i != 2) {
+      REQUIRE(storage.insertData(processId, time, ranges.mid(0, i + 1)));
+    }
+  }
+  REQUIRE(storage.commit());
+
+  for (bool native: {true, false}) {
+    storage.setNativeReads(native);
+    QList<Measurement> series;
+    REQUIRE(storage.getMeasurementSeries(processId.hash(), start.addSecs(1), start.addSecs(4),
+                                         [&](const Measurement &measurement) {
+                                           series << measurement;
+                                           return series.size() < 3;
+                                         }));
+    REQUIRE(series.size() == 3);
+    REQUIRE(series[0].time == start.addSecs(1));
+    REQUIRE(series[0].data.size() == 2);
+    REQUIRE(series[1].sampleType == SmapsRollup);
+    REQUIRE(series[1].data.isEmpty());
+    REQUIRE(series[2].time == start.addSecs(3));
+    REQUIRE(series[2].data.size() == 4);
+    REQUIRE(series[2].rangeMap.size() == 4);
+    REQUIRE(series[2].pid == 42);
+  }
+}
+
+TEST_CASE("delta recording rebuilds full measurements") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+  Storage storage;
+  REQUIRE(storage.init(dir.filePath("measurement.db")));
+  storage.setDeltaRecording(3);
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(4);
+  REQUIRE(TestFixture::insertProcess(storage, ranges));
+
+  // keyframes are the first and the fourth full measurement, rollup sample is not part of the chain
+  QDateTime start = TestFixture::start();
+  QList<QList<SmapsRange>> snapshots;
+  snapshots << ranges.mid(0, 3);
+  snapshots << snapshots.last();
+  snapshots.last()[1].rss = 100; // changed
+  snapshots << snapshots.last();
+  snapshots.last().removeAt(0); // disappeared
+  snapshots.last() << ranges[3]; // appeared
+  snapshots << QList<SmapsRange>(); // rollup
+  snapshots << snapshots[2];
+  snapshots.last()[0].pss = 1;
+  snapshots << snapshots.last();
+  for (int i = 0; i < snapshots.size(); i++) {
+    QDateTime time = start.addSecs(i);
+    SampleType sampleType = i == 3 ? SmapsRollup : FullSmaps;
+    REQUIRE(storage.insertMeasurement(processId, time, sampleType, i, i, StatM{}, OomScore{}) != 0);
+    if (sampleType == FullSmaps) {
+      REQUIRE(storage.insertData(processId, time, snapshots[i]));
+    }
+  }
+  REQUIRE(storage.commit());
+
+  auto expected = [&](int i) {
+    QMap<qlonglong, MeasurementData> data;
+    for (const SmapsRange &range: snapshots[i]) {
+      data.insert(qlonglong(range.key.hash()), MeasurementData{qlonglong(range.key.hash()), qlonglong(range.rss), qlonglong(range.pss)});
+    }
+    return data.values();
+  };
+  auto requireData = [](const QList<MeasurementData> &data, const QList<MeasurementData> &expectedData) {
+    REQUIRE(data.size() == expectedData.size());
+    for (int j = 0; j < data.size(); j++) {
+      REQUIRE(data[j].rangeId == expectedData[j].rangeId);
+      REQUIRE(data[j].rss == expectedData[j].rss);
+      REQUIRE(data[j].pss == expectedData[j].pss);
+    }
+  };
+
+  for (bool native: {true, false}) {
+    storage.setNativeReads(native);
+    for (int i = 0; i < snapshots.size(); i++) {
+      Measurement measurement;
+      REQUIRE(storage.getMeasurementAt(processId.hash(), start.addSecs(i), measurement));
+      REQUIRE((measurement.keyframeId == 0) == (i == 0 || i == 3 || i == 4));
+      requireData(measurement.data, expected(i));
+      REQUIRE(measurement.rangeMap.size() == expected(i).size());
+    }
+
+    // series starting in the middle of the chain
+    int i = 1;
+    REQUIRE(storage.getMeasurementSeries(processId.hash(), start.addSecs(1), start.addSecs(5),
+                                         [&](const Measurement &measurement) {
+                                           requireData(measurement.data, expected(i++));
+                                           return true;
+                                         }));
+    REQUIRE(i == snapshots.size());
+  }
+}
+
+TEST_CASE("data blobs are read as data rows") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(3);
+  QList<QList<SmapsRange>> snapshots;
+  snapshots << ranges;
+  snapshots << ranges.mid(1);
+  snapshots.last()[0].rss = 100;
+  snapshots << QList<SmapsRange>(); // without mappings
+  snapshots << ranges;
+
+  QDateTime start = TestFixture::start();
+  for (DataFormat format: {DataFormat::Blob, DataFormat::CompressedBlob}) {
+    for (int keyframeInterval: {0, 2}) {
+      QString file = dir.filePath(QString("measurement-%1-%2.db").arg(int(format)).arg(keyframeInterval));
+      INFO("format " << int(format) << ", keyframe interval " << keyframeInterval);
+      Storage storage;
+      REQUIRE(storage.init(file));
+      storage.setDataFormat(format);
+      storage.setDeltaRecording(keyframeInterval);
+      REQUIRE(TestFixture::insertProcess(storage, ranges));
+      for (int i = 0; i < snapshots.size(); i++) {
+        QDateTime time = start.addSecs(i);
+        REQUIRE(storage.insertMeasurement(processId, time, FullSmaps, i, i, StatM{}, OomScore{}) != 0);
+        REQUIRE(storage.insertData(processId, time, snapshots[i]));
+      }
+      REQUIRE(storage.commit());
+
+      auto requireData = [&](const Measurement &measurement, int i) {
+        QMap<qlonglong, SmapsRange> expected;
+        for (const SmapsRange &range: snapshots[i]) {
+          expected.insert(qlonglong(range.key.hash()), range);
+        }
+        REQUIRE(measurement.data.size() == expected.size());
+        int j = 0;
+        for (auto it = expected.cbegin(); it != expected.cend(); ++it, ++j) {
+          REQUIRE(measurement.data[j].rangeId == it.key());
+          REQUIRE(measurement.data[j].rss == qlonglong(it->rss));
+          REQUIRE(measurement.data[j].pss == qlonglong(it->pss));
+        }
+      };
+
+      for (bool native: {true, false}) {
+        storage.setNativeReads(native);
+        for (int i = 0; i < snapshots.size(); i++) {
+          Measurement measurement;
+          REQUIRE(storage.getMeasurementAt(processId.hash(), start.addSecs(i), measurement));
+          requireData(measurement, i);
+          REQUIRE(measurement.rangeMap.size() == snapshots[i].size());
+        }
+
+        int i = 0;
+        REQUIRE(storage.getMeasurementSeries(processId.hash(), start, start.addSecs(snapshots.size()),
+                                             [&](const Measurement &measurement) {
+                                               requireData(measurement, i++);
+                                               return true;
+                                             }));
+        REQUIRE(i == snapshots.size());
+      }
+
+      sqlite3 *db = nullptr;
+      REQUIRE(sqlite3_open_v2(file.toUtf8().constData(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK);
+      // the second blob refers ranges of the first one, the last one follows measurement
+      // without ranges, so it is self-contained
+      SqliteStatement referenced;
+      REQUIRE(referenced.prepare(db, QString("SELECT COUNT(*) FROM `data_blob` "
+                                             "WHERE hex(substr(`value`, 1, 1)) IN ('02', '03')")));
+      REQUIRE(referenced.next());
+      REQUIRE(referenced.columnLong(0) == 1);
+      referenced.finalize();
+
+      // corrupted blob is reported as error, not as the end of series
+      REQUIRE(sqlite3_exec(db, "UPDATE `data_blob` SET `value` = x'00ff';", nullptr, nullptr, nullptr) == SQLITE_OK);
+      sqlite3_close(db);
+      for (bool native: {true, false}) {
+        storage.setNativeReads(native);
+        REQUIRE(!storage.getMeasurementSeries(processId.hash(), start, start.addSecs(snapshots.size()),
+                                              [](const Measurement &) { return true; }));
+        MeasurementSeries series(storage, processId.hash(), start, start.addSecs(snapshots.size()));
+        REQUIRE(series.isValid());
+        Measurement measurement;
+        while (series.next(measurement)) {}
+        REQUIRE(series.hasError());
+      }
+    }
+  }
+}
+
+TEST_CASE("binary log is imported to database") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(2);
+  QDateTime time = TestFixture::start();
+  StatM statm;
+  statm.resident = 12;
+  OomScore oomScore;
+  oomScore.score = 7;
+  MemInfo memInfo;
+  memInfo.memTotal = 2048;
+  memInfo.memAvailable = 1024;
+  {
+    BinLogWriter writer;
+    REQUIRE(writer.init(dir.filePath("binlog"), 1024 * 1024));
+    REQUIRE(TestFixture::insertProcess(writer, ranges));
+    REQUIRE(writer.insertMeasurement(processId, time, FullSmaps, 12, 6, statm, oomScore));
+    REQUIRE(writer.insertData(processId, time, ranges));
+    REQUIRE(writer.insertSystemMemInfo(time, memInfo));
+    REQUIRE(writer.insertRecorderStats(time, {{"watchers", 1}}));
+    REQUIRE(writer.commit());
+  }
+
+  Storage storage;
+  REQUIRE(storage.init(dir.filePath("measurement.db")));
+  REQUIRE(storage.importBinLog(dir.filePath("binlog")));
+
+  pid_t pid = 0;
+  QString processName;
+  REQUIRE(storage.getProcess(processId.hash(), pid, processName));
+  REQUIRE(pid == processId.pid);
+  REQUIRE(processName == "test");
+
+  Measurement measurement;
+  REQUIRE(storage.getMeasurementAt(processId.hash(), time, measurement));
+  REQUIRE(measurement.rssSum == 12);
+  REQUIRE(measurement.pssSum == 6);
+  REQUIRE(measurement.statm.resident == 12);
+  REQUIRE(measurement.oomScore.score == 7);
+  REQUIRE(measurement.data.size() == ranges.size());
+  for (const SmapsRange &range: ranges) {
+    auto it = measurement.rangeMap.find(range.key.hash());
+    REQUIRE(it != measurement.rangeMap.end());
+    REQUIRE(it->name == range.key.name);
+    REQUIRE(it->permission == range.key.permission);
+  }
+
+  MemInfo storedMemInfo;
+  QList<Measurement> processes;
+  REQUIRE(storage.getSystemMemoryAt(time, storedMemInfo, processes));
+  REQUIRE(storedMemInfo.memTotal == memInfo.memTotal);
+  REQUIRE(storedMemInfo.memAvailable == memInfo.memAvailable);
+  REQUIRE(processes.size() == 1);
+}
+
+#endif
@@ -25,32 +25,109 @@
 #include "OomScore.h"
 #include "Utils.h"
 #include "MemInfo.h"
+#include "SqliteStatement.h"
 
 #include <QtCore/QObject>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QDateTime>
+#include <QHash>
 #include <QMap>
 
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+enum class StorageMode {
+  Fast, //!< journal in memory without fsync, database may be corrupted by crash
+  Wal, //!< write-ahead log with fsync on checkpoint, checkpoints are not done by writer
+  ReadOnly //!< for analysis, database may be opened while it is recorded in Wal mode
+};
+
+/** Peak of one process memory type, see Storage::getProcessPeaks */
+struct PeakValue {
+  qulonglong measurementId{0};
+  qlonglong value{-1};
+};
+
+struct ProcessPeaks {
+  PeakValue rss;
+  PeakValue pss;
+  PeakValue statm;
+
+  const PeakValue &get(ProcessMemoryType type) const
+  {
+    return type == Rss ? rss : (type == Pss ? pss : statm);
+  }
+};
+
 class Storage : public QObject {
   Q_OBJECT
   Q_DISABLE_COPY_MOVE(Storage)
+  friend class MeasurementSeries;
 
 signals:
 public slots:
 public:
+  /**
+   * Version of schema created for new databases. Version 2 stores time as milliseconds
+   * since epoch, hashes as signed integers and names of ranges in `string` table.
+   * Version 3 adds keyframe of delta measurements, version 4 `data_blob` table. Versions 2 and 3
+   * are upgraded when they are opened for writing. Databases with older schema may be read,
+   * writes require conversion by memory-migrate.
+   */
+  static constexpr int SchemaVersion = 4;
+
+  /** Parse data format name (rows, blob, compressed-blob) */
+  static bool parseDataFormat(const QString &str, DataFormat &format);
+
   Storage() = default;
   ~Storage();
 
   bool updateSchema();
-  bool init(QString file);
+  bool init(QString file, StorageMode mode = StorageMode::Fast);
+
+  /**
+   * Create indexes used by analysis queries when they are missing (recordings created
+   * by older versions). They are created by separate connection, so it works with database
+   * opened read-only as well. Database file has to be writable. Creation is skipped when
+   * the recording may be in progress, so recorder is never blocked by it.
+   */
+  bool ensureIndexes();
+
+  /** Schema version of opened database, 1 for databases created before versioning */
+  int schemaVersion() const
+  {
+    return version;
+  }
+
+  /**
+   * Copy recording with schema v1 to this database.
+   * It should be empty database just created with the current schema.
+   */
+  bool importV1(const QString &file);
+
+  /**
+   * Copy binary log written by memory-record to this database, see BinLog.
+   * Records of transaction interrupted by crash are skipped.
+   */
+  bool importBinLog(const QString &directory);
+
+  /**
+   * Passive checkpoint of write-ahead log, it doesn't block writers.
+   * @param walFrames number of frames in the log
+   * @param checkpointedFrames number of frames moved to the database
+   * @param busy true when checkpoint was not finished because of other connection
+   */
+  bool checkpoint(int &walFrames, int &checkpointedFrames, bool &busy);
 
   bool insertOrIgnoreProcess(const ProcessId &processId, const QString &name);
 
-  qlonglong insertOrIgnoreRange(const SmapsRange::Key &range);
+  bool insertOrIgnoreRange(const SmapsRange::Key &range);
 
   qlonglong insertMeasurement(const ProcessId &processId,
                               const QDateTime &time,
+                              SampleType sampleType,
                               qlonglong rss,
                               qlonglong pss,
                               const StatM &statm,
@@ -64,8 +141,19 @@ public:
 
   bool insertSystemMemInfo(const QDateTime &time, const MemInfo &memInfo);
 
+  bool insertRecorderStats(const QDateTime &time, const QMap<QString, qlonglong> &values);
+
   qint64 measurementCount();
 
+  /**
+   * Time of the first system snapshot, or the first measurement when there is none.
+   * Time is invalid for empty database.
+   */
+  bool getFirstTime(QDateTime &time);
+
+  /** Check whether the measurement is stored in this database, without warning when it is not */
+  bool containsMeasurement(qlonglong id);
+
   bool lookupPid(pid_t pid, QMap<ProcessId, QString> &processes);
 
   bool getProcess(qulonglong processId, pid_t &pid, QString &processName);
@@ -74,6 +162,12 @@ public:
                      Measurement &measurement,
                      ProcessMemoryType type = Rss);
 
+  /**
+   * Peaks of all processes, found by single scan of measurement table.
+   * @param peaks map from process id to its peaks
+   */
+  bool getProcessPeaks(QHash<qulonglong, ProcessPeaks> &peaks);
+
   bool getMeasurementAtOrBefore(qulonglong processId,
                                 const QDateTime &time,
                                 Measurement &measurement,
@@ -86,19 +180,28 @@ public:
 
   bool getMeasurement(Measurement &measurement, qlonglong &id, bool cacheRanges = false);
 
+  /*
+   * System memory snapshots. Processes contain just measurement level values (Rss/Pss sums,
+   * statm and oom score) read by single joined query, their ranges and data rows are read
+   * just when withRanges is true.
+   */
+
   bool getSystemMemoryPeak(SystemMemoryType memoryType,
                            QDateTime &time,
                            MemInfo &memInfo,
-                           QList<Measurement> &processes);
+                           QList<Measurement> &processes,
+                           bool withRanges = false);
 
   bool getSystemMemoryAtOrBefore(const QDateTime &time,
                                  QDateTime &exactTime,
                                  MemInfo &memInfo,
-                                 QList<Measurement> &processes);
+                                 QList<Measurement> &processes,
+                                 bool withRanges = false);
 
   bool getSystemMemoryAt(const QDateTime &time,
                          MemInfo &memInfo,
-                         QList<Measurement> &processes);
+                         QList<Measurement> &processes,
+                         bool withRanges = false);
 
   bool getMeasurementTimes(qulonglong processId, QList<QDateTime> &times);
 
@@ -106,6 +209,55 @@ public:
 
   bool getAllRanges(qulonglong processId, QMap<qulonglong, Range> &rangeMap);
 
+  /**
+   * Measurements of the process in time range (inclusive), ordered by time, read by single scan.
+   * Ranges of the process are read once and shared by all measurements.
+   * @param callback called for every measurement, scan is stopped when it returns false
+   */
+  bool getMeasurementSeries(qulonglong processId,
+                            const QDateTime &from,
+                            const QDateTime &to,
+                            const std::function<bool(const Measurement&)> &callback);
+
+  /**
+   * Use sqlite3 C API for inserts. It is enabled by default when QSQLITE driver
+   * uses the same sqlite library as we are linked with.
+   * @return true when native inserts are used
+   */
+  bool setNativeWrites(bool enabled);
+
+  /**
+   * Delta recording of full smaps measurements. Data row is written just for range
+   * with changed rss or pss, range that disappeared since previous measurement of the process
+   * has row with negative rss. Every keyframeInterval-th measurement of the process is keyframe
+   * with all ranges, reads rebuild delta measurement from at most keyframeInterval measurements.
+   * @param keyframeInterval zero disables delta recording, all measurements are full
+   */
+  void setDeltaRecording(int keyframeInterval);
+
+  /**
+   * Format of inserted data rows. Blob takes less space and it is faster to read whole
+   * measurement, rows may be selected by range. Reads support all formats.
+   */
+  void setDataFormat(DataFormat format);
+
+  /** Drop delta recording state of exited process */
+  void forgetProcess(const ProcessId &processId);
+
+  /**
+   * Use sqlite3 C API for reads, rows are decoded by column indexes without QVariant.
+   * It is enabled by default for schema v2 when QSQLITE driver uses the same sqlite library
+   * as we are linked with.
+   * @return true when native reads are used
+   */
+  bool setNativeReads(bool enabled);
+
+  /**
+   * Read queries are prepared once per connection and reused with new bindings.
+   * It is enabled by default, disabled cache prepares query on every call.
+   */
+  void setStatementCache(bool enabled);
+
   bool transaction()
   {
     return db.transaction();
@@ -113,26 +265,209 @@ public:
 
   bool commit()
   {
-    return db.commit();
+    if (!db.commit()) {
+      // strings and keyframes inserted by the transaction are not stored
+      stringIds.clear();
+      deltaStates.clear();
+      insertedMeasurements.clear();
+      blobReferences.clear();
+      return false;
+    }
+    return true;
   }
 
   bool rollback()
   {
+    stringIds.clear();
+    deltaStates.clear();
+    insertedMeasurements.clear();
+    blobReferences.clear();
     return db.rollback();
   }
 
 private:
-  bool execAndGetSystemMemory(QSqlQuery &sql, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes);
+  bool readSchemaVersion();
+  bool createSchema();
+  bool upgradeSchema();
+
+  /** Id of the string in dictionary, it is inserted when it doesn't exist yet */
+  qlonglong stringId(const QString &value);
+
+  // representation of hashes and time in the schema of opened database
+  QVariant idValue(qulonglong id) const;
+  qulonglong idFromValue(const QVariant &value) const;
+  QVariant timeValue(const QDateTime &time) const;
+  QDateTime timeFromValue(const QVariant &value) const;
+
+
+  /** Read query prepared for the statement, it has to be finished when it is not used anymore */
+  QSqlQuery &readQuery(const char *statement);
+
+  /** Native read statement with indexes of requested result columns, resolved once after prepare */
+  struct NativeQuery {
+    SqliteStatement statement;
+    std::vector<int> columns; //!< in order of requested columns, -1 when result doesn't contain it
+
+    qlonglong value(int column) const
+    {
+      return statement.columnLong(columns[column]);
+    }
+  };
+
+  /** Native variant of readQuery, statement has to be reset when it is not used anymore */
+  NativeQuery &nativeQuery(const char *statement, const std::vector<const char*> &columns);
+
+  bool execAndGetSystemMemory(QSqlQuery &systemQuery, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes,
+                              bool withRanges);
   bool execAndGetMeasurement(Measurement &measurement, QSqlQuery &measurementQuery, bool cacheRanges);
   bool getMeasurement(Measurement &measurement, QSqlQuery &measurementQuery, bool cacheRanges);
   bool getRanges(QMap<qulonglong, Range> &rangeMap, QSqlQuery &sql);
+  bool getMeasurementDetails(Measurement &measurement, bool cacheRanges);
+
+  /**
+   * Data rows of measurement, stored in data table or as blob
+   * @param blob true when data are stored as blob
+   */
+  bool getData(qlonglong measurementId, QList<MeasurementData> &data, bool &blob);
+
+  /** Data of delta measurement, applied to its keyframe, by range id */
+  bool getDeltaData(const Measurement &measurement, QMap<qlonglong, MeasurementData> &data);
+
+  // native reads, just for schema v2
+  bool execAndGetSystemMemory(NativeQuery &systemQuery, QDateTime &time, MemInfo &memInfo, QList<Measurement> &processes,
+                              bool withRanges);
+  bool execAndGetMeasurement(Measurement &measurement, NativeQuery &measurementQuery, bool cacheRanges);
+  bool getRanges(QMap<qulonglong, Range> &rangeMap, NativeQuery &query);
+  static void decodeMeasurement(const NativeQuery &query, Measurement &measurement);
+  void decodeMeasurement(const QSqlQuery &query, Measurement &measurement) const;
+
+  bool initNativeHandle();
+
+  bool initNativeWrites();
+
+  // rows are SmapsRange or MeasurementData, delta rows are not complete data of the process
+  template <typename Row>
+  bool insertDataRows(qulonglong processId, qlonglong measurementId, const QList<Row> &rows, bool delta = false);
+  template <typename Row>
+  bool nativeInsertData(qlonglong measurementId, const QList<Row> &rows);
+  bool insertDataBlob(qulonglong processId, qlonglong measurementId, std::vector<MeasurementData> &rows, bool delta);
+  /** Decode data blob, range ids of its reference blob are read when needed */
+  bool decodeDataBlob(const QByteArray &blob, QList<MeasurementData> &rows);
+
+  /** Self-contained data blob, next blobs of the process encode range ids against it */
+  struct BlobReference {
+    qlonglong measurementId{0};
+    std::vector<qlonglong> rangeIds; //!< sorted
+  };
+
+  /** Delta recording state of one process */
+  struct DeltaState {
+    qlonglong keyframeId{0};
+    qlonglong measurementId{0}; //!< last inserted measurement, its data are expected
+    int deltas{0}; //!< delta measurements since keyframe
+    QHash<qlonglong, MeasurementData> ranges; //!< values of ranges written by the chain, by range id
+  };
+
+  /** Id of new measurement, ids grow with time */
+  qlonglong nextMeasurementId(const QDateTime &time);
+
+  /** The last inserted measurement of process, its data are expected */
+  struct InsertedMeasurement {
+    qint64 time{0}; //!< milliseconds since epoch
+    qlonglong id{0};
+  };
+
+  /** Keyframe of inserted measurement, zero when it is keyframe itself */
+  qlonglong deltaKeyframe(qulonglong processId, qlonglong measurementId);
+  bool insertDeltaData(DeltaState &state, qulonglong processId, qlonglong measurementId,
+                       const QList<SmapsRange> &ranges);
 
 private:
+  QString connectionName;
   QSqlDatabase db;
+  int version{0};
+  QHash<QString, qlonglong> stringIds;
+  QSqlQuery sqlStringInsert;
+  QSqlQuery sqlStringSelect;
   QSqlQuery sqlProcessInsert;
   QSqlQuery sqlRangeInsert;
   QSqlQuery sqlMeasurementInsert;
   QSqlQuery sqlDataInsert;
+  QSqlQuery sqlDataBlobInsert;
   QSqlQuery sqlSystemInsert;
+  QSqlQuery sqlRecorderStatsInsert;
+  QHash<const char*, QSqlQuery> readQueries; //!< prepared read queries, statements are string constants
+  bool statementCache{true};
+  std::unordered_map<const char*, NativeQuery> nativeQueries; //!< prepared native read statements
+
+  sqlite3 *handle{nullptr}; //!< owned by QSQLITE driver
+  bool nativeAvailable{false};
+  bool nativeWrites{false};
+  bool nativeReads{false};
+  SqliteStatement nativeProcessInsert;
+  SqliteStatement nativeRangeInsert;
+  SqliteStatement nativeMeasurementInsert;
+  SqliteStatement nativeDataInsert;
+  SqliteStatement nativeDataBulkInsert;
+  SqliteStatement nativeDataBlobInsert;
+  SqliteStatement nativeSystemInsert;
+  SqliteStatement nativeRecorderStatsInsert;
+
+  DataFormat dataFormat{DataFormat::Rows};
+  int keyframeInterval{0}; //!< zero when delta recording is disabled
+  qlonglong lastMeasurementId{0};
+  QHash<qulonglong, InsertedMeasurement> insertedMeasurements; //!< by process id
+  QHash<qulonglong, DeltaState> deltaStates; //!< by process id
+  QHash<qulonglong, BlobReference> blobReferences; //!< by process id
+  BlobReference decodedReference; //!< the last reference blob read by decodeDataBlob
 };
 
+/**
+ * Ordered scan of process measurements in time range, together with their data rows.
+ * Measurements are decoded one by one when they are requested, so the whole history
+ * is never loaded to memory. Series keeps its statement open, it has to be destroyed
+ * before the storage.
+ */
+class MeasurementSeries {
+  Q_DISABLE_COPY_MOVE(MeasurementSeries)
+
+public:
+  MeasurementSeries(Storage &storage, qulonglong processId, const QDateTime &from, const QDateTime &to);
+  ~MeasurementSeries();
+
+  bool isValid() const
+  {
+    return valid;
+  }
+
+  /** Read next measurement of the series, false on the end or error (see hasError) */
+  bool next(Measurement &measurement);
+
+  /** Reading of the series failed, measurements returned so far are valid */
+  bool hasError() const
+  {
+    return failed;
+  }
+
+private:
+  bool step();
+  qulonglong rowMeasurementId() const;
+
+private:
+  Storage &storage;
+  bool native{false};
+  Storage::NativeQuery nativeQuery;
+  QSqlQuery query;
+  bool valid{false};
+  bool failed{false};
+  bool hasRow{false}; //!< current row is the first one of the next measurement
+  pid_t pid{0};
+  QString processName;
+  QMap<qulonglong, Range> ranges;
+
+  // delta measurements are applied to the previous measurement of their keyframe chain
+  qulonglong keyframeId{0};
+  QList<MeasurementData> keyframeData;
+  qulonglong chainKeyframeId{0};
+  QMap<qlonglong, MeasurementData> chainData;
+};
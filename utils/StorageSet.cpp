@@ -0,0 +1,469 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "StorageSet.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+qlonglong memoryValue(const Measurement &measurement, ProcessMemoryType type)
+{
+  return type == Rss ? measurement.rssSum :
+         (type == Pss ? measurement.pssSum : qlonglong(measurement.statm.resident));
+}
+
+// the same expressions as peak queries of Storage
+qint64 availableMemory(const MemInfo &memInfo, SystemMemoryType type)
+{
+  if (type == MemAvailable) {
+    return qint64(memInfo.memAvailable);
+  }
+  return qint64(memInfo.memFree + memInfo.buffers) + (qint64(memInfo.cached) - qint64(memInfo.shmem)) +
+         qint64(memInfo.swapCache + memInfo.sReclaimable);
+}
+
+} // namespace
+
+QStringList StorageSet::files(const QString &path)
+{
+  QFileInfo info(path);
+  QDir dir;
+  QString pattern;
+  if (info.isDir()) {
+    dir = QDir(path);
+    pattern = "*.db";
+  } else if (info.exists()) {
+    return {path};
+  } else {
+    dir = info.dir();
+    pattern = info.fileName();
+  }
+  QStringList result;
+  for (const QString &name: dir.entryList({pattern}, QDir::Files, QDir::Name)) {
+    result << dir.filePath(name);
+  }
+  return result;
+}
+
+bool StorageSet::init(const QString &path)
+{
+  storages.clear();
+  const QStringList names = files(path);
+  if (names.isEmpty()) {
+    qWarning() << "No database file found" << path;
+    return false;
+  }
+  for (const QString &name: names) {
+    File file;
+    file.name = name;
+    file.storage = std::make_unique<Storage>();
+    if (!file.storage->init(name, StorageMode::ReadOnly)) {
+      qWarning() << "Failed to open database" << name;
+      return false;
+    }
+    if (!file.storage->getFirstTime(file.firstTime)) {
+      return false;
+    }
+    storages.push_back(std::move(file));
+  }
+  // empty databases don't contain anything, they are moved to the beginning
+  auto key = [](const File &file) {
+    return file.firstTime.isValid() ? file.firstTime.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+  };
+  std::stable_sort(storages.begin(), storages.end(), [&key](const File &a, const File &b) {
+    return key(a) < key(b);
+  });
+  return true;
+}
+
+int StorageSet::lastFileAtOrBefore(const QDateTime &time) const
+{
+  for (int i = size() - 1; i >= 0; i--) {
+    const QDateTime &firstTime = storages[size_t(i)].firstTime;
+    if (firstTime.isValid() && firstTime <= time) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool StorageSet::containsProcess(int i, qulonglong processId)
+{
+  pid_t pid;
+  QString processName;
+  return storage(i).getProcess(processId, pid, processName);
+}
+
+bool StorageSet::ensureIndexes()
+{
+  bool result = true;
+  for (File &file: storages) {
+    result = file.storage->ensureIndexes() && result;
+  }
+  return result;
+}
+
+bool StorageSet::lookupPid(pid_t pid, QMap<ProcessId, QString> &processes)
+{
+  for (File &file: storages) {
+    if (!file.storage->lookupPid(pid, processes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StorageSet::getProcess(qulonglong processId, pid_t &pid, QString &processName)
+{
+  for (File &file: storages) {
+    if (file.storage->getProcess(processId, pid, processName)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StorageSet::getMemoryPeak(qulonglong processId, Measurement &measurement, ProcessMemoryType type)
+{
+  bool found = false;
+  for (int i = 0; i < size(); i++) {
+    Measurement peak;
+    if (!containsProcess(i, processId) || !storage(i).getMemoryPeak(processId, peak, type)) {
+      continue;
+    }
+    if (!found || memoryValue(peak, type) > memoryValue(measurement, type)) {
+      measurement = peak;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool StorageSet::getProcessPeaks(QHash<qulonglong, ProcessPeaks> &peaks)
+{
+  auto update = [](PeakValue &peak, const PeakValue &filePeak) {
+    if (filePeak.value > peak.value) {
+      peak = filePeak;
+    }
+  };
+
+  for (File &file: storages) {
+    QHash<qulonglong, ProcessPeaks> filePeaks;
+    if (!file.storage->getProcessPeaks(filePeaks)) {
+      return false;
+    }
+    for (auto it = filePeaks.cbegin(); it != filePeaks.cend(); ++it) {
+      ProcessPeaks &processPeaks = peaks[it.key()];
+      update(processPeaks.rss, it->rss);
+      update(processPeaks.pss, it->pss);
+      update(processPeaks.statm, it->statm);
+    }
+  }
+  return true;
+}
+
+bool StorageSet::getMeasurementAtOrBefore(qulonglong processId,
+                                          const QDateTime &time,
+                                          Measurement &measurement,
+                                          bool cacheRanges)
+{
+  for (int i = lastFileAtOrBefore(time); i >= 0; i--) {
+    if (containsProcess(i, processId) &&
+        storage(i).getMeasurementAtOrBefore(processId, time, measurement, cacheRanges)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StorageSet::getMeasurement(Measurement &measurement, qlonglong &id, bool cacheRanges)
+{
+  for (File &file: storages) {
+    if (file.storage->containsMeasurement(id)) {
+      return file.storage->getMeasurement(measurement, id, cacheRanges);
+    }
+  }
+  qWarning() << "No measurement found" << id;
+  return false;
+}
+
+bool StorageSet::getSystemMemoryPeak(SystemMemoryType memoryType,
+                                     QDateTime &time,
+                                     MemInfo &memInfo,
+                                     QList<Measurement> &processes,
+                                     bool withRanges)
+{
+  bool found = false;
+  for (File &file: storages) {
+    QDateTime peakTime;
+    MemInfo peakMemInfo;
+    QList<Measurement> peakProcesses;
+    if (!file.storage->getSystemMemoryPeak(memoryType, peakTime, peakMemInfo, peakProcesses, withRanges)) {
+      continue;
+    }
+    if (!found || availableMemory(peakMemInfo, memoryType) < availableMemory(memInfo, memoryType)) {
+      time = peakTime;
+      memInfo = peakMemInfo;
+      processes = peakProcesses;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool StorageSet::getSystemMemoryAtOrBefore(const QDateTime &time,
+                                           QDateTime &exactTime,
+                                           MemInfo &memInfo,
+                                           QList<Measurement> &processes,
+                                           bool withRanges)
+{
+  // file without system snapshots starts with process measurement
+  for (int i = lastFileAtOrBefore(time); i >= 0; i--) {
+    if (storage(i).getSystemMemoryAtOrBefore(time, exactTime, memInfo, processes, withRanges)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StorageSet::getSystemMemoryAt(const QDateTime &time,
+                                   MemInfo &memInfo,
+                                   QList<Measurement> &processes,
+                                   bool withRanges)
+{
+  int i = lastFileAtOrBefore(time);
+  return i >= 0 && storage(i).getSystemMemoryAt(time, memInfo, processes, withRanges);
+}
+
+bool StorageSet::getMeasurementTimes(qulonglong processId, QList<QDateTime> &times)
+{
+  for (int i = 0; i < size(); i++) {
+    if (containsProcess(i, processId) && !storage(i).getMeasurementTimes(processId, times)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StorageSet::getMeasurementTimes(QList<QDateTime> &times)
+{
+  for (File &file: storages) {
+    if (!file.storage->getMeasurementTimes(times)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StorageSet::getMeasurementSeries(qulonglong processId,
+                                      const QDateTime &from,
+                                      const QDateTime &to,
+                                      const std::function<bool(const Measurement&)> &callback)
+{
+  StorageSetSeries series(*this, processId, from, to);
+  if (!series.isValid()) {
+    return false;
+  }
+  Measurement measurement;
+  while (series.next(measurement)) {
+    if (!callback(measurement)) {
+      break;
+    }
+  }
+  return true;
+}
+
+StorageSetSeries::StorageSetSeries(StorageSet &storages,
+                                   qulonglong processId,
+                                   const QDateTime &from,
+                                   const QDateTime &to):
+  storages(storages),
+  processId(processId),
+  from(from),
+  to(to)
+{
+  valid = openNext();
+}
+
+bool StorageSetSeries::openNext()
+{
+  // statement of the previous series is finished before the next one is prepared
+  series.reset();
+  while (++file < storages.size()) {
+    if (!storages.containsProcess(file, processId)) {
+      continue;
+    }
+    series = std::make_unique<MeasurementSeries>(storages.storage(file), processId, from, to);
+    if (series->isValid()) {
+      return true;
+    }
+    // measurements of other files are still valid
+    qWarning() << "Failed to read measurements of" << storages.fileName(file) << ", file is skipped";
+    series.reset();
+  }
+  return false;
+}
+
+bool StorageSetSeries::next(Measurement &measurement)
+{
+  while (series != nullptr) {
+    if (series->next(measurement)) {
+      return true;
+    }
+    if (series->hasError()) {
+      qWarning() << "Failed to read measurements of" << storages.fileName(file) << ", rest of the file is skipped";
+    }
+    openNext();
+  }
+  return false;
+}
+
+#ifdef UNIT_TESTS
+
+#include "TestFixture.h"
+
+#include <catch2/catch.hpp>
+
+#include <QFile>
+#include <QTemporaryDir>
+
+TEST_CASE("storage set reads rotated databases in time order") {
+  TestFixture::Application app;
+
+  QTemporaryDir dir;
+  REQUIRE(dir.isValid());
+
+  ProcessId processId = TestFixture::processId();
+  QList<SmapsRange> ranges = TestFixture::ranges(1);
+  SmapsRange &range = ranges[0];
+  QDateTime start = TestFixture::start();
+
+  // name order is different from time order, every file has its own process and range rows
+  const QStringList names{"measurement-b.db", "measurement-a.db"};
+  for (int f = 0; f < names.size(); f++) {
+    Storage storage;
+    REQUIRE(storage.init(dir.filePath(names[f])));
+    REQUIRE(TestFixture::insertProcess(storage, ranges));
+    for (int i = 0; i < 3; i++) {
+      QDateTime time = start.addSecs(f * 3 + i);
+      range.rss = f == 0 && i == 1 ? 100 : f * 3 + i;
+      REQUIRE(storage.insertMeasurement(processId, time, FullSmaps, range.rss, range.rss, StatM{}, OomScore{}) != 0);
+      REQUIRE(storage.insertData(processId, time, {range}));
+      MemInfo memInfo;
+      memInfo.memAvailable = 1000 - range.rss;
+      REQUIRE(storage.insertSystemMemInfo(time, memInfo));
+    }
+    REQUIRE(storage.commit());
+  }
+  // database just created by rotation
+  {
+    Storage storage;
+    REQUIRE(storage.init(dir.filePath("measurement-c.db")));
+  }
+  QFile other(dir.filePath("other.txt"));
+  REQUIRE(other.open(QIODevice::WriteOnly));
+
+  REQUIRE(StorageSet::files(dir.path()).size() == 3);
+  REQUIRE(StorageSet::files(dir.filePath("measurement-*.db")).size() == 3);
+  REQUIRE(StorageSet::files(dir.filePath(names[0])) == QStringList{dir.filePath(names[0])});
+  REQUIRE(StorageSet::files(dir.filePath("missing-*.db")).isEmpty());
+
+  StorageSet storages;
+  REQUIRE(storages.init(dir.path()));
+  REQUIRE(storages.size() == 3);
+
+  QMap<ProcessId, QString> processes;
+  REQUIRE(storages.lookupPid(42, processes));
+  REQUIRE(processes.size() == 1);
+
+  QList<QDateTime> times;
+  REQUIRE(storages.getMeasurementTimes(processId.hash(), times));
+  REQUIRE(times.size() == 6);
+  for (int i = 0; i < times.size(); i++) {
+    REQUIRE(times[i] == start.addSecs(i));
+  }
+  QList<QDateTime> systemTimes;
+  REQUIRE(storages.getMeasurementTimes(systemTimes));
+  REQUIRE(systemTimes == times);
+
+  QList<Measurement> series;
+  REQUIRE(storages.getMeasurementSeries(processId.hash(), start.addSecs(1), start.addSecs(4),
+                                        [&](const Measurement &measurement) {
+                                          series << measurement;
+                                          return true;
+                                        }));
+  REQUIRE(series.size() == 4);
+  REQUIRE(series[0].time == start.addSecs(1));
+  REQUIRE(series[3].time == start.addSecs(4));
+  REQUIRE(series[3].data.size() == 1);
+  REQUIRE(series[3].rangeMap.size() == 1);
+
+  Measurement measurement;
+  REQUIRE(storages.getMemoryPeak(processId.hash(), measurement, Rss));
+  REQUIRE(measurement.rssSum == 100);
+  REQUIRE(measurement.time == start.addSecs(1));
+
+  QHash<qulonglong, ProcessPeaks> peaks;
+  REQUIRE(storages.getProcessPeaks(peaks));
+  REQUIRE(peaks.size() == 1);
+  REQUIRE(peaks[processId.hash()].rss.value == 100);
+  qlonglong peakId = qlonglong(peaks[processId.hash()].rss.measurementId);
+  REQUIRE(storages.getMeasurement(measurement, peakId));
+  REQUIRE(measurement.time == start.addSecs(1));
+
+  REQUIRE(storages.getMeasurementAtOrBefore(processId.hash(), start.addSecs(4), measurement, false));
+  REQUIRE(measurement.time == start.addSecs(4));
+
+  QDateTime time;
+  MemInfo memInfo;
+  QList<Measurement> systemProcesses;
+  REQUIRE(storages.getSystemMemoryAtOrBefore(start.addSecs(10), time, memInfo, systemProcesses));
+  REQUIRE(time == start.addSecs(5));
+  REQUIRE(systemProcesses.size() == 1);
+  systemProcesses.clear();
+  REQUIRE(storages.getSystemMemoryPeak(MemAvailable, time, memInfo, systemProcesses));
+  REQUIRE(time == start.addSecs(1));
+  REQUIRE(memInfo.memAvailable == 900);
+  systemProcesses.clear();
+  REQUIRE(storages.getSystemMemoryAt(start.addSecs(2), memInfo, systemProcesses));
+  REQUIRE(systemProcesses.size() == 1);
+  REQUIRE(!storages.getSystemMemoryAt(start.addSecs(-1), memInfo, systemProcesses));
+
+  // file that can't be read is skipped, measurements of the following files are returned
+  sqlite3 *db = nullptr;
+  REQUIRE(sqlite3_open_v2(dir.filePath(names[0]).toUtf8().constData(), &db, SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK);
+  REQUIRE(sqlite3_exec(db, "DROP TABLE `data`;", nullptr, nullptr, nullptr) == SQLITE_OK);
+  sqlite3_close(db);
+  series.clear();
+  REQUIRE(storages.getMeasurementSeries(processId.hash(), start, start.addSecs(5),
+                                        [&](const Measurement &measurement) {
+                                          series << measurement;
+                                          return true;
+                                        }));
+  REQUIRE(series.size() == 3);
+  REQUIRE(series[0].time == start.addSecs(3));
+}
+
+#endif
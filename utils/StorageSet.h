@@ -0,0 +1,167 @@
+/*
+  Memory watcher
+  Copyright (C) 2021 Lukas Karas <lukas.karas@centrum.cz>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include "Storage.h"
+
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Read-only view of recording split to multiple database files by rotation of memory-record.
+ * Every file is self-contained (it has own process and memory_range rows), files are queried
+ * one by one in time order, so they don't need to be merged before analysis.
+ * Measurement ids are hashes of process and time, so they are unique across the files.
+ */
+class StorageSet {
+  Q_DISABLE_COPY_MOVE(StorageSet)
+
+public:
+  StorageSet() = default;
+  ~StorageSet() = default;
+
+  /**
+   * Database files given by path: single file, all *.db files of the directory
+   * or files matching wildcard pattern (measurement-*.db). Files are ordered by name.
+   */
+  static QStringList files(const QString &path);
+
+  /** Open database files given by path read-only, they are ordered by time of their first snapshot */
+  bool init(const QString &path);
+
+  int size() const
+  {
+    return int(storages.size());
+  }
+
+  /** Storage of the i-th file in time order */
+  Storage &storage(int i)
+  {
+    return *storages[size_t(i)].storage;
+  }
+
+  /** Name of the i-th file in time order */
+  QString fileName(int i) const
+  {
+    return storages[size_t(i)].name;
+  }
+
+  /** See Storage::ensureIndexes */
+  bool ensureIndexes();
+
+  bool lookupPid(pid_t pid, QMap<ProcessId, QString> &processes);
+
+  bool getProcess(qulonglong processId, pid_t &pid, QString &processName);
+
+  bool getMemoryPeak(qulonglong processId,
+                     Measurement &measurement,
+                     ProcessMemoryType type = Rss);
+
+  bool getProcessPeaks(QHash<qulonglong, ProcessPeaks> &peaks);
+
+  bool getMeasurementAtOrBefore(qulonglong processId,
+                                const QDateTime &time,
+                                Measurement &measurement,
+                                bool cacheRanges);
+
+  bool getMeasurement(Measurement &measurement, qlonglong &id, bool cacheRanges = false);
+
+  bool getSystemMemoryPeak(SystemMemoryType memoryType,
+                           QDateTime &time,
+                           MemInfo &memInfo,
+                           QList<Measurement> &processes,
+                           bool withRanges = false);
+
+  bool getSystemMemoryAtOrBefore(const QDateTime &time,
+                                 QDateTime &exactTime,
+                                 MemInfo &memInfo,
+                                 QList<Measurement> &processes,
+                                 bool withRanges = false);
+
+  bool getSystemMemoryAt(const QDateTime &time,
+                         MemInfo &memInfo,
+                         QList<Measurement> &processes,
+                         bool withRanges = false);
+
+  bool getMeasurementTimes(qulonglong processId, QList<QDateTime> &times);
+
+  bool getMeasurementTimes(QList<QDateTime> &times);
+
+  /** See Storage::getMeasurementSeries, files of the set are scanned in time order */
+  bool getMeasurementSeries(qulonglong processId,
+                            const QDateTime &from,
+                            const QDateTime &to,
+                            const std::function<bool(const Measurement&)> &callback);
+
+  /** Check whether the i-th file contains the process, without warning when it doesn't */
+  bool containsProcess(int i, qulonglong processId);
+
+private:
+  struct File {
+    QString name;
+    QDateTime firstTime; //!< invalid for empty database
+    std::unique_ptr<Storage> storage;
+  };
+
+  /** Index of the last file started at or before the time, -1 when there is no such file */
+  int lastFileAtOrBefore(const QDateTime &time) const;
+
+private:
+  std::vector<File> storages;
+};
+
+/**
+ * MeasurementSeries over all files of the set. Series of files are opened one by one,
+ * just files containing the process are scanned. File that can't be read is skipped
+ * with warning, measurements of other files are still returned.
+ */
+class StorageSetSeries {
+  Q_DISABLE_COPY_MOVE(StorageSetSeries)
+
+public:
+  StorageSetSeries(StorageSet &storages, qulonglong processId, const QDateTime &from, const QDateTime &to);
+  ~StorageSetSeries() = default;
+
+  bool isValid() const
+  {
+    return valid;
+  }
+
+  /** Read next measurement of the series, false on the end */
+  bool next(Measurement &measurement);
+
+private:
+  /** Open series of the next readable file containing the process, false when there is none */
+  bool openNext();
+
+private:
+  StorageSet &storages;
+  qulonglong processId;
+  QDateTime from;
+  QDateTime to;
+  int file{-1};
+  std::unique_ptr<MeasurementSeries> series;
+  bool valid{false};
+};
@@ -40,14 +40,10 @@ struct ProcessMemory {
     if (type == StatmRss) {
       memory = m.statm.resident;
     } else if (type == Pss) {
-      for (auto const &d : m.data) {
-        memory += d.pss;
-      }
+      memory = m.pssSum;
     } else {
       assert(type == Rss);
-      for (auto const &d : m.data) {
-        memory += d.rss;
-      }
+      memory = m.rssSum;
     }
   }
   size_t memory{0};
@@ -169,6 +165,11 @@ void Utils::group(MeasurementGroups &g, const Measurement &measurement, ProcessM
     }
     g.sum += mem;
   }
+
+  if (measurement.sampleType != FullSmaps) {
+    // there are no mappings in rollup sample, just the sum
+    g.sum = type == Rss ? measurement.rssSum : measurement.pssSum;
+  }
 }
 
 std::vector<Mapping> MeasurementGroups::sortedMappings() const
@@ -244,7 +245,13 @@ void Utils::printMeasurement(const Measurement &measurement, ProcessMemoryType t
             << "   // dirty pages (unused since Linux 2.6; always 0)" << std::endl;
 
   std::cout << std::endl;
-  std::cout << "# smaps data (" << (smapsType == Rss ? "Rss" : "Pss") << ")" << std::endl;
+  std::cout << "# smaps data (" << (smapsType == Rss ? "Rss" : "Pss") << ")";
+  if (measurement.sampleType == SmapsRollup) {
+    std::cout << " - smaps_rollup sample, memory mappings are not available";
+  } else if (measurement.sampleType == DroppedSmaps) {
+    std::cout << " - memory mappings were dropped by overloaded recorder";
+  }
+  std::cout << std::endl;
   std::cout << std::setw(indent) << std::left << "thread stacks:"
             << std::setw(memoryIndent) << std::right << printWithSeparator(g.threadStacks) << " Ki" << std::endl;
   std::cout << std::setw(indent) << std::left << "heap:"
@@ -371,6 +378,60 @@ void Utils::printProcesses(const QDateTime &time,
   printProcess("", "sum", sumSize, OomScore{});
 }
 
+void Utils::printPeaks(const QList<Measurement> &peaks, ProcessMemoryType type)
+{
+  ProcessMemoryType smapsType = type == StatmRss ? Rss : type;
+
+  constexpr int rankIndent = 4;
+  constexpr int pidIndent = 7;
+  constexpr int processIndent = 40;
+  constexpr int memoryIndent = 14;
+  constexpr int mappingCount = 3;
+  const std::string detailIndent(rankIndent + pidIndent + 2, ' ');
+
+  std::cout << std::setw(rankIndent) << std::right << "#" << " "
+            << std::setw(pidIndent) << std::right << "PID" << " "
+            << std::setw(processIndent) << std::left << "process"
+            << std::setw(memoryIndent) << std::right << "peak" << "  "
+            << "time" << std::endl;
+
+  int rank = 1;
+  for (const Measurement &measurement: peaks) {
+    size_t memory = ProcessMemory(measurement, type).memory;
+    std::cout << std::setw(rankIndent) << std::right << rank++ << " "
+              << std::setw(pidIndent) << std::right << measurement.pid << " "
+              << std::setw(processIndent) << std::left << measurement.processName.toStdString()
+              << std::setw(memoryIndent - 3) << std::right << printWithSeparator(memory) << " Ki  "
+#if QT_VERSION >= 0x050800 // Qt::ISODateWithMs was introduced in Qt 5.8
+              << measurement.time.toString(Qt::ISODateWithMs).toStdString()
+#else
+              << measurement.time.toString("yyyy-MM-ddTHH:mm:ss.zzz").toStdString()
+#endif
+              << std::endl;
+
+    if (measurement.data.isEmpty()) {
+      std::cout << detailIndent << "memory mappings are not available for this sample" << std::endl;
+      continue;
+    }
+    MeasurementGroups g;
+    group(g, measurement, smapsType, true);
+    size_t mapped = g.sum - g.threadStacks - g.heap - g.anonymous - g.sockets;
+    std::cout << detailIndent << (smapsType == Rss ? "Rss" : "Pss") << ": "
+              << "thread stacks " << printWithSeparator(g.threadStacks) << " Ki, "
+              << "heap " << printWithSeparator(g.heap) << " Ki, "
+              << "anonymous " << printWithSeparator(g.anonymous) << " Ki, "
+              << "sockets " << printWithSeparator(g.sockets) << " Ki, "
+              << "mappings " << printWithSeparator(mapped) << " Ki" << std::endl;
+    int i = 0;
+    for (const auto &m: g.sortedMappings()) {
+      if (i++ >= mappingCount) {
+        break;
+      }
+      std::cout << detailIndent << "  " << m.name << " " << printWithSeparator(m.size) << " Ki" << std::endl;
+    }
+  }
+}
+
 void Utils::clearScreen()
 {
   //system("clear");
@@ -384,4 +445,7 @@ void Utils::registerQtMetatypes() {
   qRegisterMetaType<OomScore>("OomScore");
   qRegisterMetaType<QList<SmapsRange>>("QList<SmapsRange>");
   qRegisterMetaType<MemInfo>("MemInfo");
+  qRegisterMetaType<SampleType>("SampleType");
+  qRegisterMetaType<DataFormat>("DataFormat");
+  qRegisterMetaType<QMap<QString, qlonglong>>("QMap<QString,qlonglong>");
 }
\ No newline at end of file
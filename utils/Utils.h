@@ -39,6 +39,27 @@
 
 constexpr size_t PageSizeKiB = 4;
 
+/**
+ * Kind of process sample. Full smaps sample contains memory mappings,
+ * other samples just process-wide Rss and Pss sums.
+ */
+enum SampleType {
+  FullSmaps = 0,   // /proc/<pid>/smaps
+  SmapsRollup = 1, // /proc/<pid>/smaps_rollup
+  DroppedSmaps = 2 // full smaps was read, but mappings were dropped by overloaded recorder
+};
+
+Q_DECLARE_METATYPE(SampleType)
+
+/** How data rows of full smaps measurement are stored */
+enum class DataFormat {
+  Rows, // row per memory range in data table
+  Blob, // single blob per measurement in data_blob table, see DataBlob
+  CompressedBlob // blob compressed by qCompress
+};
+
+Q_DECLARE_METATYPE(DataFormat)
+
 struct MeasurementData {
   qlonglong rangeId{0};
   qlonglong rss{0};
@@ -58,6 +79,10 @@ struct Measurement {
   pid_t pid;
   QString processName;
   QDateTime time;
+  SampleType sampleType{FullSmaps};
+  qulonglong keyframeId{0}; //!< keyframe of measurement recorded as delta, see Storage::setDeltaRecording
+  qlonglong rssSum{0};
+  qlonglong pssSum{0};
   OomScore oomScore;
   StatM statm;
   QMap<qulonglong, Range> rangeMap;
@@ -110,6 +135,11 @@ public:
   static void printProcesses(const QDateTime &time,
                              const MemInfo &memInfo,
                              const QList<Measurement> &processes, ProcessMemoryType processType);
+  /**
+   * Print peak measurements of processes in given order, with breakdown of the peak
+   * to thread stacks, heap, anonymous memory and the biggest mappings.
+   */
+  static void printPeaks(const QList<Measurement> &peaks, ProcessMemoryType type);
   static void clearScreen();
   static void registerQtMetatypes();
 };